@@ -0,0 +1,225 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Size-class slab allocator for the main Lua state.
+ *
+ * Blocks up to LEM_ALLOC_CLASSES * LEM_ALLOC_GRANULE bytes are carved
+ * out of ALLOC_SLABSIZE slabs dedicated to a single size class and
+ * recycled through per-class free lists. Lua always tells us the old
+ * size of a block, so no per-block header is needed. Larger blocks go
+ * straight to malloc().
+ *
+ * The main Lua state is only ever touched by the event loop thread,
+ * so the allocator state is simply owned by that state rather than
+ * being thread-local.
+ */
+
+#define ALLOC_SLABSIZE (64*1024)
+#define ALLOC_MAXSIZE  (LEM_ALLOC_CLASSES * LEM_ALLOC_GRANULE)
+
+struct alloc_block {
+	struct alloc_block *next;
+};
+
+struct alloc_class {
+	struct alloc_block *free;
+	char *next;
+	char *end;
+};
+
+struct alloc_slab {
+	struct alloc_slab *next;
+};
+
+struct alloc_state {
+	struct alloc_class classes[LEM_ALLOC_CLASSES];
+	struct alloc_slab *slabs;
+	struct lem_alloc_stats stats;
+};
+
+/* slab headers take up one granule */
+LEM_BUILD_ASSERT(sizeof(struct alloc_slab) <= LEM_ALLOC_GRANULE);
+
+static struct alloc_state *alloc_slab;
+
+static inline unsigned int
+alloc_class(size_t size)
+{
+	return (size - 1) / LEM_ALLOC_GRANULE;
+}
+
+static void *
+alloc_small(struct alloc_state *st, unsigned int c)
+{
+	struct alloc_class *ac = &st->classes[c];
+	size_t size = (c + 1) * LEM_ALLOC_GRANULE;
+	void *p;
+
+	if (ac->free) {
+		p = ac->free;
+		ac->free = ac->free->next;
+	} else {
+		if (ac->next + size > ac->end) {
+			struct alloc_slab *slab = malloc(ALLOC_SLABSIZE);
+
+			if (slab == NULL)
+				return NULL;
+
+			slab->next = st->slabs;
+			st->slabs = slab;
+			ac->next = (char *)slab + LEM_ALLOC_GRANULE;
+			ac->end = (char *)slab + ALLOC_SLABSIZE;
+			st->stats.classes[c].slabs++;
+		}
+		p = ac->next;
+		ac->next += size;
+	}
+
+	st->stats.classes[c].allocs++;
+	st->stats.classes[c].inuse++;
+	return p;
+}
+
+static inline void
+alloc_small_free(struct alloc_state *st, void *p, unsigned int c)
+{
+	struct alloc_block *b = p;
+
+	b->next = st->classes[c].free;
+	st->classes[c].free = b;
+	st->stats.classes[c].inuse--;
+}
+
+static void *
+alloc_lua(void *ud, void *ptr, size_t osize, size_t nsize)
+{
+	struct alloc_state *st = ud;
+	void *p;
+
+	if (ptr == NULL)
+		osize = 0; /* osize encodes the object type */
+
+	if (nsize == 0) {
+		if (ptr == NULL)
+			return NULL;
+		if (osize <= ALLOC_MAXSIZE)
+			alloc_small_free(st, ptr, alloc_class(osize));
+		else {
+			st->stats.large_inuse -= osize;
+			free(ptr);
+		}
+		return NULL;
+	}
+
+	if (nsize <= ALLOC_MAXSIZE) {
+		unsigned int c = alloc_class(nsize);
+
+		if (ptr != NULL && osize <= ALLOC_MAXSIZE &&
+				alloc_class(osize) == c)
+			return ptr;
+
+		p = alloc_small(st, c);
+		if (p == NULL)
+			return NULL;
+	} else if (ptr != NULL && osize > ALLOC_MAXSIZE) {
+		p = realloc(ptr, nsize);
+		if (p == NULL)
+			return NULL;
+		st->stats.large_allocs++;
+		st->stats.large_inuse += nsize - osize;
+		return p;
+	} else {
+		p = malloc(nsize);
+		if (p == NULL)
+			return NULL;
+		st->stats.large_allocs++;
+		st->stats.large_inuse += nsize;
+	}
+
+	if (ptr != NULL) {
+		memcpy(p, ptr, osize < nsize ? osize : nsize);
+		if (osize <= ALLOC_MAXSIZE)
+			alloc_small_free(st, ptr, alloc_class(osize));
+		else {
+			st->stats.large_inuse -= osize;
+			free(ptr);
+		}
+	}
+
+	return p;
+}
+
+static int
+alloc_panic(lua_State *T)
+{
+	lem_log_error("lem: unprotected error in call to Lua API (%s)",
+			lua_tostring(T, -1));
+	return 0;
+}
+
+static lua_State *
+alloc_newstate(void)
+{
+	const char *kind = getenv("LEM_ALLOCATOR");
+	lua_State *S;
+
+	if (kind == NULL || strcmp(kind, "slab") != 0)
+		return luaL_newstate();
+
+	alloc_slab = calloc(1, sizeof(struct alloc_state));
+	if (alloc_slab == NULL)
+		return NULL;
+
+	S = lua_newstate(alloc_lua, alloc_slab);
+	if (S == NULL) {
+		free(alloc_slab);
+		alloc_slab = NULL;
+		return NULL;
+	}
+	lua_atpanic(S, alloc_panic);
+
+	return S;
+}
+
+/* only call this after the Lua state is closed */
+static void
+alloc_destroy(void)
+{
+	struct alloc_slab *slab;
+	struct alloc_slab *next;
+
+	if (alloc_slab == NULL)
+		return;
+
+	for (slab = alloc_slab->slabs; slab; slab = next) {
+		next = slab->next;
+		free(slab);
+	}
+	free(alloc_slab);
+	alloc_slab = NULL;
+}
+
+int
+lem_alloc_getstats(struct lem_alloc_stats *stats)
+{
+	if (alloc_slab == NULL)
+		return -1;
+
+	*stats = alloc_slab->stats;
+	return 0;
+}
@@ -0,0 +1,141 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define BUFFER_MINSIZE 64
+
+/* sizes come from Lua, so fail rather than abort */
+static struct lem_bufstore *
+buffer_store(size_t size)
+{
+	struct lem_bufstore *s;
+
+	if (size > (size_t)-1 - sizeof(struct lem_bufstore))
+		return NULL;
+	s = malloc(sizeof(struct lem_bufstore) + size);
+	if (s == NULL)
+		return NULL;
+
+	s->refs = 1;
+	s->size = size;
+	return s;
+}
+
+static void
+buffer_unref(struct lem_bufstore *s)
+{
+	if (--s->refs == 0)
+		free(s);
+}
+
+static struct lem_buffer *
+buffer_push(lua_State *T)
+{
+	struct lem_buffer *b = lua_newuserdata(T, sizeof(struct lem_buffer));
+
+	b->store = NULL;
+	b->off = 0;
+	b->len = 0;
+	b->cap = 0;
+	b->pos = 0;
+	b->busy = 0;
+
+	luaL_getmetatable(T, LEM_BUFFER_MT);
+	lua_setmetatable(T, -2);
+	return b;
+}
+
+struct lem_buffer *
+lem_buffer_new(lua_State *T, size_t size)
+{
+	struct lem_buffer *b = buffer_push(T);
+
+	b->store = buffer_store(size);
+	if (b->store == NULL)
+		luaL_error(T, "out of memory");
+	b->cap = size;
+	return b;
+}
+
+struct lem_buffer *
+lem_buffer_view(lua_State *T, struct lem_buffer *b, size_t off, size_t len)
+{
+	struct lem_buffer *v = buffer_push(T);
+
+	v->store = b->store;
+	v->store->refs++;
+	v->off = b->off + off;
+	v->len = len;
+	/* writing to shared storage always moves to new storage */
+	v->cap = len;
+	return v;
+}
+
+char *
+lem_buffer_reserve(struct lem_buffer *b, size_t n)
+{
+	struct lem_bufstore *s = b->store;
+	size_t size;
+
+	/* the bytes of shared storage may belong to another buffer,
+	 * which could be busy on the thread pool, so they are never
+	 * written in place */
+	if (n <= b->cap - b->len) {
+		if (s->refs == 1)
+			return lem_buffer_data(b) + b->len;
+		if (b->busy)
+			return NULL;
+		size = b->cap;
+	} else {
+		if (b->busy || n > (size_t)-1 / 2 - b->len)
+			return NULL;
+
+		size = 2 * b->cap;
+		if (size < b->len + n)
+			size = b->len + n;
+	}
+	if (size < BUFFER_MINSIZE)
+		size = BUFFER_MINSIZE;
+
+	if (s->refs == 1 && b->cap == s->size - b->off) {
+		s = realloc(s, sizeof(struct lem_bufstore) + b->off + size);
+		if (s == NULL)
+			return NULL;
+		s->size = b->off + size;
+	} else {
+		s = buffer_store(size);
+		if (s == NULL)
+			return NULL;
+		memcpy(s->data, lem_buffer_data(b), b->len);
+		buffer_unref(b->store);
+		b->off = 0;
+	}
+
+	b->store = s;
+	b->cap = size;
+	return lem_buffer_data(b) + b->len;
+}
+
+void
+lem_buffer_free(struct lem_buffer *b)
+{
+	if (b->store == NULL)
+		return;
+
+	buffer_unref(b->store);
+	b->store = NULL;
+	b->len = b->cap = b->pos = 0;
+}
@@ -0,0 +1,166 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#define CHANNEL_INITIAL_WAITERS 4 /* this must be a power of 2 */
+#define CHANNEL_INITIAL_SLOTS   64
+
+struct lem_channel *
+lem_channel_new(lua_State *T, unsigned int cap)
+{
+	struct lem_channel *ch = lua_newuserdata(T, sizeof(struct lem_channel));
+
+	ch->cap = cap;
+	ch->head = 0;
+	ch->len = 0;
+	ch->ref = LUA_NOREF;
+	ch->closed = 0;
+	ch->waiters.T = NULL;
+	ch->waiters.mask = 0;
+	ch->waiters.first = 0;
+	ch->waiters.last = 0;
+
+	/* the ring of values, which Lua grows up to cap as it fills */
+	lua_createtable(T, cap < CHANNEL_INITIAL_SLOTS ?
+			cap : CHANNEL_INITIAL_SLOTS, 0);
+	ch->ref = luaL_ref(T, LUA_REGISTRYINDEX);
+
+	luaL_getmetatable(T, LEM_CHANNEL_MT);
+	lua_setmetatable(T, -2);
+	return ch;
+}
+
+void
+lem_channel_free(lua_State *T, struct lem_channel *ch)
+{
+	luaL_unref(T, LUA_REGISTRYINDEX, ch->ref);
+	ch->ref = LUA_NOREF;
+	free(ch->waiters.T);
+	ch->waiters.T = NULL;
+}
+
+static lua_State *
+channel_shift(struct lem_channel *ch)
+{
+	lua_State *T = ch->waiters.T[ch->waiters.first];
+
+	ch->waiters.first = (ch->waiters.first + 1) & ch->waiters.mask;
+	return T;
+}
+
+/* move the value on top of T to the end of the ring */
+static void
+channel_store(lua_State *T, struct lem_channel *ch)
+{
+	unsigned int i = ch->head + ch->len;
+
+	if (i >= ch->cap)
+		i -= ch->cap;
+
+	lua_rawgeti(T, LUA_REGISTRYINDEX, ch->ref);
+	lua_insert(T, -2);
+	lua_rawseti(T, -2, i + 1);
+	lua_pop(T, 1);
+	ch->len++;
+}
+
+int
+lem_channel_tryput(lua_State *T, struct lem_channel *ch)
+{
+	if (ch->closed)
+		return LEM_CHANNEL_CLOSED;
+
+	if (ch->len == 0 && lem_channel_waiting(ch) > 0) {
+		/* hand the value straight to the first getter */
+		lua_State *S = channel_shift(ch);
+
+		lua_xmove(T, S, 1);
+		lem_queue(S, 1);
+		return LEM_CHANNEL_OK;
+	}
+
+	if (ch->len == ch->cap)
+		return LEM_CHANNEL_AGAIN;
+
+	channel_store(T, ch);
+	return LEM_CHANNEL_OK;
+}
+
+int
+lem_channel_tryget(lua_State *T, struct lem_channel *ch)
+{
+	if (ch->len == 0)
+		return ch->closed ? LEM_CHANNEL_CLOSED : LEM_CHANNEL_AGAIN;
+
+	lua_rawgeti(T, LUA_REGISTRYINDEX, ch->ref);
+	lua_rawgeti(T, -1, ch->head + 1);
+	lua_pushnil(T);
+	lua_rawseti(T, -3, ch->head + 1);
+	lua_remove(T, -2);
+	if (++ch->head == ch->cap)
+		ch->head = 0;
+	ch->len--;
+
+	if (lem_channel_waiting(ch) > 0) {
+		/* there is room for the value of the first putter */
+		lua_State *S = channel_shift(ch);
+
+		lua_xmove(S, T, 1);
+		channel_store(T, ch);
+		lua_pushboolean(S, 1);
+		lem_queue(S, 1);
+	}
+
+	return LEM_CHANNEL_OK;
+}
+
+void
+lem_channel_wait(struct lem_channel *ch, lua_State *T)
+{
+	if (ch->waiters.T == NULL ||
+			((ch->waiters.last + 1) & ch->waiters.mask) == ch->waiters.first) {
+		unsigned int size = ch->waiters.T == NULL ? CHANNEL_INITIAL_WAITERS
+			: 2*(ch->waiters.mask + 1);
+		lua_State **ring = lem_xmalloc(size * sizeof(lua_State *));
+		unsigned int i = 0;
+
+		while (ch->waiters.first != ch->waiters.last)
+			ring[i++] = channel_shift(ch);
+
+		free(ch->waiters.T);
+		ch->waiters.T = ring;
+		ch->waiters.mask = size - 1;
+		ch->waiters.first = 0;
+		ch->waiters.last = i;
+	}
+
+	ch->waiters.T[ch->waiters.last] = T;
+	ch->waiters.last = (ch->waiters.last + 1) & ch->waiters.mask;
+}
+
+void
+lem_channel_close(struct lem_channel *ch)
+{
+	ch->closed = 1;
+
+	while (ch->waiters.first != ch->waiters.last) {
+		lua_State *S = channel_shift(ch);
+
+		lua_pushnil(S);
+		lua_pushliteral(S, "closed");
+		lem_queue(S, 2);
+	}
+}
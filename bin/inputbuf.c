@@ -0,0 +1,140 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Input buffers are only attached to a stream or file while a read
+ * is in progress or unread data remains. Released buffers of the
+ * pooled size go on a free list, anything else goes back to malloc.
+ */
+
+#define INPUTBUF_POOLMAX 256
+
+struct inputbuf_free {
+	struct inputbuf_free *next;
+};
+
+static struct {
+	struct inputbuf_free *free;
+	unsigned int size;
+	struct lem_inputbuf_stats stats;
+} ib = {
+	.size = LEM_INPUTBUF_SIZE,
+	.stats.cap = INPUTBUF_POOLMAX,
+};
+
+void
+lem_inputbuf_get(struct lem_inputbuf *b)
+{
+	if (b->buf != NULL)
+		return;
+
+	b->size = b->defsize;
+	if (b->size == ib.size && ib.free != NULL) {
+		struct inputbuf_free *f = ib.free;
+
+		ib.free = f->next;
+		ib.stats.pooled--;
+		ib.stats.hits++;
+		b->buf = (char *)f;
+	} else {
+		ib.stats.misses++;
+		b->buf = lem_xmalloc(b->size);
+	}
+
+	ib.stats.buffers++;
+	ib.stats.resident += b->size;
+}
+
+void
+lem_inputbuf_free(struct lem_inputbuf *b)
+{
+	if (b->buf == NULL)
+		return;
+
+	ib.stats.buffers--;
+	ib.stats.resident -= b->size;
+
+	if (b->size == ib.size && ib.stats.pooled < INPUTBUF_POOLMAX) {
+		struct inputbuf_free *f = (struct inputbuf_free *)b->buf;
+
+		f->next = ib.free;
+		ib.free = f;
+		ib.stats.pooled++;
+	} else
+		free(b->buf);
+
+	b->buf = NULL;
+	b->start = b->end = 0;
+	b->size = b->defsize;
+}
+
+void
+lem_inputbuf_put(struct lem_inputbuf *b)
+{
+	/* parsers reset start and end to 0 once everything
+	 * is consumed, start == end > 0 may still mean data
+	 * in front of start */
+	if (b->end == 0)
+		lem_inputbuf_free(b);
+}
+
+int
+lem_inputbuf_resize(struct lem_inputbuf *b, unsigned int size)
+{
+	char *p;
+
+	if (b->buf == NULL) {
+		b->size = size;
+		return 0;
+	}
+
+	if (size < b->end)
+		return -1;
+
+	p = realloc(b->buf, size);
+	if (p == NULL)
+		return -1;
+
+	ib.stats.resident += size;
+	ib.stats.resident -= b->size;
+	b->buf = p;
+	b->size = size;
+	return 0;
+}
+
+void
+lem_inputbuf_config(unsigned int size)
+{
+	if (size == ib.size)
+		return;
+
+	while (ib.free != NULL) {
+		struct inputbuf_free *f = ib.free;
+
+		ib.free = f->next;
+		free(f);
+	}
+	ib.stats.pooled = 0;
+	ib.size = size;
+}
+
+void
+lem_inputbuf_getstats(struct lem_inputbuf_stats *stats)
+{
+	*stats = ib.stats;
+	stats->size = ib.size;
+}
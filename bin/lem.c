@@ -31,8 +31,12 @@
 #include <time.h>
 #include <pthread.h>
 #include <libgen.h>
+#include <stdint.h>
 
 #include <lem.h>
+#include <lem-channel.h>
+#include <lem-buffer.h>
+#include <lem-parsers.h>
 #include <lualib.h>
 
 #ifdef STATIC_LEM
@@ -76,16 +80,45 @@ struct lem_runqueue {
 	unsigned int first;
 	unsigned int last;
 	unsigned int mask;
+	unsigned int batch;
+	ev_tstamp budget;
+	struct lem_runqueue_stats stats;
+};
+
+struct lem_threadcache {
+	lua_State **threads;
+	unsigned int size;
+	unsigned int cap;
+	struct lem_threadcache_stats stats;
+};
+
+struct lem_idlegc {
+	struct ev_idle w;
+	struct ev_timer quiet;
+	int enabled;
+	int generational;
+	int kb;
+	ev_tstamp budget;
+	struct lem_gc_stats stats;
 };
 
 struct ev_loop *lem_loop;
 static lua_State *L;
+static pthread_t lem_loop_thread;
+
+int
+lem_on_loop_thread(void)
+{
+	return pthread_equal(pthread_self(), lem_loop_thread);
+}
 
 lua_State*
 lem_get_global_lua_state() {
 	return L;
 }
 static struct lem_runqueue rq;
+static struct lem_threadcache tc;
+static struct lem_idlegc gc;
 static int exit_status = EXIT_SUCCESS;
 
 static void
@@ -133,8 +166,15 @@ setsignal(int signal, void (*handler)(int), int flags)
 lua_State *
 lem_newthread(void)
 {
-	lua_State *T = lua_newthread(L);
+	lua_State *T;
+
+	if (tc.size > 0) {
+		tc.stats.hits++;
+		return tc.threads[--tc.size];
+	}
+	tc.stats.misses++;
 
+	T = lua_newthread(L);
 	if (T == NULL)
 		oom();
 
@@ -145,8 +185,29 @@ lem_newthread(void)
 	return T;
 }
 
-void
-lem_forgetthread(lua_State *T)
+static int
+threadcache_reset(lua_State *T)
+{
+	lua_Debug ar;
+
+	/* only recycle threads which finished or never ran */
+	if (lua_status(T) != LUA_OK || lua_getstack(T, 0, &ar))
+		return 0;
+
+#if LUA_VERSION_NUM >= 504
+#if defined(LUA_VERSION_RELEASE_NUM) && LUA_VERSION_RELEASE_NUM >= 50406
+	return lua_closethread(T, L) == LUA_OK;
+#else
+	return lua_resetthread(T) == LUA_OK;
+#endif
+#else
+	lua_settop(T, 0);
+	return 1;
+#endif
+}
+
+static void
+threadcache_drop(lua_State *T)
 {
 	/* set thread_table[T] = nil */
 	lua_pushthread(T);
@@ -155,6 +216,49 @@ lem_forgetthread(lua_State *T)
 	lua_rawset(L, LEM_THREADTABLE);
 }
 
+void
+lem_forgetthread(lua_State *T)
+{
+	if (tc.size < tc.cap && threadcache_reset(T)) {
+		/* keep it in the thread table and hand it
+		 * out again on the next lem_newthread() */
+		tc.threads[tc.size++] = T;
+		tc.stats.recycled++;
+		return;
+	}
+
+	tc.stats.dropped++;
+	threadcache_drop(T);
+}
+
+void
+lem_threadcache_config(unsigned int cap)
+{
+	while (tc.size > cap)
+		threadcache_drop(tc.threads[--tc.size]);
+
+	if (cap != tc.cap) {
+		if (cap == 0) {
+			free(tc.threads);
+			tc.threads = NULL;
+		} else {
+			tc.threads = realloc(tc.threads,
+					cap * sizeof(lua_State *));
+			if (tc.threads == NULL)
+				oom();
+		}
+		tc.cap = cap;
+	}
+}
+
+void
+lem_threadcache_getstats(struct lem_threadcache_stats *stats)
+{
+	*stats = tc.stats;
+	stats->size = tc.size;
+	stats->cap = tc.cap;
+}
+
 void
 lem_exit(int status)
 {
@@ -236,6 +340,129 @@ merror:
 #endif
 }
 
+/*
+ * idle garbage collection
+ *
+ * Once the runqueue drains (and optionally stays drained for
+ * gc.quiet.repeat seconds) a low priority idle watcher runs bounded
+ * incremental GC steps until a cycle completes. Idle watchers only
+ * run when no other events are pending, so collection never gets
+ * in the way of I/O.
+ */
+static void
+idlegc_record(ev_tstamp pause)
+{
+	unsigned long usec = (unsigned long)(pause * 1e6);
+	unsigned int i = 0;
+
+	while (usec > 0 && i < LEM_GC_HISTSIZE - 1) {
+		usec >>= 1;
+		i++;
+	}
+	gc.stats.pauses[i]++;
+	if (pause > gc.stats.maxpause)
+		gc.stats.maxpause = pause;
+}
+
+static void
+idlegc_step(EV_P_ struct ev_idle *w, int revents)
+{
+	ev_tstamp start = ev_time();
+	ev_tstamp now = start;
+	ev_tstamp last;
+	int done;
+
+	(void)revents;
+
+	if (gc.generational) {
+		/* a generational step is a whole young collection and
+		 * never leaves the collector paused, so do one and stop */
+		lua_gc(L, LUA_GCSTEP, 0);
+		gc.stats.steps++;
+		gc.stats.cycles++;
+		idlegc_record(ev_time() - start);
+		ev_idle_stop(EV_A_ w);
+		return;
+	}
+
+	do {
+		last = now;
+		done = lua_gc(L, LUA_GCSTEP, gc.kb);
+		now = ev_time();
+
+		gc.stats.steps++;
+		idlegc_record(now - last);
+		if (done) {
+			lem_debug("done collecting");
+			gc.stats.cycles++;
+			ev_idle_stop(EV_A_ w);
+			break;
+		}
+	} while (now - start < gc.budget);
+}
+
+static void
+idlegc_quiet(EV_P_ struct ev_timer *w, int revents)
+{
+	(void)revents;
+
+	ev_timer_stop(EV_A_ w);
+	ev_idle_start(EV_A_ &gc.w);
+}
+
+static inline void
+idlegc_schedule(EV_P)
+{
+	if (!gc.enabled)
+		return;
+
+	if (gc.quiet.repeat > 0)
+		ev_timer_again(EV_A_ &gc.quiet);
+	else
+		ev_idle_start(EV_A_ &gc.w);
+}
+
+void
+lem_idlegc_config(int enable, int kb, ev_tstamp budget, ev_tstamp quiet)
+{
+	ev_idle_stop(LEM_ &gc.w);
+	ev_timer_stop(LEM_ &gc.quiet);
+
+	gc.enabled = enable;
+	gc.kb = kb;
+	gc.budget = budget;
+	gc.quiet.repeat = quiet;
+
+	if (enable)
+		idlegc_schedule(LEM);
+}
+
+int
+lem_gc_setmode(int generational)
+{
+#if LUA_VERSION_NUM >= 504
+	int prev;
+
+	if (generational)
+		prev = lua_gc(L, LUA_GCGEN, 0, 0);
+	else
+		prev = lua_gc(L, LUA_GCINC, 0, 0, 0);
+
+	gc.generational = generational;
+	return prev == LUA_GCGEN;
+#else
+	if (generational)
+		return -1;
+	return 0;
+#endif
+}
+
+void
+lem_idlegc_getstats(struct lem_gc_stats *stats)
+{
+	*stats = gc.stats;
+}
+
 static void
 runqueue_pop(EV_P_ struct ev_idle *w, int revents)
 {
@@ -243,25 +470,36 @@ runqueue_pop(EV_P_ struct ev_idle *w, int revents)
 	lua_State *T;
 	int nargs;
 	int nresults;
+	unsigned int limit;
+	unsigned int n;
+	ev_tstamp deadline = 0;
 
 	(void)revents;
 
 	if (rq.first == rq.last) { /* queue is empty */
-		lem_debug("runqueue is empty, collecting..");
-#if 0
-		if (lua_gc(L, LUA_GCSTEP, 0)) {
-			lem_debug("done collecting");
-			ev_idle_stop(EV_A_ w);
-		}
-#else
+		lem_debug("runqueue is empty");
 		ev_idle_stop(EV_A_ w);
-		//lua_gc(L, LUA_GCCOLLECT, 0);
-#endif
+		idlegc_schedule(EV_A);
 		return;
 	}
 
 	lem_debug("running lua threads...");
 
+	/* in batch mode only run the threads queued before this
+	 * iteration started, so threads re-queueing themselves
+	 * can't starve the event loop */
+	limit = rq.batch;
+	if (limit) {
+		unsigned int pending = (rq.last - rq.first) & rq.mask;
+
+		if (limit > pending)
+			limit = pending;
+		if (rq.budget > 0)
+			deadline = ev_time() + rq.budget;
+	}
+
+	rq.stats.iterations++;
+	n = 0;
 	for(;;) {
 		slot = &rq.queue[rq.first];
 		T = slot->T;
@@ -269,6 +507,7 @@ runqueue_pop(EV_P_ struct ev_idle *w, int revents)
 
 		rq.first++;
 		rq.first &= rq.mask;
+		n++;
 
 		/* run Lua thread */
 #if LUA_VERSION_NUM >= 504
@@ -285,7 +524,9 @@ runqueue_pop(EV_P_ struct ev_idle *w, int revents)
 
 			case LUA_YIELD: /* thread yielded */
 				lem_debug("thread yielded");
-				return ;
+				if (limit == 0)
+					goto out;
+				break;
 
 			case LUA_ERRERR: /* error running error handler */
 				lem_debug("thread errored while running error handler");
@@ -312,15 +553,49 @@ runqueue_pop(EV_P_ struct ev_idle *w, int revents)
 
 		if (rq.first == rq.last) { /* queue is empty */
 			ev_idle_stop(EV_A_ w);
-			return ;
+			idlegc_schedule(EV_A);
+			goto out;
+		}
+
+		if (limit) {
+			if (n >= limit)
+				goto out;
+			if (deadline > 0 && ev_time() >= deadline) {
+				rq.stats.overruns++;
+				goto out;
+			}
 		}
 	}
 
-	lua_failure:
-		lem_exit(EXIT_FAILURE);
+out:
+	rq.stats.resumed += n;
+	if (n > rq.stats.maxbatch)
+		rq.stats.maxbatch = n;
+	return;
+
+lua_failure:
+	lem_exit(EXIT_FAILURE);
+}
+
+void
+lem_runqueue_config(unsigned int batch, ev_tstamp budget)
+{
+	rq.batch = batch;
+	rq.budget = budget;
+}
+
+void
+lem_runqueue_getstats(struct lem_runqueue_stats *stats)
+{
+	*stats = rq.stats;
 }
 
 #include "pool.c"
+#include "alloc.c"
+#include "timer.c"
+#include "channel.c"
+#include "inputbuf.c"
+#include "buffer.c"
 
 static int
 queue_file(int argc, char *argv[], int fidx)
@@ -405,6 +680,14 @@ runqueue_wait_init(void)
 {
 	ev_idle_init(&rq.w, runqueue_pop);
 }
+
+static inline void
+idlegc_init(void)
+{
+	ev_idle_init(&gc.w, idlegc_step);
+	ev_set_priority(&gc.w, EV_MINPRI);
+	ev_init(&gc.quiet, idlegc_quiet);
+}
 #pragma GCC diagnostic pop
 
 void ((**process_quit_cb)(void)) = NULL;
@@ -429,6 +712,7 @@ main(int argc, char *argv[])
 	__lem_main_environ = environ;
 	__lem_main_argc = argc;
 	__lem_main_argv = argv;
+	lem_loop_thread = pthread_self();
 
   atexit(lem_process_exit);
 
@@ -453,7 +737,7 @@ main(int argc, char *argv[])
 		goto error;
 
 	/* create main Lua state */
-	L = luaL_newstate();
+	L = alloc_newstate();
 	if (L == NULL) {
 		lem_log_error("lem: error initializing Lua state");
 		goto error;
@@ -477,6 +761,12 @@ main(int argc, char *argv[])
 	rq.first = rq.last = 0;
 	rq.mask = LEM_INITIAL_QUEUESIZE - 1;
 
+	/* initialize idle collector */
+	idlegc_init();
+
+	/* initialize timer wheel */
+	wheel_init();
+
 	/* initialize threadpool */
 	if (pool_init()) {
 		lem_log_error("lem: error initializing threadpool");
@@ -501,9 +791,11 @@ main(int argc, char *argv[])
 
 	/* shutdown Lua */
 	lua_close(L);
+	alloc_destroy();
 
-	/* free runqueue */
+	/* free runqueue and thread cache */
 	free(rq.queue);
+	free(tc.threads);
 
 	/* destroy loop */
 	ev_loop_destroy(lem_loop);
@@ -513,6 +805,7 @@ main(int argc, char *argv[])
 error:
 	if (L)
 		lua_close(L);
+	alloc_destroy();
 	if (rq.queue)
 		free(rq.queue);
 
@@ -16,24 +16,98 @@
  * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * jobs are submitted from the event loop thread only and run on
+ * one of several lanes, each with its own queue and threads, so
+ * jobs that may block for a long time, like waitpid(), can't hold
+ * up the quick file operations behind them.
+ *
+ * a lane queues jobs in a lock-free ring (a bounded MPMC queue as
+ * described by Dmitry Vyukov) shared by its workers, and anything
+ * that doesn't fit waits on a backlog list owned by the loop thread
+ * until completions make room. finished jobs of all lanes are pushed
+ * onto one lock-free stack and the loop is only notified when that
+ * stack goes from empty to non-empty.
+ *
+ * every worker also owns a slot with a small deque. a job remembers
+ * the slot of the worker that last ran it, and when it is submitted
+ * again with lem_async_run(), like a file read resubmitted from its
+ * reap function, it is pushed onto that deque so it tends to run
+ * where its data is still in cache. the owner pops its deque from
+ * the newest end, while workers out of work steal from the oldest
+ * end of the others. as jobs are only ever submitted from the loop
+ * thread a deque is fed by the loop rather than by its owner, so
+ * each has a plain mutex.
+ *
+ * sleeping workers wait on a condition of their own under the lane
+ * mutex, so a job pushed to a deque can wake exactly its owner. other
+ * jobs only wake as many workers as aren't already on their way, as
+ * a woken worker keeps taking jobs until it runs out.
+ */
+#define POOL_RING_SIZE  1024
+#define POOL_SLOTS      64
+#define POOL_DEQUE_SIZE 64
+
+struct pool_cell {
+	unsigned long seq;
+	struct lem_async *a;
+};
+
+struct pool_worker {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct pool_worker *next_asleep;
+	unsigned int head;     /* stolen from here */
+	unsigned int tail;     /* pushed and popped here */
+	unsigned int active;
+	unsigned int asleep;
+	struct lem_async *deque[POOL_DEQUE_SIZE];
+};
+
+struct pool_lane {
+	struct pool_cell ring[POOL_RING_SIZE];
+	unsigned long enq;
+	unsigned long deq;
+	struct lem_async *backlog;
+	struct lem_async *backlog_tail;
+	unsigned int jobs;
+	unsigned int min;
+	unsigned int max;
+	unsigned int threads;
+	unsigned int idle;
+	unsigned int affinity;
+	unsigned int slots;    /* highest slot ever used + 1 */
+	unsigned int waking;
+	unsigned int queued;
+	unsigned int maxqueued;
+	unsigned long spawned;
+	unsigned long exited;
+	time_t delay;
+	pthread_mutex_t mutex;
+	struct pool_worker *asleep;
+	struct pool_worker workers[POOL_SLOTS];
+};
+
+const char *const lem_lane_names[] = { "fs", "net", "blocking", "user", NULL };
+
+static struct pool_lane pool_lanes[LEM_LANES];
+/*
+ * jobs are timed when submitted, started and finished, and the wait
+ * and service times are counted in log2 histograms per work function.
+ * the table is open addressed and only ever grows, so workers can
+ * find or add their entry with nothing but atomics. names are added
+ * by modules with lem_async_name(). the last entry counts jobs of
+ * any work functions that don't fit in the table.
+ */
+#define POOL_JOBTYPES LEM_POOL_JOBTYPES
+
+static struct lem_pool_job_stats pool_jobtypes[POOL_JOBTYPES + 1];
+
+static struct lem_async *pool_done;
 static unsigned int pool_jobs;
-static unsigned int pool_min;
-static unsigned int pool_max;
-static unsigned int pool_threads;
 static unsigned int pool_is_halting;
-static time_t pool_delay;
-static pthread_mutex_t pool_mutex;
-
-static pthread_mutex_t pool_dlock;
-#define pool_done_init()   pthread_mutex_init(&pool_dlock, NULL)
-#define pool_done_lock()   pthread_mutex_lock(&pool_dlock)
-#define pool_done_unlock() pthread_mutex_unlock(&pool_dlock)
 
-static pthread_cond_t pool_cond;
 static pthread_condattr_t pool_condattr;
-static struct lem_async *pool_head;
-static struct lem_async *pool_tail;
-static struct lem_async *pool_done;
 static struct ev_async pool_watch;
 
 #define LEM_POOL_USED_CLOCK CLOCK_MONOTONIC
@@ -46,75 +120,361 @@ static struct ev_async pool_watch;
 	#define LEM_POOL_FASTCLOCK CLOCK_MONOTONIC
 #endif
 
+static uint64_t
+pool_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(LEM_POOL_USED_CLOCK, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static struct lem_pool_job_stats *
+pool_jobtype(void (*work)(struct lem_async *a))
+{
+	unsigned long h = ((uintptr_t)work >> 4) * 2654435761UL;
+	unsigned int n;
+
+	for (n = 0; n < POOL_JOBTYPES; n++) {
+		struct lem_pool_job_stats *t =
+			&pool_jobtypes[(h + n) & (POOL_JOBTYPES - 1)];
+		void (*w)(struct lem_async *a) =
+			__atomic_load_n(&t->work, __ATOMIC_ACQUIRE);
+
+		if (w == NULL && __atomic_compare_exchange_n(&t->work, &w,
+					work, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+			return t;
+		if (w == work)
+			return t;
+	}
+	return &pool_jobtypes[POOL_JOBTYPES];
+}
+
+static void
+pool_histogram(unsigned long *hist, uint64_t ns)
+{
+	uint64_t usec = ns / 1000;
+	unsigned int i = 0;
+
+	while (usec > 0 && i < LEM_POOL_HISTSIZE - 1) {
+		usec >>= 1;
+		i++;
+	}
+	__atomic_add_fetch(&hist[i], 1, __ATOMIC_RELAXED);
+}
+
+static void
+pool_record(void (*work)(struct lem_async *a), struct lem_async *a)
+{
+	struct lem_pool_job_stats *t = pool_jobtype(work);
+
+	__atomic_add_fetch(&t->jobs, 1, __ATOMIC_RELAXED);
+	pool_histogram(t->wait, a->started - a->submitted);
+	pool_histogram(t->service, a->finished - a->started);
+}
+
+/* only called from the loop thread, so there is a single producer */
+static int
+pool_enqueue(struct pool_lane *l, struct lem_async *a)
+{
+	struct pool_cell *c = &l->ring[l->enq & (POOL_RING_SIZE - 1)];
+
+	if (__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) != l->enq)
+		return 0; /* full */
+
+	c->a = a;
+	__atomic_store_n(&c->seq, l->enq + 1, __ATOMIC_RELEASE);
+	l->enq++;
+	return 1;
+}
+
+static struct lem_async *
+pool_dequeue(struct pool_lane *l)
+{
+	unsigned long pos = __atomic_load_n(&l->deq, __ATOMIC_RELAXED);
+	struct pool_cell *c;
+	struct lem_async *a;
+
+	for (;;) {
+		long diff;
+
+		c = &l->ring[pos & (POOL_RING_SIZE - 1)];
+		diff = (long)(__atomic_load_n(&c->seq, __ATOMIC_ACQUIRE) - (pos + 1));
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&l->deq, &pos, pos + 1,
+						1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (diff < 0) {
+			return NULL; /* empty */
+		} else
+			pos = __atomic_load_n(&l->deq, __ATOMIC_RELAXED);
+	}
+
+	a = c->a;
+	__atomic_store_n(&c->seq, pos + POOL_RING_SIZE, __ATOMIC_RELEASE);
+	return a;
+}
+
+static void
+pool_finish(struct lem_async *a)
+{
+	struct lem_async *head = __atomic_load_n(&pool_done, __ATOMIC_RELAXED);
+
+	do {
+		a->next = head;
+	} while (!__atomic_compare_exchange_n(&pool_done, &head, a,
+				1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+	/* the loop thread is already on its way otherwise */
+	if (head == NULL)
+		ev_async_send(LEM_ &pool_watch);
+}
+
+/* push a job onto the deque of a live worker */
+static int
+pool_push(struct pool_worker *w, struct lem_async *a)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->active && w->tail - w->head < POOL_DEQUE_SIZE) {
+		w->deque[w->tail & (POOL_DEQUE_SIZE - 1)] = a;
+		__atomic_store_n(&w->tail, w->tail + 1, __ATOMIC_RELAXED);
+		ret = 1;
+	}
+	pthread_mutex_unlock(&w->lock);
+	return ret;
+}
+
+/* take the newest job of a deque, called by its owner */
+static struct lem_async *
+pool_pop(struct pool_worker *w)
+{
+	struct lem_async *a = NULL;
+
+	if (__atomic_load_n(&w->tail, __ATOMIC_RELAXED) ==
+			__atomic_load_n(&w->head, __ATOMIC_RELAXED))
+		return NULL;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->tail != w->head) {
+		__atomic_store_n(&w->tail, w->tail - 1, __ATOMIC_RELAXED);
+		a = w->deque[w->tail & (POOL_DEQUE_SIZE - 1)];
+	}
+	pthread_mutex_unlock(&w->lock);
+	return a;
+}
+
+/* take the oldest job from the deque of any other worker */
+static struct lem_async *
+pool_steal(struct pool_lane *l, struct pool_worker *self)
+{
+	unsigned int slots = __atomic_load_n(&l->slots, __ATOMIC_RELAXED);
+	unsigned int start = self - l->workers;
+	unsigned int i;
+
+	for (i = 1; i < slots; i++) {
+		struct pool_worker *w = &l->workers[(start + i) % slots];
+		struct lem_async *a = NULL;
+
+		if (__atomic_load_n(&w->tail, __ATOMIC_RELAXED) ==
+				__atomic_load_n(&w->head, __ATOMIC_RELAXED))
+			continue;
+
+		pthread_mutex_lock(&w->lock);
+		if (w->tail != w->head) {
+			a = w->deque[w->head & (POOL_DEQUE_SIZE - 1)];
+			__atomic_store_n(&w->head, w->head + 1, __ATOMIC_RELAXED);
+		}
+		pthread_mutex_unlock(&w->lock);
+		if (a != NULL)
+			return a;
+	}
+	return NULL;
+}
+
+static struct lem_async *
+pool_take(struct pool_lane *l, struct pool_worker *w)
+{
+	struct lem_async *a;
+
+	a = pool_pop(w);
+	if (a == NULL)
+		a = pool_dequeue(l);
+	if (a == NULL)
+		a = pool_steal(l, w);
+	return a;
+}
+
+/* wake a sleeping worker, the lane mutex must be held */
+static void
+pool_wake(struct pool_lane *l, struct pool_worker *w)
+{
+	struct pool_worker **pw;
+
+	for (pw = &l->asleep; *pw != w; pw = &(*pw)->next_asleep)
+		;
+	*pw = w->next_asleep;
+	w->asleep = 0;
+	l->waking++;
+	pthread_cond_signal(&w->cond);
+}
+
+/* wake up to n sleeping workers, counting those woken before that
+ * haven't got going yet, the lane mutex must be held */
+static void
+pool_wake_some(struct pool_lane *l, unsigned int n)
+{
+	if (n <= l->waking)
+		return;
+	for (n -= l->waking; n > 0 && l->asleep != NULL; n--)
+		pool_wake(l, l->asleep);
+}
+
+/* claim a free slot, the lane mutex must be held */
+static struct pool_worker *
+pool_claim(struct pool_lane *l)
+{
+	struct pool_worker *w = l->workers;
+
+	while (w->active)
+		w++;
+
+	pthread_mutex_lock(&w->lock);
+	w->active = 1;
+	pthread_mutex_unlock(&w->lock);
+
+	if (l->slots <= (unsigned int)(w - l->workers))
+		__atomic_store_n(&l->slots, w - l->workers + 1, __ATOMIC_RELAXED);
+	return w;
+}
+
+/* give up the slot unless jobs were pushed to it meanwhile */
+static int
+pool_retire(struct pool_worker *w)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&w->lock);
+	if (w->tail == w->head) {
+		w->active = 0;
+		ret = 1;
+	}
+	pthread_mutex_unlock(&w->lock);
+	return ret;
+}
+
 static void *
 pool_threadfunc(void *arg)
 {
+	struct pool_lane *l = arg;
+	struct pool_worker *w;
 	struct lem_async *a;
+	void (*work)(struct lem_async *a);
 	struct timespec ts;
 
-	(void)arg;
+	pthread_mutex_lock(&l->mutex);
+	w = pool_claim(l);
+	pthread_mutex_unlock(&l->mutex);
 
 	while (1) {
-		clock_gettime(LEM_POOL_FASTCLOCK, &ts);
-		ts.tv_sec  += pool_delay;
-
-		pthread_mutex_lock(&pool_mutex);
-		while ((a = pool_head) == NULL) {
-retry_lock:
-			if (pool_threads <= pool_min) {
-				pthread_cond_wait(&pool_cond, &pool_mutex);
-				continue;
-			}
-
-			if (pool_is_halting) {
-				goto out;
-			}
-
-			if (pthread_cond_timedwait(&pool_cond, &pool_mutex, &ts)) {
-				/* timeout */
-				if (pool_threads > pool_min)
+		a = pool_take(l, w);
+		if (a == NULL) {
+			int timeout = 0;
+
+			clock_gettime(LEM_POOL_FASTCLOCK, &ts);
+			ts.tv_sec  += l->delay;
+
+			pthread_mutex_lock(&l->mutex);
+			__atomic_add_fetch(&l->idle, 1, __ATOMIC_SEQ_CST);
+			/* only retire right after finding no jobs under the
+			 * mutex, pool_kick() decides what to spawn under it */
+			while ((a = pool_take(l, w)) == NULL) {
+				if (l->threads > l->min &&
+						(pool_is_halting || timeout) &&
+						pool_retire(w))
 					goto out;
+
+				if (!w->asleep) {
+					w->next_asleep = l->asleep;
+					l->asleep = w;
+					w->asleep = 1;
+				}
+				if (l->threads <= l->min)
+					pthread_cond_wait(&w->cond, &l->mutex);
 				else
-					goto retry_lock;
+					timeout = pthread_cond_timedwait(&w->cond,
+							&l->mutex, &ts);
+				if (w->asleep)
+					pool_wake(l, w);
+				l->waking--;
 			}
-
+			__atomic_sub_fetch(&l->idle, 1, __ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&l->mutex);
 		}
-		pool_head = a->next;
-		pthread_mutex_unlock(&pool_mutex);
 
+		/* remember where the job ran for its next submission */
+		a->worker = w - l->workers + 1;
+		__atomic_sub_fetch(&l->queued, 1, __ATOMIC_RELAXED);
+
+		work = a->work;
+		a->started = pool_now();
 		lem_debug("Running job %p", a);
-		a->work(a);
+		work(a);
 		lem_debug("Bye %p", a);
+		a->finished = pool_now();
+		pool_record(work, a);
 
-		pool_done_lock();
-		a->next = pool_done;
-		pool_done = a;
-		pool_done_unlock();
-
-		ev_async_send(LEM_ &pool_watch);
+		pool_finish(a);
 	}
 out:
-	pool_threads--;
-	pthread_mutex_unlock(&pool_mutex);
+	/* threads drops before idle, see pool_kick() */
+	__atomic_sub_fetch(&l->threads, 1, __ATOMIC_SEQ_CST);
+	__atomic_sub_fetch(&l->idle, 1, __ATOMIC_SEQ_CST);
+	__atomic_add_fetch(&l->exited, 1, __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&l->mutex);
 	return NULL;
 }
 
+static void pool_kick(struct pool_lane *l, struct pool_worker *w,
+		unsigned int n);
+
+/* move jobs from the backlog to the ring as room allows */
+static void
+pool_flush_backlog(struct pool_lane *l)
+{
+	unsigned int n = 0;
+
+	while (l->backlog != NULL && pool_enqueue(l, l->backlog)) {
+		l->backlog = l->backlog->next;
+		n++;
+	}
+	if (n > 0)
+		pool_kick(l, NULL, n);
+}
+
 static void
 pool_cb(EV_P_ struct ev_async *w, int revents)
 {
 	struct lem_async *a;
 	struct lem_async *next;
+	struct lem_async *fifo = NULL;
+	unsigned int i;
 
 	(void)revents;
 
+	a = __atomic_exchange_n(&pool_done, NULL, __ATOMIC_ACQUIRE);
 
-	pool_done_lock();
-	a = pool_done;
-	pool_done = NULL;
-	pool_done_unlock();
-
+	/* the stack has the last job finished first */
 	for (; a; a = next) {
+		next = a->next;
+		a->next = fifo;
+		fifo = a;
+	}
+
+	for (a = fifo; a; a = next) {
 		pool_jobs--;
+		pool_lanes[a->lane].jobs--;
 		next = a->next;
 		if (a->reap)
 			a->reap(a);
@@ -122,6 +482,9 @@ pool_cb(EV_P_ struct ev_async *w, int revents)
 			free(a);
 	}
 
+	for (i = 0; i < LEM_LANES; i++)
+		pool_flush_backlog(&pool_lanes[i]);
+
 	if (pool_jobs == 0)
 		ev_async_stop(EV_A_ w);
 }
@@ -139,32 +502,10 @@ static int
 pool_init(void)
 {
 	int ret;
-
-	/*
-	pool_jobs = 0;
-	pool_min = 0;
-	pool_threads = 0;
-	*/
-	pool_min = 1;
-	pool_max = 8 /*INT_MAX*/;
-	pool_delay = 3;
-	/*
-	pool_head = NULL;
-	pool_tail = NULL;
-	pool_done = NULL;
-	*/
+	unsigned int i;
 
 	pool_watch_init();
 
-	ret = pthread_mutex_init(&pool_mutex, NULL);
-	if (ret == 0)
-		ret = pool_done_init();
-	if (ret) {
-		lem_log_error("error initializing lock: %s",
-				strerror(ret));
-		return -1;
-	}
-
 	ret = pthread_condattr_init(&pool_condattr);
 	if (ret) {
 		lem_log_error("error initializing cond_attr: %s",
@@ -179,18 +520,56 @@ pool_init(void)
 		return -1;
 	}
 
-	ret = pthread_cond_init(&pool_cond, &pool_condattr);
-	if (ret) {
-		lem_log_error("error initializing cond: %s",
-				strerror(ret));
-		return -1;
+	for (i = 0; i < LEM_LANES; i++) {
+		struct pool_lane *l = &pool_lanes[i];
+		unsigned int j;
+
+		for (j = 0; j < POOL_RING_SIZE; j++)
+			l->ring[j].seq = j;
+		l->min = 0;
+		l->max = 8;
+		l->delay = 3;
+		l->affinity = 1;
+
+		ret = pthread_mutex_init(&l->mutex, NULL);
+		if (ret) {
+			lem_log_error("error initializing lock: %s",
+					strerror(ret));
+			return -1;
+		}
+
+		for (j = 0; j < POOL_SLOTS; j++) {
+			struct pool_worker *w = &l->workers[j];
+
+			ret = pthread_mutex_init(&w->lock, NULL);
+			if (ret) {
+				lem_log_error("error initializing lock: %s",
+						strerror(ret));
+				return -1;
+			}
+
+			ret = pthread_cond_init(&w->cond, &pool_condattr);
+			if (ret) {
+				lem_log_error("error initializing cond: %s",
+						strerror(ret));
+				return -1;
+			}
+		}
 	}
 
+	pool_jobtypes[POOL_JOBTYPES].name = "other";
+
+	/* keep a thread around for file I/O, and give jobs that
+	 * may block for good plenty of room */
+	pool_lanes[LEM_LANE_FS].min = 1;
+	pool_lanes[LEM_LANE_BLOCKING].max = 64;
+	pool_lanes[LEM_LANE_USER].max = 4;
+
 	return 0;
 }
 
 static void
-pool_spawnthread(void)
+pool_spawnthread(struct pool_lane *l)
 {
 	pthread_attr_t attr;
 	pthread_t thread;
@@ -212,66 +591,234 @@ pool_spawnthread(void)
 	//	goto error;
 	//}
 
-	ret = pthread_create(&thread, &attr, pool_threadfunc, NULL);
+	ret = pthread_create(&thread, &attr, pool_threadfunc, l);
 	pthread_attr_destroy(&attr);
 	if (ret)
 		goto error;
 
+	__atomic_add_fetch(&l->spawned, 1, __ATOMIC_RELAXED);
 	return;
 error:
 	lem_log_error("error spawning thread: %s", strerror(ret));
 	lem_exit(EXIT_FAILURE);
 }
 
-void
-lem_async_run(struct lem_async *a)
+/* queue a job and return the worker it was pushed to, if any */
+static struct pool_worker *
+pool_submit(struct lem_async *a, struct pool_lane **lp)
 {
-	int spawn = 0;
+	struct pool_lane *l;
+	unsigned int queued;
+
+	if (a->lane >= LEM_LANES)
+		a->lane = LEM_LANE_FS;
+	l = &pool_lanes[a->lane];
+	*lp = l;
 
 	if (pool_jobs == 0)
 		ev_async_start(LEM_ &pool_watch);
 	pool_jobs++;
+	l->jobs++;
+	a->submitted = pool_now();
+	queued = __atomic_add_fetch(&l->queued, 1, __ATOMIC_RELAXED);
+	if (queued > l->maxqueued)
+		l->maxqueued = queued;
+
+	/* the slot is only a hint, so a stale one does no harm,
+	 * and with a single worker there is nothing to choose from */
+	if (l->affinity && __atomic_load_n(&l->slots, __ATOMIC_RELAXED) > 1 &&
+			a->worker > 0 && a->worker <= POOL_SLOTS) {
+		struct pool_worker *w = &l->workers[a->worker - 1];
+
+		if (pool_push(w, a))
+			return w;
+	}
 
 	a->next = NULL;
+	if (l->backlog == NULL && pool_enqueue(l, a))
+		return NULL;
+
+	if (l->backlog == NULL)
+		l->backlog = a;
+	else
+		l->backlog_tail->next = a;
+	l->backlog_tail = a;
+	return NULL;
+}
+
+/* start threads and wake up sleeping ones for n new jobs,
+ * preferring the owner w of the deque they were pushed to */
+static void
+pool_kick(struct pool_lane *l, struct pool_worker *w, unsigned int n)
+{
+	unsigned int threads;
+	unsigned int spawn = 0;
+
+	/* pairs with the worker checking for jobs after announcing
+	 * itself idle. a retiring worker drops threads before idle,
+	 * so with no idle workers the thread count is current */
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&l->idle, __ATOMIC_SEQ_CST) == 0) {
+		threads = __atomic_load_n(&l->threads, __ATOMIC_SEQ_CST);
+		if (pool_is_halting || l->jobs <= threads || threads >= l->max)
+			return;
+	}
 
-	pthread_mutex_lock(&pool_mutex);
-	if (pool_head == NULL) {
-		pool_head = a;
-		pool_tail = a;
-	} else {
-		pool_tail->next = a;
-		pool_tail = a;
+	pthread_mutex_lock(&l->mutex);
+	if (__atomic_load_n(&l->idle, __ATOMIC_RELAXED) > 0) {
+		if (w != NULL && w->asleep)
+			pool_wake(l, w);
+		else
+			pool_wake_some(l, n);
 	}
+
+	/* workers only retire under the mutex, so this also
+	 * covers the last one timing out just now */
+	threads = l->threads;
 	if (pool_is_halting == 0 &&
-			pool_jobs > pool_threads && pool_threads < pool_max) {
-		pool_threads++;
-		spawn = 1;
+			l->jobs > threads && threads < l->max) {
+		spawn = l->jobs - threads;
+		if (spawn > l->max - threads)
+			spawn = l->max - threads;
+		if (spawn > n)
+			spawn = n;
+		__atomic_add_fetch(&l->threads, spawn, __ATOMIC_RELAXED);
 	}
-	pthread_mutex_unlock(&pool_mutex);
-	pthread_cond_signal(&pool_cond);
+	pthread_mutex_unlock(&l->mutex);
 
+	for (; spawn > 0; spawn--)
+		pool_spawnthread(l);
+}
 
-	if (spawn)
-		pool_spawnthread();
+void
+lem_async_run(struct lem_async *a)
+{
+	struct pool_lane *l;
+	struct pool_worker *w = pool_submit(a, &l);
+
+	pool_kick(l, w, 1);
 }
 
 void
-lem_async_config(int delay, int min, int max)
+lem_async_run_batch(struct lem_async **jobs, unsigned int n)
+{
+	unsigned int count[LEM_LANES] = { 0 };
+	unsigned int i;
+
+	for (i = 0; i < n; i++) {
+		struct pool_lane *l;
+
+		(void)pool_submit(jobs[i], &l);
+		count[l - pool_lanes]++;
+	}
+	for (i = 0; i < LEM_LANES; i++) {
+		if (count[i] > 0)
+			pool_kick(&pool_lanes[i], NULL, count[i]);
+	}
+}
+
+int
+lem_async_lane_config(int lane, int delay, int min, int max)
 {
+	struct pool_lane *l;
 	int spawn;
 
-	pool_delay = (time_t)delay;
-	pool_min = min;
-	pool_max = max;
+	if (lane < 0 || lane >= LEM_LANES)
+		return -1;
+	l = &pool_lanes[lane];
+
+	/* every thread needs a slot */
+	if (max > POOL_SLOTS)
+		max = POOL_SLOTS;
+	if (min > max)
+		min = max;
+
+	l->delay = (time_t)delay;
+	l->min = min;
+	l->max = max;
 
-	pthread_mutex_lock(&pool_mutex);
-	spawn = min - pool_threads;
+	pthread_mutex_lock(&l->mutex);
+	spawn = min - (int)l->threads;
 	if (spawn > 0)
-		pool_threads = min;
-	pthread_mutex_unlock(&pool_mutex);
+		l->threads = min;
+	/* let threads above the new limits time out */
+	pool_wake_some(l, POOL_SLOTS);
+	pthread_mutex_unlock(&l->mutex);
 
 	for (; spawn > 0; spawn--)
-		pool_spawnthread();
+		pool_spawnthread(l);
+	return 0;
+}
+
+int
+lem_async_lane_affinity(int lane, int enable)
+{
+	if (lane < 0 || lane >= LEM_LANES)
+		return -1;
+
+	pool_lanes[lane].affinity = enable ? 1 : 0;
+	return 0;
+}
+
+void
+lem_async_name(void (*work)(struct lem_async *a), const char *name)
+{
+	struct lem_pool_job_stats *t = pool_jobtype(work);
+
+	if (t != &pool_jobtypes[POOL_JOBTYPES])
+		__atomic_store_n(&t->name, name, __ATOMIC_RELEASE);
+}
+
+void
+lem_pool_getstats(struct lem_pool_lane_stats stats[LEM_LANES])
+{
+	unsigned int i;
+
+	for (i = 0; i < LEM_LANES; i++) {
+		struct pool_lane *l = &pool_lanes[i];
+		struct lem_pool_lane_stats *st = &stats[i];
+
+		st->spawned = __atomic_load_n(&l->spawned, __ATOMIC_RELAXED);
+		st->exited = __atomic_load_n(&l->exited, __ATOMIC_RELAXED);
+		st->threads = __atomic_load_n(&l->threads, __ATOMIC_RELAXED);
+		st->idle = __atomic_load_n(&l->idle, __ATOMIC_RELAXED);
+		st->jobs = l->jobs;
+		st->queued = __atomic_load_n(&l->queued, __ATOMIC_RELAXED);
+		st->maxqueued = l->maxqueued;
+	}
+}
+
+unsigned int
+lem_pool_getjobstats(struct lem_pool_job_stats *stats, unsigned int max)
+{
+	unsigned int i;
+	unsigned int n = 0;
+
+	for (i = 0; i <= POOL_JOBTYPES && n < max; i++) {
+		struct lem_pool_job_stats *t = &pool_jobtypes[i];
+		unsigned int j;
+
+		if (__atomic_load_n(&t->jobs, __ATOMIC_RELAXED) == 0)
+			continue;
+
+		stats[n].work = __atomic_load_n(&t->work, __ATOMIC_ACQUIRE);
+		stats[n].name = __atomic_load_n(&t->name, __ATOMIC_ACQUIRE);
+		stats[n].jobs = __atomic_load_n(&t->jobs, __ATOMIC_RELAXED);
+		for (j = 0; j < LEM_POOL_HISTSIZE; j++) {
+			stats[n].wait[j] = __atomic_load_n(&t->wait[j],
+					__ATOMIC_RELAXED);
+			stats[n].service[j] = __atomic_load_n(&t->service[j],
+					__ATOMIC_RELAXED);
+		}
+		n++;
+	}
+	return n;
+}
+
+void
+lem_async_config(int delay, int min, int max)
+{
+	(void)lem_async_lane_config(LEM_LANE_FS, delay, min, max);
 }
 
 static void
@@ -284,25 +831,38 @@ lem_exit_timeout(EV_P_ ev_timer *w, int revents) {
 
 static void
 lem_pool_halt(EV_P_ struct ev_idle *w, int revents) {
+	unsigned int threads = 0;
+	unsigned int i;
+
 	(void)w;
 	(void)revents;
-		pthread_mutex_lock(&pool_mutex);
 
-		if (pool_threads == 0) {
-			ev_idle_stop(EV_A_ w);
-			ev_unloop(LEM_ EVBREAK_ALL);
-		} else {
-			pthread_cond_signal(&pool_cond);
+	for (i = 0; i < LEM_LANES; i++) {
+		struct pool_lane *l = &pool_lanes[i];
+
+		pthread_mutex_lock(&l->mutex);
+		if (l->threads > 0) {
+			threads += l->threads;
+			pool_wake_some(l, 1);
 		}
-		pthread_mutex_unlock(&pool_mutex);
+		pthread_mutex_unlock(&l->mutex);
+	}
+
+	if (threads == 0) {
+		ev_idle_stop(EV_A_ w);
+		ev_unloop(LEM_ EVBREAK_ALL);
+	}
 }
 
 
 inline static void
 lem_wait_pool_to_be_empty_upto_delay(double delay) {
+	unsigned int i;
+
 	ev_now_update(LEM);
 
-	lem_async_config(0, 0, pool_max);
+	for (i = 0; i < LEM_LANES; i++)
+		(void)lem_async_lane_config(i, 0, 0, pool_lanes[i].max);
 	pool_is_halting = 1;
 
 	if (delay == 0) {
@@ -24,6 +24,7 @@
 #include "../lem/io/core.c"
 #include "../lem/os/core.c"
 #include "../lem/parsers/core.c"
+#include "../lem/buffer/core.c"
 #include "../lem/utils/core.c"
 
 #include "static-clib-extra.h"
@@ -31,6 +32,7 @@
 static const luaL_Reg lem_loadedlibs[] = { 
 	{"lem.utils.core", luaopen_lem_utils_core},
 	{"lem.parsers.core", luaopen_lem_parsers_core},
+	{"lem.buffer.core", luaopen_lem_buffer_core},
 	{"lem.signal.core", luaopen_lem_signal_core},
 	{"lem.http.core", luaopen_lem_http_core},
 	{"lem.lfs.core", luaopen_lem_lfs_core},
@@ -0,0 +1,347 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Hierarchical timer wheel.
+ *
+ * Time is divided into ticks of wheel.granularity seconds. Level 0
+ * has one slot per tick for the next WHEEL_SLOTS ticks, level 1 one
+ * slot per WHEEL_SLOTS ticks and so on. Whenever the level 0 index
+ * wraps around the next slot of the level above is cascaded down.
+ * Timers expire on the first tick boundary after their deadline, so
+ * timers due within the same tick are coalesced into a single wakeup.
+ *
+ * A single ev_timer drives the wheel and is only rescheduled when a
+ * timer due earlier than the next wakeup is added.
+ *
+ * With a granularity of 0 the wheel is disabled and every lem_timer
+ * simply runs its own ev_timer.
+ */
+
+#define WHEEL_BITS   6
+#define WHEEL_SLOTS  (1 << WHEEL_BITS)
+#define WHEEL_MASK   (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS 4
+
+struct timer_wheel {
+	struct ev_timer w;
+	ev_tstamp granularity;
+	ev_tstamp origin;
+	uint64_t tick;
+	uint64_t wakeup;
+	unsigned long active;
+	int running;
+	uint64_t occupied[WHEEL_LEVELS];
+	struct lem_timer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+};
+
+static struct timer_wheel wheel;
+
+static inline void
+wheel_link(struct lem_timer **head, struct lem_timer *t)
+{
+	t->next = *head;
+	if (t->next)
+		t->next->pprev = &t->next;
+	t->pprev = head;
+	*head = t;
+}
+
+static inline void
+wheel_unlink(struct lem_timer *t)
+{
+	*t->pprev = t->next;
+	if (t->next)
+		t->next->pprev = t->pprev;
+	t->pprev = NULL;
+}
+
+static void
+wheel_insert(struct lem_timer *t)
+{
+	uint64_t delta = t->expires - wheel.tick;
+	unsigned int level;
+	unsigned int slot;
+
+	if (t->expires < wheel.tick)
+		delta = 0;
+
+	for (level = 0; level < WHEEL_LEVELS - 1; level++) {
+		if (delta < ((uint64_t)1 << (WHEEL_BITS * (level + 1))))
+			break;
+	}
+
+	/* timers too far into the future are parked in the last
+	 * slot and re-inserted once they cascade down */
+	if (delta >= ((uint64_t)1 << (WHEEL_BITS * WHEEL_LEVELS)))
+		slot = (wheel.tick + ((uint64_t)WHEEL_MASK << (WHEEL_BITS * level)))
+			>> (WHEEL_BITS * level);
+	else
+		slot = (delta ? t->expires : wheel.tick) >> (WHEEL_BITS * level);
+	slot &= WHEEL_MASK;
+
+	wheel_link(&wheel.slots[level][slot], t);
+	wheel.occupied[level] |= (uint64_t)1 << slot;
+}
+
+static void
+wheel_remove(struct lem_timer *t)
+{
+	struct lem_timer **head = t->pprev;
+
+	wheel_unlink(t);
+
+	/* clear the occupied bit if the slot went empty */
+	if (*head == NULL) {
+		unsigned int level;
+
+		for (level = 0; level < WHEEL_LEVELS; level++) {
+			struct lem_timer **first = &wheel.slots[level][0];
+
+			if (head >= first && head < first + WHEEL_SLOTS) {
+				wheel.occupied[level] &=
+					~((uint64_t)1 << (head - first));
+				break;
+			}
+		}
+	}
+}
+
+static void
+wheel_cascade(unsigned int level)
+{
+	unsigned int slot = (wheel.tick >> (WHEEL_BITS * level)) & WHEEL_MASK;
+	struct lem_timer *t = wheel.slots[level][slot];
+
+	wheel.slots[level][slot] = NULL;
+	wheel.occupied[level] &= ~((uint64_t)1 << slot);
+
+	while (t) {
+		struct lem_timer *next = t->next;
+
+		t->pprev = NULL;
+		wheel_insert(t);
+		t = next;
+	}
+
+	if (slot == 0 && level + 1 < WHEEL_LEVELS)
+		wheel_cascade(level + 1);
+}
+
+static void
+wheel_run_tick(void)
+{
+	uint64_t current = wheel.tick;
+	unsigned int slot = current & WHEEL_MASK;
+	struct lem_timer *pending;
+	struct lem_timer *t;
+
+	if (slot == 0)
+		wheel_cascade(1);
+
+	/* move the slot to a local list so callbacks are free
+	 * to start and stop timers, including the pending ones */
+	pending = wheel.slots[0][slot];
+	wheel.slots[0][slot] = NULL;
+	wheel.occupied[0] &= ~((uint64_t)1 << slot);
+	if (pending)
+		pending->pprev = &pending;
+
+	/* timers added by the callbacks belong to the next tick */
+	wheel.tick++;
+
+	while ((t = pending) != NULL) {
+		wheel_unlink(t);
+		if (t->expires > current) {
+			/* parked far future timer */
+			wheel_insert(t);
+			continue;
+		}
+		wheel.active--;
+		t->cb(t);
+	}
+}
+
+static void
+wheel_reschedule(EV_P)
+{
+	struct ev_timer *w = &wheel.w;
+	uint64_t next;
+	uint64_t r;
+	unsigned int slot;
+	ev_tstamp delay;
+
+	if (wheel.active == 0) {
+		ev_timer_stop(EV_A_ w);
+		return;
+	}
+
+	/* the next occupied level 0 slot in this rotation,
+	 * or the next cascade, whichever comes first */
+	slot = wheel.tick & WHEEL_MASK;
+	if (slot == 0)
+		next = wheel.tick;
+	else {
+		next = (wheel.tick | WHEEL_MASK) + 1;
+		r = wheel.occupied[0] >> slot;
+		if (r)
+			next = wheel.tick + __builtin_ctzll(r);
+	}
+
+	if (ev_is_active(w) && wheel.wakeup == next)
+		return;
+
+	wheel.wakeup = next;
+	delay = wheel.origin + next * wheel.granularity - ev_now(EV_A);
+	if (delay < 0)
+		delay = 0;
+
+	ev_timer_stop(EV_A_ w);
+	ev_timer_set(w, delay, 0);
+	ev_timer_start(EV_A_ w);
+}
+
+static void
+wheel_cb(EV_P_ struct ev_timer *w, int revents)
+{
+	uint64_t target;
+
+	(void)w;
+	(void)revents;
+
+	/* keep the clock while the callbacks run, even
+	 * if they leave no timers active for a moment */
+	wheel.running = 1;
+	target = (uint64_t)((ev_now(EV_A) - wheel.origin) / wheel.granularity);
+	while (wheel.tick <= target) {
+		/* skip straight to the next cascade if
+		 * nothing is due before then */
+		if (wheel.occupied[0] == 0 && (wheel.tick & WHEEL_MASK) != 0) {
+			uint64_t skip = (wheel.tick | WHEEL_MASK) + 1;
+
+			wheel.tick = skip <= target ? skip : target + 1;
+			continue;
+		}
+		wheel_run_tick();
+	}
+	wheel.running = 0;
+
+	wheel_reschedule(EV_A);
+}
+
+static void
+timer_ev_cb(EV_P_ struct ev_timer *w, int revents)
+{
+	struct lem_timer *t = (struct lem_timer *)w;
+
+	(void)EV_A;
+	(void)revents;
+
+	t->cb(t);
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wstrict-aliasing"
+void
+lem_timer_init(struct lem_timer *t, void (*cb)(struct lem_timer *t))
+{
+	ev_init(&t->w, timer_ev_cb);
+	t->next = NULL;
+	t->pprev = NULL;
+	t->cb = cb;
+}
+
+static inline void
+wheel_init(void)
+{
+	ev_init(&wheel.w, wheel_cb);
+}
+#pragma GCC diagnostic pop
+
+void
+lem_timer_start(struct lem_timer *t, ev_tstamp delay)
+{
+	struct ev_timer *w;
+	ev_tstamp now;
+
+	if (wheel.granularity <= 0) {
+		w = &t->w;
+		ev_timer_set(w, delay, 0);
+		ev_timer_start(LEM_ w);
+		return;
+	}
+
+	now = ev_now(LEM);
+	if (wheel.active == 0 && !wheel.running) {
+		/* restart the clock so ticks line up with now */
+		wheel.origin = now;
+		wheel.tick = 0;
+		wheel.wakeup = 0;
+		ev_timer_stop(LEM_ &wheel.w);
+	}
+
+	if (delay < 0)
+		delay = 0;
+	t->expires = (uint64_t)((now - wheel.origin + delay)
+			/ wheel.granularity) + 1;
+	wheel_insert(t);
+	wheel.active++;
+
+	/* wheel_cb reschedules when it is done */
+	if (wheel.running)
+		return;
+
+	w = &wheel.w;
+	if (!ev_is_active(w) || t->expires < wheel.wakeup)
+		wheel_reschedule(LEM);
+}
+
+void
+lem_timer_stop(struct lem_timer *t)
+{
+	if (t->pprev != NULL) {
+		wheel_remove(t);
+		wheel.active--;
+		return;
+	}
+
+	ev_timer_stop(LEM_ &t->w);
+}
+
+int
+lem_timer_active(struct lem_timer *t)
+{
+	struct ev_timer *w = &t->w;
+
+	return t->pprev != NULL || ev_is_active(w);
+}
+
+int
+lem_timerwheel_config(ev_tstamp granularity)
+{
+	if (wheel.active > 0 || wheel.running)
+		return -1;
+
+	wheel.granularity = granularity;
+	return 0;
+}
+
+unsigned long
+lem_timerwheel_active(void)
+{
+	return wheel.active;
+}
@@ -0,0 +1,83 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LEM_BUFFER_H
+#define _LEM_BUFFER_H
+
+#include <lem.h>
+
+#define LEM_BUFFER_MT "lem.Buffer"
+
+/*
+ * A resizable byte array. Views made with buffer:sub() share the
+ * storage of their parent until one of them is written to, at which
+ * point that one moves to storage of its own.
+ *
+ * While busy is non-zero the length of the buffer must not change
+ * and its data must not move. The io module keeps buffers busy while
+ * a write is queued or a read on the thread pool fills them.
+ */
+struct lem_bufstore {
+	unsigned long refs;
+	size_t size;
+	char data[];
+};
+
+struct lem_buffer {
+	struct lem_bufstore *store;
+	size_t off;  /* start of this buffer in the store */
+	size_t len;
+	size_t cap;  /* room from off on */
+	size_t pos;  /* cursor of buffer:unpack() */
+	unsigned int busy;
+};
+
+/* pushes a new empty buffer, metatable LEM_BUFFER_MT if it exists,
+ * raises an error if out of memory */
+struct lem_buffer *lem_buffer_new(lua_State *T, size_t size);
+/* pushes a view of len bytes from off into b */
+struct lem_buffer *lem_buffer_view(lua_State *T, struct lem_buffer *b,
+		size_t off, size_t len);
+/* returns room for n more bytes after len, NULL if busy or out of
+ * memory */
+char *lem_buffer_reserve(struct lem_buffer *b, size_t n);
+/* must be called from the __gc metamethod */
+void lem_buffer_free(struct lem_buffer *b);
+
+static inline char *
+lem_buffer_data(struct lem_buffer *b)
+{
+	return b->store->data + b->off;
+}
+
+/* returns the buffer at idx, NULL if it isn't one */
+static inline struct lem_buffer *
+lem_buffer_test(lua_State *T, int idx)
+{
+	struct lem_buffer *b = lua_touserdata(T, idx);
+
+	if (b == NULL || !lua_getmetatable(T, idx))
+		return NULL;
+
+	luaL_getmetatable(T, LEM_BUFFER_MT);
+	if (!lua_rawequal(T, -1, -2))
+		b = NULL;
+	lua_pop(T, 2);
+	return b;
+}
+
+#endif
@@ -0,0 +1,75 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _LEM_CHANNEL_H
+#define _LEM_CHANNEL_H
+
+#include <lem.h>
+
+#define LEM_CHANNEL_MT "lem.Channel"
+
+enum lem_channel_status {
+	LEM_CHANNEL_OK,
+	LEM_CHANNEL_AGAIN,  /* full on put, empty on get */
+	LEM_CHANNEL_CLOSED,
+};
+
+/*
+ * A bounded FIFO of Lua values. Values live in a table referenced
+ * from the registry, while coroutines blocked on the channel are kept
+ * in a ring of their own and woken up in the order they arrived.
+ * Waiters are always of one kind: getters when the channel is empty
+ * and putters when it is full.
+ *
+ * A blocked putter must yield with the value it wants to put on the
+ * top of its stack, and will be resumed with true once the value is
+ * in the channel. A blocked getter will be resumed with the value.
+ * Both are resumed with nil, 'closed' if the channel is closed.
+ */
+struct lem_channel {
+	unsigned int cap;
+	unsigned int head;
+	unsigned int len;
+	int ref;
+	int closed;
+	struct {
+		lua_State **T;
+		unsigned int mask;
+		unsigned int first;
+		unsigned int last;
+	} waiters;
+};
+
+/* pushes a new channel, metatable LEM_CHANNEL_MT if it exists */
+struct lem_channel *lem_channel_new(lua_State *T, unsigned int cap);
+/* must be called from the __gc metamethod */
+void lem_channel_free(lua_State *T, struct lem_channel *ch);
+/* pops the value on top of T on LEM_CHANNEL_OK */
+int lem_channel_tryput(lua_State *T, struct lem_channel *ch);
+/* pushes the next value onto T on LEM_CHANNEL_OK */
+int lem_channel_tryget(lua_State *T, struct lem_channel *ch);
+/* queue T to be resumed as described above, the caller must yield */
+void lem_channel_wait(struct lem_channel *ch, lua_State *T);
+void lem_channel_close(struct lem_channel *ch);
+
+static inline unsigned int
+lem_channel_waiting(struct lem_channel *ch)
+{
+	return (ch->waiters.last - ch->waiters.first) & ch->waiters.mask;
+}
+
+#endif
@@ -22,13 +22,16 @@
 #include <lem.h>
 
 #define LEM_INPUTBUF_PSIZE (4*sizeof(size_t))
-#define LEM_INPUTBUF_SIZE 4096
+#define LEM_INPUTBUF_SIZE 4096 /* default size of new buffers */
 
 struct lem_inputbuf {
 	unsigned int start;
 	unsigned int end;
+	unsigned int size;     /* size of the attached buffer */
+	unsigned int defsize;  /* size of newly attached buffers */
+	size_t hint;           /* bytes known to be readable, 0 if unknown */
 	char pstate[LEM_INPUTBUF_PSIZE];
-	char buf[LEM_INPUTBUF_SIZE];
+	char *buf;
 };
 
 enum lem_preason {
@@ -48,4 +51,45 @@ lem_inputbuf_init(struct lem_inputbuf *buf)
 	buf->start = buf->end = 0;
 }
 
+/* set the size of a buffer which is allocated on first use */
+static inline void
+lem_inputbuf_setup(struct lem_inputbuf *buf, unsigned int size)
+{
+	buf->start = buf->end = 0;
+	buf->size = buf->defsize = size;
+	buf->hint = 0;
+	buf->buf = NULL;
+}
+
+struct lem_inputbuf_stats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long buffers;  /* attached to a stream or file */
+	size_t resident;        /* bytes in those buffers */
+	unsigned int pooled;    /* buffers on the free list */
+	unsigned int cap;
+	unsigned int size;      /* size of pooled buffers */
+};
+
+/*
+ * input buffers are attached on demand and may be detached
+ * whenever start and end are both 0
+ */
+void lem_inputbuf_get(struct lem_inputbuf *buf);
+/* detach the buffer if no data remains */
+void lem_inputbuf_put(struct lem_inputbuf *buf);
+/* detach the buffer, dropping any unread data */
+void lem_inputbuf_free(struct lem_inputbuf *buf);
+/*
+ * change the size of the attached buffer keeping start and end as
+ * they are, so parsers may grow the buffer in the middle of their
+ * work. the next buffer attached is of the default size again
+ * returns -1 if size is less than end or the memory couldn't
+ * be allocated
+ */
+int lem_inputbuf_resize(struct lem_inputbuf *buf, unsigned int size);
+/* buffers of this size are kept on a free list */
+void lem_inputbuf_config(unsigned int size);
+void lem_inputbuf_getstats(struct lem_inputbuf_stats *stats);
+
 #endif
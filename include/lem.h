@@ -23,6 +23,7 @@
 #include <ev-config.h>
 #include <ev.h>
 
+#include <stdint.h>
 #include <lua.h>
 #include <lauxlib.h>
 
@@ -66,10 +67,101 @@ extern struct ev_loop *lem_loop;
 #define LEM lem_loop
 #define LEM_ LEM,
 
+/* thread pool lanes, each with its own queue and threads */
+enum lem_lane {
+	LEM_LANE_FS,       /* quick file system operations */
+	LEM_LANE_NET,      /* name lookups, connects and the like */
+	LEM_LANE_BLOCKING, /* jobs that may block indefinitely */
+	LEM_LANE_USER,     /* jobs submitted on behalf of Lua code */
+	LEM_LANES
+};
+
 struct lem_async {
 	void (*work)(struct lem_async *a);
 	void (*reap)(struct lem_async *a);
 	struct lem_async *next;
+	unsigned int lane;
+	/* set by the pool, a hint where to run it next. lem_async_do()
+	 * clears it, so callers of lem_async_run() must set lane and zero
+	 * worker themselves unless the job went through lem_async_do() */
+	unsigned int worker;
+	/* set by the pool, CLOCK_MONOTONIC in nanoseconds */
+	uint64_t submitted;
+	uint64_t started;
+	uint64_t finished;
+};
+
+struct lem_runqueue_stats {
+	unsigned long iterations;
+	unsigned long resumed;
+	unsigned long overruns;
+	unsigned int maxbatch;
+};
+
+struct lem_threadcache_stats {
+	unsigned long hits;
+	unsigned long misses;
+	unsigned long recycled;
+	unsigned long dropped;
+	unsigned int size;
+	unsigned int cap;
+};
+
+#define LEM_GC_HISTSIZE 24
+
+struct lem_gc_stats {
+	unsigned long steps;
+	unsigned long cycles;
+	ev_tstamp maxpause;
+	/* pauses[i] counts steps taking less than 2^i microseconds */
+	unsigned long pauses[LEM_GC_HISTSIZE];
+};
+
+#define LEM_ALLOC_GRANULE 16
+#define LEM_ALLOC_CLASSES 32
+
+struct lem_alloc_class_stats {
+	unsigned long allocs;
+	unsigned long inuse;
+	unsigned long slabs;
+};
+
+struct lem_alloc_stats {
+	/* classes[i] holds blocks of (i+1)*LEM_ALLOC_GRANULE bytes */
+	struct lem_alloc_class_stats classes[LEM_ALLOC_CLASSES];
+	unsigned long large_allocs;
+	size_t large_inuse;
+};
+
+#define LEM_POOL_HISTSIZE 24
+#define LEM_POOL_JOBTYPES 128
+
+struct lem_pool_lane_stats {
+	unsigned long spawned;
+	unsigned long exited;
+	unsigned int threads;
+	unsigned int idle;
+	unsigned int jobs;      /* submitted and not yet reaped */
+	unsigned int queued;    /* submitted and not yet started */
+	unsigned int maxqueued;
+};
+
+struct lem_pool_job_stats {
+	void (*work)(struct lem_async *a);
+	const char *name;
+	unsigned long jobs;
+	/* wait[i] and service[i] count jobs that waited in the queue
+	 * or ran for less than 2^i microseconds */
+	unsigned long wait[LEM_POOL_HISTSIZE];
+	unsigned long service[LEM_POOL_HISTSIZE];
+};
+
+struct lem_timer {
+	struct ev_timer w;
+	struct lem_timer *next;
+	struct lem_timer **pprev;
+	uint64_t expires;
+	void (*cb)(struct lem_timer *t);
 };
 
 void *lem_xmalloc(size_t size);
@@ -77,26 +169,59 @@ lua_State *lem_newthread(void);
 void lem_forgetthread(lua_State *T);
 void lem_queue(lua_State *T, int nargs);
 void lem_exit(int status);
+int lem_on_loop_thread(void);
 void lem_async_run(struct lem_async *a);
+void lem_async_run_batch(struct lem_async **jobs, unsigned int n);
 void lem_async_config(int delay, int min, int max);
+int lem_async_lane_config(int lane, int delay, int min, int max);
+int lem_async_lane_affinity(int lane, int enable);
+void lem_async_name(void (*work)(struct lem_async *a), const char *name);
+void lem_pool_getstats(struct lem_pool_lane_stats stats[LEM_LANES]);
+unsigned int lem_pool_getjobstats(struct lem_pool_job_stats *stats,
+		unsigned int max);
+void lem_runqueue_config(unsigned int batch, ev_tstamp budget);
+void lem_runqueue_getstats(struct lem_runqueue_stats *stats);
+void lem_threadcache_config(unsigned int cap);
+void lem_threadcache_getstats(struct lem_threadcache_stats *stats);
+void lem_idlegc_config(int enable, int kb, ev_tstamp budget, ev_tstamp quiet);
+int lem_gc_setmode(int generational);
+void lem_idlegc_getstats(struct lem_gc_stats *stats);
+int lem_alloc_getstats(struct lem_alloc_stats *stats);
+void lem_timer_init(struct lem_timer *t, void (*cb)(struct lem_timer *t));
+void lem_timer_start(struct lem_timer *t, ev_tstamp delay);
+void lem_timer_stop(struct lem_timer *t);
+int lem_timer_active(struct lem_timer *t);
+int lem_timerwheel_config(ev_tstamp granularity);
+unsigned long lem_timerwheel_active(void);
 
 void on_lem_process_exit(void (*cb)(void));
 lua_State* lem_get_global_lua_state();
 
+extern const char *const lem_lane_names[];
 extern char **__lem_main_environ;
 extern char **__lem_main_argv;
 extern int __lem_main_argc;
 
 static inline void
-lem_async_do(struct lem_async *a,
+lem_async_do_lane(struct lem_async *a, enum lem_lane lane,
 		void (*work)(struct lem_async *a),
 		void (*reap)(struct lem_async *a))
 {
 	a->work = work;
 	a->reap = reap;
+	a->lane = lane;
+	a->worker = 0;
 	lem_async_run(a);
 }
 
+static inline void
+lem_async_do(struct lem_async *a,
+		void (*work)(struct lem_async *a),
+		void (*reap)(struct lem_async *a))
+{
+	lem_async_do_lane(a, LEM_LANE_FS, work, reap);
+}
+
 #if LUA_VERSION_NUM >= 502
   #define lua_objlen(a,b) lua_rawlen(a,b)
 #endif
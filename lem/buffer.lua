@@ -0,0 +1,28 @@
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+local buffer = require 'lem.buffer.core'
+
+local Buffer = buffer.Buffer
+
+function Buffer:eof()
+	return self:remaining() == 0
+end
+
+return buffer
+
+-- vim: ts=2 sw=2 noet:
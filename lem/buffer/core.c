@@ -0,0 +1,725 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include <lem-buffer.h>
+
+static struct lem_buffer *
+buffer_check(lua_State *T, int idx)
+{
+	struct lem_buffer *b = lem_buffer_test(T, idx);
+
+	if (b == NULL)
+		luaL_argerror(T, idx, "expected buffer");
+	return b;
+}
+
+static void
+buffer_checkfree(lua_State *T, struct lem_buffer *b)
+{
+	if (b->busy)
+		luaL_error(T, "buffer busy");
+}
+
+static char *
+buffer_grow(lua_State *T, struct lem_buffer *b, size_t n)
+{
+	char *p;
+
+	buffer_checkfree(T, b);
+	p = lem_buffer_reserve(b, n);
+	if (p == NULL)
+		luaL_error(T, "out of memory");
+	return p;
+}
+
+/* translate a relative string position, like string.sub does */
+static size_t
+buffer_posrelat(lua_Integer pos, size_t len)
+{
+	if (pos >= 0)
+		return (size_t)pos;
+	if ((size_t)-pos > len)
+		return 0;
+	return len + (size_t)pos + 1;
+}
+
+/* get the 0-based range [*i, *j) from arguments idx and idx+1 */
+static void
+buffer_range(lua_State *T, struct lem_buffer *b, int idx,
+		lua_Integer defi, lua_Integer defj, size_t *i, size_t *j)
+{
+	size_t start = buffer_posrelat(luaL_optinteger(T, idx, defi), b->len);
+	size_t end = buffer_posrelat(luaL_optinteger(T, idx + 1, defj), b->len);
+
+	if (start < 1)
+		start = 1;
+	if (end > b->len)
+		end = b->len;
+	if (start > end) {
+		*i = *j = 0;
+		return;
+	}
+	*i = start - 1;
+	*j = end;
+}
+
+/*
+ * buffer.new([size | string])
+ */
+static int
+buffer_new(lua_State *T)
+{
+	struct lem_buffer *b;
+	lua_Integer n;
+	size_t len;
+	const char *str;
+
+	if (lua_type(T, 1) == LUA_TSTRING) {
+		str = lua_tolstring(T, 1, &len);
+		b = lem_buffer_new(T, len);
+		memcpy(lem_buffer_data(b), str, len);
+		b->len = len;
+		return 1;
+	}
+
+	n = luaL_optinteger(T, 1, 0);
+	luaL_argcheck(T, n >= 0, 1, "expected a non-negative number");
+	(void)lem_buffer_new(T, (size_t)n);
+	return 1;
+}
+
+static int
+buffer_gc(lua_State *T)
+{
+	lem_buffer_free(lua_touserdata(T, 1));
+	return 0;
+}
+
+static int
+buffer_len(lua_State *T)
+{
+	struct lem_buffer *b = buffer_check(T, 1);
+
+	lua_pushinteger(T, (lua_Integer)b->len);
+	return 1;
+}
+
+/*
+ * buffer:tostring([i [, j]]) copies the range into a string
+ */
+static int
+buffer_tostring(lua_State *T)
+{
+	struct lem_buffer *b = buffer_check(T, 1);
+	size_t i, j;
+
+	buffer_range(T, b, 2, 1, -1, &i, &j);
+	lua_pushlstring(T, lem_buffer_data(b) + i, j - i);
+	return 1;
+}
+
+/*
+ * buffer:sub(i [, j]) returns a view sharing memory with the buffer
+ */
+static int
+buffer_sub(lua_State *T)
+{
+	struct lem_buffer *b = buffer_check(T, 1);
+	size_t i, j;
+
+	luaL_checkinteger(T, 2);
+	buffer_range(T, b, 2, 1, -1, &i, &j);
+	(void)lem_buffer_view(T, b, i, j - i);
+	return 1;
+}
+
+static int
+buffer_byte(lua_State *T)
+{
+	struct lem_buffer *b = buffer_check(T, 1);
+	lua_Integer pi = luaL_optinteger(T, 2, 1);
+	const unsigned char *data = (unsigned char *)lem_buffer_data(b);
+	size_t i, j;
+	int n;
+
+	buffer_range(T, b, 2, pi, pi, &i, &j);
+	n = (int)(j - i);
+	luaL_checkstack(T, n, "byte range too large");
+	for (; i < j; i++)
+		lua_pushinteger(T, data[i]);
+	return n;
+}
+
+/*
+ * buffer:find(str [, init]) plain search, returns start and end
+ */
+static int
+buffer_find(lua_State *T)
+{
+	struct lem_buffer *b = buffer_check(T, 1);
+	size_t len;
+	const char *str = luaL_checklstring(T, 2, &len);
+	size_t init = buffer_posrelat(luaL_optinteger(T, 3, 1), b->len);
+	const char *data = lem_buffer_data(b);
+	const char *p;
+	const char *end;
+
+	if (init < 1)
+		init = 1;
+	if (init - 1 > b->len || len > b->len - (init - 1)) {
+		lua_pushnil(T);
+		return 1;
+	}
+	if (len == 0) {
+		lua_pushinteger(T, (lua_Integer)init);
+		lua_pushinteger(T, (lua_Integer)init - 1);
+		return 2;
+	}
+
+	p = data + init - 1;
+	end = data + b->len - len + 1;
+	while (p < end) {
+		p = memchr(p, str[0], end - p);
+		if (p == NULL)
+			break;
+		if (memcmp(p + 1, str + 1, len - 1) == 0) {
+			lua_pushinteger(T, (lua_Integer)(p - data) + 1);
+			lua_pushinteger(T, (lua_Integer)(p - data + len));
+			return 2;
+		}
+		p++;
+	}
+
+	lua_pushnil(T);
+	return 1;
+}
+
+/*
+ * buffer:append(...) appends strings and buffers
+ */
+static int
+buffer_append(lua_State *T)
+{
+	struct lem_buffer *b = buffer_check(T, 1);
+	int top = lua_gettop(T);
+	int i;
+
+	for (i = 2; i <= top; i++) {
+		struct lem_buffer *src = lem_buffer_test(T, i);
+		const char *str;
+		size_t len;
+		char *p;
+
+		if (src != NULL) {
+			len = src->len;
+			p = buffer_grow(T, b, len);
+			/* src may share (or be) b */
+			str = lem_buffer_data(src);
+			memmove(p, str, len);
+		} else {
+			str = luaL_checklstring(T, i, &len);
+			p = buffer_grow(T, b, len);
+			memcpy(p, str, len);
+		}
+		b->len += len;
+	}
+
+	lua_settop(T, 1);
+	return 1;
+}
+
+/*
+ * buffer:setlen(n) truncates or extends with zeroes
+ */
+static int
+buffer_setlen(lua_State *T)
+{
+	struct lem_buffer *b = buffer_check(T, 1);
+	lua_Integer n = luaL_checkinteger(T, 2);
+
+	luaL_argcheck(T, n >= 0, 2, "expected a non-negative number");
+	buffer_checkfree(T, b);
+	if ((size_t)n > b->len) {
+		char *p = buffer_grow(T, b, (size_t)n - b->len);
+
+		memset(p, 0, (size_t)n - b->len);
+	}
+	b->len = (size_t)n;
+	if (b->pos > b->len)
+		b->pos = b->len;
+
+	lua_settop(T, 1);
+	return 1;
+}
+
+static int
+buffer_reserve(lua_State *T)
+{
+	struct lem_buffer *b = buffer_check(T, 1);
+	lua_Integer n = luaL_checkinteger(T, 2);
+
+	luaL_argcheck(T, n >= 0, 2, "expected a non-negative number");
+	(void)buffer_grow(T, b, (size_t)n);
+	lua_settop(T, 1);
+	return 1;
+}
+
+static int
+buffer_clear(lua_State *T)
+{
+	struct lem_buffer *b = buffer_check(T, 1);
+
+	buffer_checkfree(T, b);
+	b->len = 0;
+	b->pos = 0;
+	lua_settop(T, 1);
+	return 1;
+}
+
+/*
+ * buffer:pos([pos]) gets or sets the cursor, 1 is the first byte
+ */
+static int
+buffer_pos(lua_State *T)
+{
+	struct lem_buffer *b = buffer_check(T, 1);
+
+	lua_pushinteger(T, (lua_Integer)b->pos + 1);
+	if (!lua_isnoneornil(T, 2)) {
+		lua_Integer pos = luaL_checkinteger(T, 2);
+
+		luaL_argcheck(T, pos >= 1 && (size_t)pos - 1 <= b->len, 2,
+				"position out of bounds");
+		b->pos = (size_t)pos - 1;
+	}
+	return 1;
+}
+
+static int
+buffer_remaining(lua_State *T)
+{
+	struct lem_buffer *b = buffer_check(T, 1);
+
+	lua_pushinteger(T, (lua_Integer)(b->len - b->pos));
+	return 1;
+}
+
+/*
+ * binary packing
+ *
+ * a subset of the string.pack() format: < > = for endianness,
+ * b B h H i[n] I[n] l L j J T for integers of up to 8 bytes,
+ * f d n for floats, s[n] z c[n] for strings and x for padding
+ */
+enum buffer_kind {
+	KINT,
+	KUINT,
+	KFLOAT,
+	KDOUBLE,
+	KNUMBER,
+	KSTRING,
+	KZSTR,
+	KCHAR,
+	KPADDING,
+	KNOP,
+};
+
+struct buffer_fmt {
+	const char *s;
+	int little;
+};
+
+static int
+buffer_fmtnum(const char **s, int def)
+{
+	int n = 0;
+
+	if (**s < '0' || **s > '9')
+		return def;
+	do {
+		n = 10*n + (*(*s)++ - '0');
+	} while (**s >= '0' && **s <= '9' && n < 1000);
+	return n;
+}
+
+static int
+buffer_intsize(lua_State *T, const char **s, int def)
+{
+	int n = buffer_fmtnum(s, def);
+
+	if (n < 1 || n > 8)
+		luaL_error(T, "integral size (%d) out of limits [1,8]", n);
+	return n;
+}
+
+static enum buffer_kind
+buffer_option(lua_State *T, struct buffer_fmt *f, size_t *size)
+{
+	int opt = *f->s++;
+
+	switch (opt) {
+	case 'b': *size = 1; return KINT;
+	case 'B': *size = 1; return KUINT;
+	case 'h': *size = 2; return KINT;
+	case 'H': *size = 2; return KUINT;
+	case 'l': *size = sizeof(long); return KINT;
+	case 'L': *size = sizeof(long); return KUINT;
+	case 'j': *size = sizeof(lua_Integer); return KINT;
+	case 'J': *size = sizeof(lua_Integer); return KUINT;
+	case 'T': *size = sizeof(size_t); return KUINT;
+	case 'i': *size = buffer_intsize(T, &f->s, sizeof(int)); return KINT;
+	case 'I': *size = buffer_intsize(T, &f->s, sizeof(int)); return KUINT;
+	case 'f': *size = sizeof(float); return KFLOAT;
+	case 'd': *size = sizeof(double); return KDOUBLE;
+	case 'n': *size = sizeof(lua_Number); return KNUMBER;
+	case 's': *size = buffer_intsize(T, &f->s, sizeof(size_t)); return KSTRING;
+	case 'z': *size = 0; return KZSTR;
+	case 'x': *size = 1; return KPADDING;
+	case 'c':
+		*size = buffer_fmtnum(&f->s, -1);
+		if (*size == (size_t)-1)
+			luaL_error(T, "missing size for format option 'c'");
+		return KCHAR;
+	case ' ': break;
+	case '<': f->little = 1; break;
+	case '>': f->little = 0; break;
+	case '=': {
+			static const union { int i; char c; } one = { 1 };
+
+			f->little = one.c;
+		}
+		break;
+	default:
+		luaL_error(T, "invalid format option '%c'", opt);
+	}
+
+	*size = 0;
+	return KNOP;
+}
+
+static void
+buffer_putint(char *p, uint64_t v, size_t size, int little)
+{
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		p[little ? i : size - 1 - i] = (char)(v & 0xFF);
+		v >>= 8;
+	}
+}
+
+static uint64_t
+buffer_getint(const char *p, size_t size, int little, int issigned)
+{
+	const unsigned char *u = (const unsigned char *)p;
+	uint64_t v = 0;
+	size_t i;
+
+	for (i = 0; i < size; i++)
+		v = (v << 8) | u[little ? size - 1 - i : i];
+
+	if (issigned && size < 8) {
+		uint64_t mask = (uint64_t)1 << (8*size - 1);
+
+		v = (v ^ mask) - mask;
+	}
+	return v;
+}
+
+/*
+ * buffer:pack(fmt, ...) appends the packed values
+ */
+static int
+buffer_pack(lua_State *T)
+{
+	struct lem_buffer *b = buffer_check(T, 1);
+	struct buffer_fmt f;
+	int arg = 2;
+
+	f.s = luaL_checkstring(T, 2);
+	f.little = 1;
+	buffer_checkfree(T, b);
+
+	while (*f.s != '\0') {
+		size_t size;
+		enum buffer_kind k = buffer_option(T, &f, &size);
+		char *p;
+
+		if (k == KNOP)
+			continue;
+		if (k != KPADDING)
+			arg++;
+
+		switch (k) {
+		case KINT:
+		case KUINT: {
+				lua_Integer v = luaL_checkinteger(T, arg);
+
+				if (size < 8) {
+					lua_Integer lim = (lua_Integer)1 << (8*size - 1);
+
+					if (k == KINT)
+						luaL_argcheck(T, -lim <= v && v < lim,
+								arg, "integer overflow");
+					else
+						luaL_argcheck(T, (uint64_t)v < 2*(uint64_t)lim,
+								arg, "unsigned overflow");
+				}
+				p = buffer_grow(T, b, size);
+				buffer_putint(p, (uint64_t)v, size, f.little);
+			}
+			break;
+		case KFLOAT:
+		case KDOUBLE:
+		case KNUMBER: {
+				lua_Number n = luaL_checknumber(T, arg);
+				union { float f; double d; lua_Number n; uint64_t u; char c[8]; } u;
+				uint64_t v = 0;
+
+				if (k == KFLOAT) {
+					uint32_t w;
+					float x = (float)n;
+
+					memcpy(&w, &x, 4);
+					v = w;
+				} else if (k == KDOUBLE) {
+					u.d = (double)n;
+					memcpy(&v, &u, 8);
+				} else {
+					u.n = n;
+					memcpy(&v, &u, sizeof(lua_Number));
+				}
+				p = buffer_grow(T, b, size);
+				buffer_putint(p, v, size, f.little);
+			}
+			break;
+		case KSTRING:
+		case KZSTR:
+		case KCHAR: {
+				size_t len;
+				const char *str = luaL_checklstring(T, arg, &len);
+
+				if (k == KSTRING) {
+					luaL_argcheck(T, size >= 8 ||
+							len < ((size_t)1 << (8*size)), arg,
+							"string length does not fit in given size");
+					p = buffer_grow(T, b, size + len);
+					buffer_putint(p, len, size, f.little);
+					memcpy(p + size, str, len);
+					b->len += size;
+					size = len;
+				} else if (k == KZSTR) {
+					luaL_argcheck(T, strlen(str) == len, arg,
+							"string contains zeros");
+					p = buffer_grow(T, b, len + 1);
+					memcpy(p, str, len + 1);
+					size = len + 1;
+				} else {
+					luaL_argcheck(T, len <= size, arg,
+							"string longer than given size");
+					p = buffer_grow(T, b, size);
+					memcpy(p, str, len);
+					memset(p + len, 0, size - len);
+				}
+			}
+			break;
+		case KPADDING:
+			p = buffer_grow(T, b, 1);
+			*p = '\0';
+			break;
+		case KNOP:
+			break;
+		}
+		b->len += size;
+	}
+
+	lua_settop(T, 1);
+	return 1;
+}
+
+/*
+ * buffer:unpack(fmt [, pos]) like string.unpack(), but without
+ * pos the values are read at the cursor, which is advanced
+ */
+static int
+buffer_unpack(lua_State *T)
+{
+	struct lem_buffer *b = buffer_check(T, 1);
+	struct buffer_fmt f;
+	const char *data = lem_buffer_data(b);
+	int cursor = lua_isnoneornil(T, 3);
+	size_t pos;
+	int n = 0;
+
+	f.s = luaL_checkstring(T, 2);
+	f.little = 1;
+	if (cursor)
+		pos = b->pos;
+	else {
+		pos = buffer_posrelat(luaL_checkinteger(T, 3), b->len);
+		luaL_argcheck(T, pos >= 1 && pos - 1 <= b->len, 3,
+				"initial position out of string");
+		pos--;
+	}
+
+	while (*f.s != '\0') {
+		size_t size;
+		enum buffer_kind k = buffer_option(T, &f, &size);
+
+		if (k == KNOP)
+			continue;
+		if (size > b->len - pos)
+			return luaL_argerror(T, 2, "data string too short");
+
+		luaL_checkstack(T, 2, "too many results");
+		switch (k) {
+		case KINT:
+		case KUINT:
+			lua_pushinteger(T, (lua_Integer)buffer_getint(data + pos,
+						size, f.little, k == KINT));
+			n++;
+			break;
+		case KFLOAT: {
+				uint32_t w = (uint32_t)buffer_getint(data + pos, 4, f.little, 0);
+				float x;
+
+				memcpy(&x, &w, 4);
+				lua_pushnumber(T, (lua_Number)x);
+				n++;
+			}
+			break;
+		case KDOUBLE:
+		case KNUMBER: {
+				uint64_t v = buffer_getint(data + pos, size, f.little, 0);
+
+				if (k == KDOUBLE) {
+					double d;
+
+					memcpy(&d, &v, 8);
+					lua_pushnumber(T, (lua_Number)d);
+				} else {
+					lua_Number x;
+
+					memcpy(&x, &v, sizeof(lua_Number));
+					lua_pushnumber(T, x);
+				}
+				n++;
+			}
+			break;
+		case KSTRING: {
+				uint64_t len = buffer_getint(data + pos, size, f.little, 0);
+
+				if (len > b->len - pos - size)
+					return luaL_argerror(T, 2, "data string too short");
+				lua_pushlstring(T, data + pos + size, (size_t)len);
+				size += (size_t)len;
+				n++;
+			}
+			break;
+		case KZSTR: {
+				const char *z = memchr(data + pos, '\0', b->len - pos);
+
+				if (z == NULL)
+					return luaL_argerror(T, 2, "unfinished string for format 'z'");
+				size = z - (data + pos) + 1;
+				lua_pushlstring(T, data + pos, size - 1);
+				n++;
+			}
+			break;
+		case KCHAR:
+			lua_pushlstring(T, data + pos, size);
+			n++;
+			break;
+		case KPADDING:
+		case KNOP:
+			break;
+		}
+		pos += size;
+	}
+
+	if (cursor)
+		b->pos = pos;
+	lua_pushinteger(T, (lua_Integer)pos + 1);
+	return n + 1;
+}
+
+int
+luaopen_lem_buffer_core(lua_State *L)
+{
+	/* create module table */
+	lua_newtable(L);
+
+	/* create Buffer metatable */
+	luaL_newmetatable(L, LEM_BUFFER_MT);
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	/* mt.__gc = <buffer_gc> */
+	lua_pushcfunction(L, buffer_gc);
+	lua_setfield(L, -2, "__gc");
+	/* mt.__len = <buffer_len> */
+	lua_pushcfunction(L, buffer_len);
+	lua_setfield(L, -2, "__len");
+	/* mt.__tostring = <buffer_tostring> */
+	lua_pushcfunction(L, buffer_tostring);
+	lua_setfield(L, -2, "__tostring");
+	/* mt.tostring = <buffer_tostring> */
+	lua_pushcfunction(L, buffer_tostring);
+	lua_setfield(L, -2, "tostring");
+	/* mt.sub = <buffer_sub> */
+	lua_pushcfunction(L, buffer_sub);
+	lua_setfield(L, -2, "sub");
+	/* mt.byte = <buffer_byte> */
+	lua_pushcfunction(L, buffer_byte);
+	lua_setfield(L, -2, "byte");
+	/* mt.find = <buffer_find> */
+	lua_pushcfunction(L, buffer_find);
+	lua_setfield(L, -2, "find");
+	/* mt.append = <buffer_append> */
+	lua_pushcfunction(L, buffer_append);
+	lua_setfield(L, -2, "append");
+	/* mt.setlen = <buffer_setlen> */
+	lua_pushcfunction(L, buffer_setlen);
+	lua_setfield(L, -2, "setlen");
+	/* mt.reserve = <buffer_reserve> */
+	lua_pushcfunction(L, buffer_reserve);
+	lua_setfield(L, -2, "reserve");
+	/* mt.clear = <buffer_clear> */
+	lua_pushcfunction(L, buffer_clear);
+	lua_setfield(L, -2, "clear");
+	/* mt.pos = <buffer_pos> */
+	lua_pushcfunction(L, buffer_pos);
+	lua_setfield(L, -2, "pos");
+	/* mt.remaining = <buffer_remaining> */
+	lua_pushcfunction(L, buffer_remaining);
+	lua_setfield(L, -2, "remaining");
+	/* mt.pack = <buffer_pack> */
+	lua_pushcfunction(L, buffer_pack);
+	lua_setfield(L, -2, "pack");
+	/* mt.unpack = <buffer_unpack> */
+	lua_pushcfunction(L, buffer_unpack);
+	lua_setfield(L, -2, "unpack");
+	/* insert table */
+	lua_setfield(L, -2, "Buffer");
+
+	/* insert new function */
+	lua_pushcfunction(L, buffer_new);
+	lua_setfield(L, -2, "new");
+
+	return 1;
+}
@@ -18,6 +18,13 @@
 
 local http    = require 'lem.http.core'
 local parsers = require 'lem.parsers'
+local io      = require 'lem.io'
+
+local compatshim = require 'lem.compatshim'
+local table_unpack = compatshim.table_unpack
+
+local getmetatable = getmetatable
+local select = select
 
 parsers.lookup['HTTPRequest'] = http.HTTPRequest
 http.HTTPRequest = nil
@@ -107,6 +114,42 @@ function header_list_mt:toString()
 	return concat(rope)
 end
 
+-- write io.rope() objects with a single writev() on lem streams,
+-- other connections, like ssl wrapped ones, get them as strings
+do
+	local Stream, Rope = io.Stream, io.Rope
+
+	function http.write(conn, ...)
+		if getmetatable(conn) == Stream then
+			return conn:write(...)
+		end
+
+		local n = select('#', ...)
+		local args = {...}
+		for i = 1, n do
+			if getmetatable(args[i]) == Rope then
+				args[i] = args[i]:tostring()
+			end
+		end
+		return conn:write(table_unpack(args, 1, n))
+	end
+end
+
+-- add the headers and the empty line ending them to an io.rope()
+function header_list_mt:appendTo(rope)
+	local v
+
+	for i = 1, #self do
+		v = self[i]
+		if v[2] then
+			rope:add(v[1], ': ', v[2], '\r\n')
+		end
+	end
+	rope:add('\r\n')
+
+	return rope
+end
+
 function new_header_list(t)
 	return setmetatable(t, header_list_mt)
 end
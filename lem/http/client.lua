@@ -24,6 +24,9 @@ local format = string.format
 local io    = require 'lem.io'
 local http  = require 'lem.http'
 
+local newrope = io.rope
+local write = http.write
+
 local M = {}
 
 local Response = {}
@@ -98,9 +101,6 @@ function M.new()
 	}, Client)
 end
 
-local req_method = "%s %s HTTP/1.1\r\n"
-local req_method_and_host = "%s %s HTTP/1.1\r\nHost: %s\r\n"
-
 local function close(self)
 	local c = self.conn
 	if c then
@@ -167,22 +167,14 @@ function Client:request(request)
 
 	local host_is_set = header_list:value('host')
 
-	local rope = {}
-	local rope_c = 1
+	local req = newrope()
 
-	if host_is_set then
-		rope[rope_c] = req_method:format(method, path)
-	else
-		rope[rope_c] = req_method_and_host:format(method, path, domain_and_port)
+	req:add(method, ' ', path, ' HTTP/1.1\r\n')
+	if not host_is_set then
+		req:add('Host: ', domain_and_port, '\r\n')
 	end
-
-	rope_c = rope_c + 1
-	rope[rope_c] = header_list:toString()
-
-	rope_c = rope_c + 1
-	rope[rope_c] = payload
-
-	local req = concat(rope)
+	header_list:appendTo(req)
+	req:add(payload)
 
 	local res
 	local ok
@@ -197,7 +189,7 @@ function Client:request(request)
 		-- 2nd request in case connection is keepalive,
 		-- and we didn't timeout..
 
-		ok, err = c:write(req)
+		ok, err = write(c, req)
 		if not ok then return fail(self, err) end
 
 		res, err = c:read('HTTPResponse')
@@ -284,7 +276,7 @@ function Client:request(request)
 	end
 	if not c then return fail(self, err) end
 
-	ok, err = c:write(req)
+	ok, err = write(c, req)
 	if not ok then return fail(self, err) end
 
 	res, err = c:read('HTTPResponse')
@@ -19,6 +19,9 @@
 #include <lem-parsers.h>
 #include <ctype.h>
 
+/* the input buffer grows up to this size to fit long headers */
+#define HTTP_HEADER_MAX (64*1024)
+
 static int
 _lem_urldecode(const char *src, size_t len, char *out) {
 	size_t i;
@@ -396,7 +399,10 @@ parse_http_process(lua_State *T, struct lem_inputbuf *b)
 		}
 	}
 
-	if (unlikely(w == LEM_INPUTBUF_SIZE - 1)) {
+	if (unlikely(w == b->size - 1) &&
+			(b->size >= HTTP_HEADER_MAX ||
+			 lem_inputbuf_resize(b, 2*b->size > HTTP_HEADER_MAX ?
+				 HTTP_HEADER_MAX : 2*b->size))) {
 		b->start = b->end = 0;
 		lua_settop(T, 0);
 		lua_pushnil(T);
@@ -153,23 +153,36 @@ Response.__index = Response
 M.Response = Response
 
 do
-	local next = next
+	local next, type = next, type
 
+	-- appends the headers to an io.rope and returns it, or,
+	-- given a table, to the end of it and returns the last index
 	function Response:appendheader(rope)
 		local headers = self.headers
-		local i = #rope
 		local k = nil
-		k = next(headers, k)
-		while k do
 
+		if type(rope) == 'table' then
+			local i = #rope
+			k = next(headers, k)
+			while k do
+				i = i + 1
+				rope[i] = k .. ': ' .. headers[k] .. '\r\n'
+
+				k = next(headers, k)
+			end
 			i = i + 1
-			rope[i] = k .. ': ' .. headers[k] .. '\r\n'
+			rope[i] = '\r\n'
+			return i
+		end
+
+		k = next(headers, k)
+		while k do
+			rope:add(k, ': ', headers[k], '\r\n')
 
 			k = next(headers, k)
 		end
-		i = i + 1
-		rope[i] = '\r\n'
-		return i
+		rope:add('\r\n')
+		return rope
 	end
 end
 
@@ -21,13 +21,14 @@ local setmetatable = setmetatable
 local tonumber = tonumber
 local pairs = pairs
 local type = type
-local concat = table.concat
 
 local io       = require 'lem.io'
 local http     = require 'lem.http'
 local response = require 'lem.http.response'
 local utils = require 'lem.utils'
 local response_status_string = response.status_string
+local newrope = io.rope
+local write = http.write
 
 local utc_date
 do
@@ -164,25 +165,22 @@ local function handleHTTP(self, client)
 		end
 
 
-		local rope = {
-			'HTTP/' .. version .. ' ' .. response_status_string[res.status] .. '\r\n'
-		}
+		-- status line, headers and body are collected in a rope
+		-- and go out in a single gathered write
+		local rope = newrope()
+		rope:add('HTTP/', version, ' ', response_status_string[res.status], '\r\n')
 
-		local rope_idx = 2
 		if headers['Date'] == nil then
-			rope[rope_idx] = 'Date: ' .. utc_date() .. '\r\n'
-			rope_idx = rope_idx + 1
+			rope:add('Date: ', utc_date(), '\r\n')
 		end
 
 		if headers['Server'] == nil then
-			rope[rope_idx] = 'Server: Hathaway/0.1 LEM/0.3\r\n'
-			rope_idx = rope_idx + 1
+			rope:add('Server: Hathaway/0.1 LEM/0.3\r\n')
 		end
 
 		if req.headers['connection'] == 'close' and
 			headers['Connection'] == nil then
-			rope[rope_idx] = 'Connection: close\r\n'
-			rope_idx = rope_idx + 1
+			rope:add('Connection: close\r\n')
 			keep_serving = false
 		end
 
@@ -192,29 +190,31 @@ local function handleHTTP(self, client)
 			if file then
 				body_len = file:size()
 			else
-				body = concat(res)
+				body = newrope()
+				for i = 1, #res do
+					body:add(res[i])
+				end
 				body_len = #body
 			end
 
-			rope[#rope+1] = 'Content-Length: '.. body_len .. '\r\n'
+			rope:add('Content-Length: ', body_len, '\r\n')
 		end
 
 		res:appendheader(rope)
 
 		client:cork()
 
-		local ok, err = client:write(concat(rope))
+		local ok, err
+		if method ~= 'HEAD' and not file and body_len > 0 then
+			ok, err = write(client, rope, body)
+		else
+			ok, err = write(client, rope)
+		end
 		if not ok then self.debug('write', err) break end
 
-		if method ~= 'HEAD' then
-			if file then
-				ok, err = client:sendfile(file, body_len)
-				if close_file then file:close() end
-			else
-				if body_len > 0 then
-					ok, err = client:write(body)
-				end
-			end
+		if method ~= 'HEAD' and file then
+			ok, err = client:sendfile(file, body_len)
+			if close_file then file:close() end
 			if not ok then self.debug('write', err) break end
 		end
 
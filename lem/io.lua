@@ -50,16 +50,36 @@ do
 		return stdin:read(...)
 	end
 
+	-- without a format lines are read in batches, so all
+	-- complete lines already buffered cost a single resume.
+	-- only done here, where nobody else reads from the file
+	-- if the loop is left early
 	local streamfile, error = io.streamfile, error
+	local batch = 256
 	function io.lines(filename, fmt)
 		if not filename then return stdin:lines(fmt) end
-		if not fmt then fmt = '*l' end
 		local file, err = streamfile(filename)
 		if not file then error(err, 2) end
+		if fmt then
+			return function(s)
+				local line = s:read(fmt)
+				if not line then s:close() end
+				return line
+			end, file
+		end
+
+		local lines, i, n = nil, 0, 0
 		return function(s)
-			local line = s:read(fmt)
-			if not line then s:close() end
-			return line
+			if i == n then
+				lines = s:read('*L', batch)
+				if not lines then
+					s:close()
+					return nil
+				end
+				i, n = 0, #lines
+			end
+			i = i + 1
+			return lines[i]
 		end, file
 	end
 end
@@ -21,6 +21,7 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
 #include <assert.h>
 #include <termios.h>
 
@@ -28,6 +29,7 @@
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netinet/tcp.h>
@@ -95,7 +97,15 @@ ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
 #define UNIX_PATH_MAX  (sizeof ((struct sockaddr_un *)0)->sun_path)
 #endif
 
+/* max. iovecs submitted with a single writev() */
+#if defined(IOV_MAX) && IOV_MAX < 128
+#define IO_IOVMAX IOV_MAX
+#else
+#define IO_IOVMAX 128
+#endif
+
 #include <lem-parsers.h>
+#include <lem-buffer.h>
 
 static int
 io_closed(lua_State *T)
@@ -154,6 +164,198 @@ error:
 }
 
 
+#define IO_BUFSIZE_MIN 64
+#define IO_BUFSIZE_MAX (1 << 30)
+
+/* size of input buffers in new files and streams */
+static unsigned int io_bufsize = LEM_INPUTBUF_SIZE;
+
+static unsigned int
+io_checkbufsize(lua_State *T, int idx)
+{
+	lua_Integer size = luaL_checkinteger(T, idx);
+
+	luaL_argcheck(T, size >= IO_BUFSIZE_MIN && size <= IO_BUFSIZE_MAX,
+			idx, "buffer size out of range");
+	return (unsigned int)size;
+}
+
+/* set the default size and resize the attached buffer too,
+ * buffered data is moved to the front and never dropped */
+static int
+io_resizebuf(lua_State *T, struct lem_inputbuf *b, unsigned int size)
+{
+	unsigned int len = b->end - b->start;
+
+	b->defsize = size;
+
+	if (b->start > 0) {
+		memmove(b->buf, b->buf + b->start, len);
+		b->start = 0;
+		b->end = len;
+	}
+	lem_inputbuf_put(b);
+	if (size < len)
+		size = len;
+
+	if (lem_inputbuf_resize(b, size))
+		return io_strerror(T, ENOMEM);
+	return 0;
+}
+
+#include "rope.c"
+
+/*
+ * writes take strings, lem.buffer objects and ropes
+ */
+enum io_data {
+	IO_DSTRING,
+	IO_DBUFFER,
+	IO_DROPE,
+};
+
+static enum io_data
+io_datakind(lua_State *T, int idx, void **ud)
+{
+	if (lua_type(T, idx) != LUA_TUSERDATA)
+		return IO_DSTRING;
+	if ((*ud = lem_buffer_test(T, idx)) != NULL)
+		return IO_DBUFFER;
+	if ((*ud = rope_test(T, idx)) != NULL)
+		return IO_DROPE;
+	return IO_DSTRING;
+}
+
+static size_t
+io_datalen(lua_State *T, int idx)
+{
+	void *ud;
+	size_t len;
+
+	switch (io_datakind(T, idx, &ud)) {
+	case IO_DBUFFER:
+		return ((struct lem_buffer *)ud)->len;
+	case IO_DROPE:
+		return ((struct rope *)ud)->total;
+	default:
+		(void)lua_tolstring(T, idx, &len);
+		return len;
+	}
+}
+
+static size_t
+io_checkdata(lua_State *T, int idx)
+{
+	void *ud;
+	size_t len;
+
+	if (io_datakind(T, idx, &ud) != IO_DSTRING)
+		return io_datalen(T, idx);
+
+	(void)luaL_checklstring(T, idx, &len);
+	return len;
+}
+
+/* fill at most max iovecs with the data from off on,
+ * returns the number of iovecs used */
+static int
+io_dataiov(lua_State *T, int idx, size_t off,
+		struct iovec *iov, int max, size_t *total)
+{
+	void *ud;
+	const char *str;
+	size_t len;
+	struct rope *r;
+	unsigned int i;
+	int n;
+
+	switch (io_datakind(T, idx, &ud)) {
+	case IO_DBUFFER:
+		str = lem_buffer_data(ud);
+		len = ((struct lem_buffer *)ud)->len;
+		break;
+	case IO_DROPE:
+		r = ud;
+		n = 0;
+		for (i = 0; i < r->n && n < max; i++) {
+			struct rope_part *p = &r->parts[i];
+
+			if (off >= p->len) {
+				off -= p->len;
+				continue;
+			}
+			iov[n].iov_base = (void *)(rope_partdata(r, p) + off);
+			iov[n].iov_len = p->len - off;
+			*total += p->len - off;
+			off = 0;
+			n++;
+		}
+		return n;
+	default:
+		str = lua_tolstring(T, idx, &len);
+		break;
+	}
+
+	if (len <= off)
+		return 0;
+	iov->iov_base = (void *)(str + off);
+	iov->iov_len = len - off;
+	*total += len - off;
+	return 1;
+}
+
+/* copy all of the data to dst */
+static void
+io_datacopy(lua_State *T, int idx, char *dst)
+{
+	void *ud;
+	struct rope *r;
+	size_t len;
+	unsigned int i;
+
+	switch (io_datakind(T, idx, &ud)) {
+	case IO_DBUFFER:
+		memcpy(dst, lem_buffer_data(ud), ((struct lem_buffer *)ud)->len);
+		break;
+	case IO_DROPE:
+		r = ud;
+		for (i = 0; i < r->n; i++) {
+			memcpy(dst, rope_partdata(r, &r->parts[i]),
+					r->parts[i].len);
+			dst += r->parts[i].len;
+		}
+		break;
+	default:
+		memcpy(dst, lua_tolstring(T, idx, &len), len);
+	}
+}
+
+/* buffers and ropes must not change while a write is pending on them */
+static void
+io_pindata(lua_State *T, int idx, int top, int pin)
+{
+	for (; idx <= top; idx++) {
+		void *ud;
+
+		switch (io_datakind(T, idx, &ud)) {
+		case IO_DBUFFER:
+			if (pin)
+				((struct lem_buffer *)ud)->busy++;
+			else
+				((struct lem_buffer *)ud)->busy--;
+			break;
+		case IO_DROPE:
+			if (pin)
+				((struct rope *)ud)->busy++;
+			else
+				((struct rope *)ud)->busy--;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
 static const int ip_famnumber[] = { AF_UNSPEC, AF_INET, AF_INET6 };
 static const char *const ip_famnames[] = { "any", "ipv4", "ipv6", NULL };
 
@@ -401,6 +603,21 @@ io_fromfd_reap(struct lem_async *a)
 
 }
 
+/*
+ * io.setbufsize() sets the default input buffer size
+ * and returns the old one
+ */
+static int
+io_setbufsize(lua_State *T)
+{
+	unsigned int size = io_checkbufsize(T, 1);
+
+	lua_pushinteger(T, io_bufsize);
+	io_bufsize = size;
+	lem_inputbuf_config(size);
+	return 1;
+}
+
 static int
 io_fromfd(lua_State *T)
 {
@@ -744,7 +961,8 @@ io_streamfile_reap(struct lem_async *a)
 	lem_debug("s->file = %d, s->pipe[0] = %d, s->pipe[1] = %d",
 			ret, s->pipe[0], s->pipe[1]);
 
-	lem_async_do(&s->a, io_streamfile_worker, NULL);
+	lem_async_do_lane(&s->a, LEM_LANE_BLOCKING,
+			io_streamfile_worker, NULL);
 
 	stream_new(T, s->pipe[0], 2);
 	lem_queue(T, 1);
@@ -931,6 +1149,15 @@ luaopen_lem_io_core(lua_State *L)
 	/* mt.readp = <file_readp> */
 	lua_pushcfunction(L, file_readp);
 	lua_setfield(L, -2, "readp");
+	/* mt.readinto = <file_readinto> */
+	lua_pushcfunction(L, file_readinto);
+	lua_setfield(L, -2, "readinto");
+	/* mt.settimeout = <file_settimeout> */
+	lua_pushcfunction(L, file_settimeout);
+	lua_setfield(L, -2, "settimeout");
+	/* mt.setbufsize = <file_setbufsize> */
+	lua_pushcfunction(L, file_setbufsize);
+	lua_setfield(L, -2, "setbufsize");
 	/* mt.write = <file_write> */
 	lua_pushcfunction(L, file_write);
 	lua_setfield(L, -2, "write");
@@ -966,9 +1193,21 @@ luaopen_lem_io_core(lua_State *L)
 	/* mt.readp = <stream_readp> */
 	lua_pushcfunction(L, stream_readp);
 	lua_setfield(L, -2, "readp");
+	/* mt.readinto = <stream_readinto> */
+	lua_pushcfunction(L, stream_readinto);
+	lua_setfield(L, -2, "readinto");
+	/* mt.settimeout = <stream_settimeout> */
+	lua_pushcfunction(L, stream_settimeout);
+	lua_setfield(L, -2, "settimeout");
+	/* mt.setbufsize = <stream_setbufsize> */
+	lua_pushcfunction(L, stream_setbufsize);
+	lua_setfield(L, -2, "setbufsize");
 	/* mt.write = <stream_write> */
 	lua_pushcfunction(L, stream_write);
 	lua_setfield(L, -2, "write");
+	/* mt.setbuffered = <stream_setbuffered> */
+	lua_pushcfunction(L, stream_setbuffered);
+	lua_setfield(L, -2, "setbuffered");
 #ifdef TCP_CORK
 	/* mt.cork = <stream_cork> */
 	lua_pushcfunction(L, stream_cork);
@@ -991,6 +1230,9 @@ luaopen_lem_io_core(lua_State *L)
 	/* mt.getpeer = <stream_getpeer> */
 	lua_pushcfunction(L, stream_getpeer);
 	lua_setfield(L, -2, "getpeer");
+	/* mt.splice = <stream_splice> */
+	lua_pushcfunction(L, stream_splice);
+	lua_setfield(L, -2, "splice");
 	/* mt.sendfile = <stream_sendfile> */
 	lua_pushcfunction(L, stream_sendfile);
 	lua_setfield(L, -2, "sendfile");
@@ -1039,6 +1281,9 @@ luaopen_lem_io_core(lua_State *L)
 	lua_getfield(L, -2, "Stream"); /* upvalue 1 = Stream */
 	lua_pushcclosure(L, server_accept, 1);
 	lua_setfield(L, -2, "accept");
+	/* mt.settimeout = <server_settimeout> */
+	lua_pushcfunction(L, server_settimeout);
+	lua_setfield(L, -2, "settimeout");
 	/* mt.autospawn = <server_autospawn> */
 	lua_getfield(L, -2, "Stream"); /* upvalue 1 = Stream */
 	lua_pushcclosure(L, server_autospawn, 1);
@@ -1046,6 +1291,42 @@ luaopen_lem_io_core(lua_State *L)
 	/* insert table */
 	lua_setfield(L, -2, "Server");
 
+	/* create Rope metatable */
+	luaL_newmetatable(L, ROPE_MT);
+	/* mt.__index = mt */
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	/* mt.__gc = <rope_gc> */
+	lua_pushcfunction(L, rope_gc);
+	lua_setfield(L, -2, "__gc");
+	/* mt.__len = <rope_len> */
+	lua_pushcfunction(L, rope_len);
+	lua_setfield(L, -2, "__len");
+	/* mt.__tostring = <rope_tostring> */
+	lua_pushcfunction(L, rope_tostring);
+	lua_setfield(L, -2, "__tostring");
+	/* mt.kind = <rope> */
+	lua_pushstring(L, "rope");
+	lua_setfield(L, -2, "kind");
+	/* mt.add = <rope_add> */
+	lua_pushcfunction(L, rope_add);
+	lua_setfield(L, -2, "add");
+	/* mt.clear = <rope_clear> */
+	lua_pushcfunction(L, rope_clear);
+	lua_setfield(L, -2, "clear");
+	/* mt.parts = <rope_parts> */
+	lua_pushcfunction(L, rope_parts);
+	lua_setfield(L, -2, "parts");
+	/* mt.tostring = <rope_tostring> */
+	lua_pushcfunction(L, rope_tostring);
+	lua_setfield(L, -2, "tostring");
+	/* insert table */
+	lua_setfield(L, -2, "Rope");
+
+	/* insert rope function */
+	lua_pushcfunction(L, rope_new);
+	lua_setfield(L, -2, "rope");
+
 	/* insert open function */
 	lua_getfield(L, -1, "File");   /* upvalue 1 = File   */
 	lua_getfield(L, -2, "Stream"); /* upvalue 2 = Stream */
@@ -1061,6 +1342,10 @@ luaopen_lem_io_core(lua_State *L)
 	lua_getfield(L, -1, "Stream"); /* upvalue 1 = Stream */
 	lua_pushcclosure(L, io_spawnp, 1);
 	lua_setfield(L, -2, "spawnp");
+	/* insert proxy function */
+	lua_getfield(L, -1, "Stream"); /* upvalue 1 = Stream */
+	lua_pushcclosure(L, io_proxy, 1);
+	lua_setfield(L, -2, "proxy");
 	/* insert streamfile function */
 	lua_getfield(L, -1, "Stream"); /* upvalue 1 = Stream */
 	lua_pushcclosure(L, io_streamfile, 1);
@@ -1142,6 +1427,10 @@ luaopen_lem_io_core(lua_State *L)
 
 	lua_setfield(L, -2, "tty");
 
+	/* set setbufsize function */
+	lua_pushcfunction(L, io_setbufsize);
+	lua_setfield(L, -2, "setbufsize");
+
 	/* set set_collect_interval function */
 	lua_pushcfunction(L, io_set_collect_interval);
 	lua_setfield(L, -2, "set_collect_interval");
@@ -1155,6 +1444,29 @@ luaopen_lem_io_core(lua_State *L)
 	lua_pushcfunction(L, io_fdpoll);
 	lua_setfield(L, -2, "fdpoll");
 
+	/* name pool jobs for utils.poolstats() */
+	lem_async_name(io_open_work, "io.open");
+	lem_async_name(io_fromfd_work, "io.fromfd");
+	lem_async_name(io_streamfile_open, "io.streamfile");
+	lem_async_name(io_streamfile_worker, "io.streamfile.pump");
+	lem_async_name(file_close_work, "io.File.close");
+	lem_async_name(file_gc_work, "io.File.__gc");
+	lem_async_name(file_readp_work, "io.File.readp");
+	lem_async_name(file_readinto_work, "io.File.readinto");
+	lem_async_name(file_write_work, "io.File.write");
+	lem_async_name(file_size_work, "io.File.size");
+	lem_async_name(file_seek_work, "io.File.seek");
+	lem_async_name(file_lock_work, "io.File.lock");
+	lem_async_name(tcp_connect_work, "io.tcp.connect");
+	lem_async_name(tcp_listen_work, "io.tcp.listen");
+	lem_async_name(udp_connect_work, "io.udp.connect");
+	lem_async_name(udp_listen_work, "io.udp.listen");
+	lem_async_name(unix_connect_work, "io.unix.connect");
+	lem_async_name(unix_listen_work, "io.unix.listen");
+	lem_async_name(unix_socketpair_work, "io.unix.socketpair");
+	lem_async_name(unix_passfd_send_work, "io.unix.passfd_send");
+	lem_async_name(unix_passfd_recv_work, "io.unix.passfd_recv");
+	lem_async_name(pty_openpair_work, "io.tty.pty_openpair");
 
 	on_lem_process_exit(remake_std_stream_blocking);
 
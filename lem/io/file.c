@@ -16,6 +16,8 @@
  * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define FILE_IOVSMALL 8
+
 struct file {
 	struct lem_async a;
 	lua_State *T;
@@ -26,9 +28,15 @@ struct file {
 			struct lem_parser *p;
 		} readp;
 		struct {
-			const char *str;
-			size_t len;
-			int idx;
+			struct lem_buffer *b;
+			char *p;
+			size_t n;
+			ssize_t bytes;
+		} readinto;
+		struct {
+			struct iovec *iov;
+			int iovcnt;
+			struct iovec small[FILE_IOVSMALL];
 		} write;
 		struct {
 			off_t val;
@@ -43,6 +51,9 @@ struct file {
 			short type;
 		} lock;
 	};
+	ev_tstamp timeout;
+	struct lem_timer t;
+	int ref;
 	struct lem_inputbuf buf;
 };
 
@@ -51,6 +62,24 @@ struct file_gc {
 	int fd;
 };
 
+/*
+ * a read on the thread pool can't be cancelled, so on timeout
+ * the coroutine is resumed right away and the file is anchored
+ * in the registry until the pending read is reaped
+ */
+static void
+file_readp_timeout(struct lem_timer *t)
+{
+	struct file *f = (struct file *)(((char *)t) - offsetof(struct file, t));
+	lua_State *T = f->T;
+
+	lua_pushvalue(T, 1);
+	f->ref = luaL_ref(T, LUA_REGISTRYINDEX);
+	lua_pushnil(T);
+	lua_pushliteral(T, "timeout");
+	lem_queue(T, 2);
+}
+
 static struct file *
 file_new(lua_State *T, int fd, int mt)
 {
@@ -64,7 +93,10 @@ file_new(lua_State *T, int fd, int mt)
 	/* initialize userdata */
 	f->T = NULL;
 	f->fd = fd;
-	lem_inputbuf_init(&f->buf);
+	f->timeout = 0;
+	lem_timer_init(&f->t, file_readp_timeout);
+	f->ref = LUA_NOREF;
+	lem_inputbuf_setup(&f->buf, io_bufsize);
 
 	return f;
 }
@@ -93,6 +125,7 @@ file_gc(lua_State *T)
 		f->fd = -1;
 		lem_async_do(&gc->a, file_gc_work, NULL);
 	}
+	lem_inputbuf_free(&f->buf);
 
 	return 0;
 }
@@ -165,7 +198,7 @@ file_readp_work(struct lem_async *a)
 {
 	struct file *f = (struct file *)a;
 	ssize_t bytes = read(f->fd, f->buf.buf + f->buf.end,
-			LEM_INPUTBUF_SIZE - f->buf.end);
+			f->buf.size - f->buf.end);
 
 	lem_debug("read %ld bytes from %d", bytes, f->fd);
 	if (bytes > 0) {
@@ -187,13 +220,26 @@ file_readp_reap(struct lem_async *a)
 	lua_State *T = f->T;
 	int ret;
 
+	if (f->ref != LUA_NOREF) {
+		/* the caller has already given up */
+		f->T = NULL;
+		lem_inputbuf_put(&f->buf);
+		luaL_unref(lem_get_global_lua_state(), LUA_REGISTRYINDEX, f->ref);
+		f->ref = LUA_NOREF;
+		return;
+	}
+
 	if (f->ret) {
 		enum lem_preason res = f->ret < 0 ? LEM_PCLOSED : LEM_PERROR;
 
 		f->T = NULL;
+		lem_timer_stop(&f->t);
 
-		if (f->readp.p->destroy &&
-				(ret = f->readp.p->destroy(T, &f->buf, res)) > 0) {
+		ret = 0;
+		if (f->readp.p->destroy)
+			ret = f->readp.p->destroy(T, &f->buf, res);
+		lem_inputbuf_put(&f->buf);
+		if (ret > 0) {
 			lem_queue(T, ret);
 			return;
 		}
@@ -210,6 +256,8 @@ file_readp_reap(struct lem_async *a)
 	ret = f->readp.p->process(T, &f->buf);
 	if (ret > 0) {
 		f->T = NULL;
+		lem_timer_stop(&f->t);
+		lem_inputbuf_put(&f->buf);
 		lem_queue(T, ret);
 		return;
 	}
@@ -217,6 +265,23 @@ file_readp_reap(struct lem_async *a)
 	lem_async_run(&f->a);
 }
 
+/* bytes left until the end of a regular file, 0 if unknown */
+static size_t
+file__remaining(int fd)
+{
+	struct stat st;
+	off_t pos;
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode))
+		return 0;
+
+	pos = lseek(fd, 0, SEEK_CUR);
+	if (pos < 0 || pos >= st.st_size)
+		return 0;
+
+	return (size_t)(st.st_size - pos);
+}
+
 static int
 file_readp(lua_State *T)
 {
@@ -236,95 +301,285 @@ file_readp(lua_State *T)
 		return io_busy(T);
 
 	p = lua_touserdata(T, 2);
+	/* the buffer stays attached while the read is on the pool */
+	lem_inputbuf_get(&f->buf);
+	f->buf.hint = file__remaining(f->fd);
 	if (p->init)
 		p->init(T, &f->buf);
 
 	ret = p->process(T, &f->buf);
-	if (ret > 0)
+	if (ret > 0) {
+		lem_inputbuf_put(&f->buf);
 		return ret;
+	}
 
 	f->T = T;
 	f->readp.p = p;
 	lem_async_do(&f->a, file_readp_work, file_readp_reap);
+	if (f->timeout > 0)
+		lem_timer_start(&f->t, f->timeout);
 	return lua_yield(T, lua_gettop(T));
 }
 
 /*
- * file:write() method
+ * file:readinto() method
  */
 static void
-file_write_work(struct lem_async *a)
+file_readinto_work(struct lem_async *a)
 {
 	struct file *f = (struct file *)a;
-	ssize_t bytes = write(f->fd, f->write.str, f->write.len);
+	ssize_t bytes;
 
-	if (bytes < 0)
-		f->ret = errno;
-	else
-		f->ret = 0;
+	do {
+		bytes = read(f->fd, f->readinto.p, f->readinto.n);
+	} while (bytes < 0 && errno == EINTR);
+
+	lem_debug("read %ld bytes from %d", bytes, f->fd);
+	f->readinto.bytes = bytes;
+	f->ret = bytes < 0 ? errno : 0;
 }
 
 static void
-file_write_reap(struct lem_async *a)
+file_readinto_reap(struct lem_async *a)
 {
 	struct file *f = (struct file *)a;
 	lua_State *T = f->T;
-	int top;
+	struct lem_buffer *b = f->readinto.b;
+	ssize_t bytes = f->readinto.bytes;
 
-	if (f->ret) {
-		f->T = NULL;
+	f->T = NULL;
+	b->busy--;
+
+	if (bytes < 0) {
 		lem_queue(T, io_strerror(T, f->ret));
 		return;
 	}
+	if (bytes == 0) {
+		lua_pushnil(T);
+		lua_pushliteral(T, "eof");
+		lem_queue(T, 2);
+		return;
+	}
 
-	top = lua_gettop(T);
-	do {
-		if (f->write.idx == top) {
-			f->T = NULL;
-			lua_pushboolean(T, 1);
-			lem_queue(T, 1);
+	b->len += bytes;
+	lua_pushinteger(T, bytes);
+	lem_queue(T, 1);
+}
+
+static int
+file_readinto(lua_State *T)
+{
+	struct file *f;
+	struct lem_buffer *b;
+	lua_Integer n;
+	char *p;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	b = lem_buffer_test(T, 2);
+	if (b == NULL)
+		return luaL_argerror(T, 2, "expected buffer");
+
+	f = lua_touserdata(T, 1);
+	n = luaL_optinteger(T, 3, f->buf.defsize);
+	luaL_argcheck(T, n > 0, 3, "expected a positive number");
+
+	if (f->fd < 0)
+		return io_closed(T);
+	if (f->T != NULL)
+		return io_busy(T);
+
+	/* hand out what is already buffered first */
+	if (f->buf.end > f->buf.start) {
+		size_t len = f->buf.end - f->buf.start;
+
+		if ((size_t)n < len)
+			len = (size_t)n;
+		p = lem_buffer_reserve(b, len);
+		if (p == NULL)
+			return b->busy ? io_busy(T) : io_strerror(T, ENOMEM);
+		memcpy(p, f->buf.buf + f->buf.start, len);
+		b->len += len;
+		f->buf.start += len;
+		if (f->buf.start == f->buf.end) {
+			f->buf.start = f->buf.end = 0;
+			lem_inputbuf_put(&f->buf);
+		}
+		lua_pushinteger(T, (lua_Integer)len);
+		return 1;
+	}
+
+	p = lem_buffer_reserve(b, (size_t)n);
+	if (p == NULL)
+		return b->busy ? io_busy(T) : io_strerror(T, ENOMEM);
+
+	/* the buffer is filled on the pool, so pin it */
+	b->busy++;
+	f->T = T;
+	f->readinto.b = b;
+	f->readinto.p = p;
+	f->readinto.n = (size_t)n;
+	lem_async_do(&f->a, file_readinto_work, file_readinto_reap);
+	return lua_yield(T, lua_gettop(T));
+}
+
+/*
+ * file:settimeout() method
+ */
+static int
+file_settimeout(lua_State *T)
+{
+	struct file *f;
+	ev_tstamp timeout;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	timeout = (ev_tstamp)luaL_optnumber(T, 2, 0);
+	luaL_argcheck(T, timeout >= 0, 2, "expected a non-negative number");
+
+	f = lua_touserdata(T, 1);
+	lua_pushnumber(T, f->timeout);
+	f->timeout = timeout;
+	return 1;
+}
+
+/*
+ * file:setbufsize() method
+ */
+static int
+file_setbufsize(lua_State *T)
+{
+	struct file *f;
+	unsigned int size;
+	int ret;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	size = io_checkbufsize(T, 2);
+
+	f = lua_touserdata(T, 1);
+	if (f->T != NULL)
+		return io_busy(T);
+
+	lua_pushinteger(T, f->buf.defsize);
+	ret = io_resizebuf(T, &f->buf, size);
+	if (ret > 0)
+		return ret;
+	return 1;
+}
+
+/*
+ * file:write() method
+ */
+static void
+file_write_work(struct lem_async *a)
+{
+	struct file *f = (struct file *)a;
+	struct iovec *iov = f->write.iov;
+	int cnt = f->write.iovcnt;
+
+	while (cnt > 0) {
+		struct iovec *start = iov;
+		ssize_t bytes = writev(f->fd, iov, cnt < IO_IOVMAX ? cnt : IO_IOVMAX);
+
+		if (bytes < 0) {
+			if (errno == EINTR)
+				continue;
+			f->ret = errno;
 			return;
 		}
 
-		f->write.str = lua_tolstring(T, ++f->write.idx, &f->write.len);
-	} while (f->write.len == 0);
+		/* skip past what was written */
+		while (cnt > 0 && (size_t)bytes >= iov->iov_len) {
+			bytes -= iov->iov_len;
+			iov++;
+			cnt--;
+		}
+		if (iov == start && bytes == 0) {
+			/* nothing written, don't spin on it */
+			f->ret = EIO;
+			return;
+		}
+		if (cnt > 0) {
+			iov->iov_base = (char *)iov->iov_base + bytes;
+			iov->iov_len -= bytes;
+		}
+	}
 
-	lem_async_run(&f->a);
+	f->ret = 0;
+}
+
+static void
+file_write_reap(struct lem_async *a)
+{
+	struct file *f = (struct file *)a;
+	lua_State *T = f->T;
+
+	f->T = NULL;
+	if (f->write.iov != f->write.small)
+		free(f->write.iov);
+	io_pindata(T, 2, lua_gettop(T), 0);
+
+	if (f->ret) {
+		lem_queue(T, io_strerror(T, f->ret));
+		return;
+	}
+
+	lua_pushboolean(T, 1);
+	lem_queue(T, 1);
 }
 
 static int
 file_write(lua_State *T)
 {
 	struct file *f;
-	const char *str;
-	size_t len;
-	int idx;
-	int i;
+	struct iovec *iov;
+	size_t total;
 	int top;
+	int max;
+	int cnt;
+	int i;
 
 	luaL_checktype(T, 1, LUA_TUSERDATA);
 	top = lua_gettop(T);
-	idx = 1;
-	do {
-		str = luaL_checklstring(T, ++idx, &len);
-	} while (len == 0 && idx < top);
-	for (i = idx+1; i <= top; i++)
-		(void)luaL_checkstring(T, i);
+	(void)io_checkdata(T, 2);
+	for (i = 3; i <= top; i++)
+		(void)io_checkdata(T, i);
 
 	f = lua_touserdata(T, 1);
 	if (f->fd < 0)
 		return io_closed(T);
 	if (f->T != NULL)
 		return io_busy(T);
-	if (len == 0) {
+
+	/* gather all the arguments into one writev() */
+	max = 0;
+	for (i = 2; i <= top; i++) {
+		void *ud;
+
+		if (io_datakind(T, i, &ud) == IO_DROPE)
+			max += ((struct rope *)ud)->n;
+		else
+			max++;
+	}
+	if (max <= FILE_IOVSMALL)
+		iov = f->write.small;
+	else
+		iov = lem_xmalloc(max * sizeof(struct iovec));
+
+	cnt = 0;
+	total = 0;
+	for (i = 2; i <= top; i++)
+		cnt += io_dataiov(T, i, 0, iov + cnt, max - cnt, &total);
+
+	if (cnt == 0) {
+		if (iov != f->write.small)
+			free(iov);
 		lua_pushboolean(T, 1);
 		return 1;
 	}
 
 	f->T = T;
-	f->write.str = str;
-	f->write.len = len;
-	f->write.idx = idx;
+	f->write.iov = iov;
+	f->write.iovcnt = cnt;
+	io_pindata(T, 2, top, 1);
 	lem_async_do(&f->a, file_write_work, file_write_reap);
 
 	return lua_yield(T, top);
@@ -440,6 +695,7 @@ file_seek(lua_State *T)
 
 	/* flush input buffer */
 	lem_inputbuf_init(&f->buf);
+	lem_inputbuf_put(&f->buf);
 
 	f->T = T;
 	f->seek.whence = mode[op];
@@ -61,8 +61,19 @@ function Stream:write(...)
 	return ok
 end
 
+-- streams queue concurrent writes themselves
+local Native = setmetatable({}, Stream)
+Native.__index = Native
+
+function Native:write(...)
+	return self.stream:write(...)
+end
+
 local function wrap(stream, ...)
 	if not stream then return stream, ... end
+	if stream.kind == 'stream' then
+		return setmetatable({ stream = stream }, Native)
+	end
 	return setmetatable({ stream = stream, next = 0 }, Stream)
 end
 
@@ -0,0 +1,273 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * io.rope() output builder
+ *
+ * a rope collects the pieces of a message, like the status
+ * line, headers and body of an HTTP response, so they can be
+ * sent with a single writev() instead of being concatenated.
+ * longer strings are referenced from the uservalue table,
+ * short ones and formatted numbers are copied into an inline
+ * area where consecutive fragments merge into one iovec.
+ */
+#define ROPE_MT "lem.io.Rope"
+#define ROPE_INLINE_MAX 64
+
+/* the table referencing strings, the environment before Lua 5.2 */
+#if LUA_VERSION_NUM >= 502
+#define rope_setrefs(T, idx) lua_setuservalue(T, idx)
+#define rope_getrefs(T, idx) lua_getuservalue(T, idx)
+#else
+#define rope_setrefs(T, idx) (void)lua_setfenv(T, idx)
+#define rope_getrefs(T, idx) lua_getfenv(T, idx)
+#endif
+
+struct rope_part {
+	const char *str; /* NULL for data in the inline area */
+	size_t off;
+	size_t len;
+};
+
+struct rope {
+	struct rope_part *parts;
+	unsigned int n;
+	unsigned int size;
+	unsigned int refs;
+	unsigned int busy;
+	char *ibuf;
+	size_t ilen;
+	size_t isize;
+	size_t total;
+};
+
+/* the rope at idx, or NULL */
+static struct rope *
+rope_test(lua_State *T, int idx)
+{
+	struct rope *r = lua_touserdata(T, idx);
+
+	if (r == NULL || !lua_getmetatable(T, idx))
+		return NULL;
+
+	luaL_getmetatable(T, ROPE_MT);
+	if (!lua_rawequal(T, -1, -2))
+		r = NULL;
+	lua_pop(T, 2);
+	return r;
+}
+
+static inline const char *
+rope_partdata(struct rope *r, struct rope_part *p)
+{
+	return p->str ? p->str : r->ibuf + p->off;
+}
+
+static int
+rope_new(lua_State *T)
+{
+	struct rope *r = lua_newuserdata(T, sizeof(struct rope));
+
+	r->parts = NULL;
+	r->n = r->size = 0;
+	r->refs = 0;
+	r->busy = 0;
+	r->ibuf = NULL;
+	r->ilen = r->isize = 0;
+	r->total = 0;
+
+	luaL_getmetatable(T, ROPE_MT);
+	lua_setmetatable(T, -2);
+	lua_newtable(T);
+	rope_setrefs(T, -2);
+	return 1;
+}
+
+static int
+rope_gc(lua_State *T)
+{
+	struct rope *r = lua_touserdata(T, 1);
+
+	free(r->parts);
+	free(r->ibuf);
+	r->parts = NULL;
+	r->ibuf = NULL;
+	return 0;
+}
+
+static int
+rope_len(lua_State *T)
+{
+	struct rope *r = luaL_checkudata(T, 1, ROPE_MT);
+
+	lua_pushinteger(T, (lua_Integer)r->total);
+	return 1;
+}
+
+static struct rope_part *
+rope__part(lua_State *T, struct rope *r)
+{
+	if (r->n == r->size) {
+		unsigned int size = r->size ? 2*r->size : 16;
+		struct rope_part *parts =
+			realloc(r->parts, size * sizeof(struct rope_part));
+
+		if (parts == NULL)
+			luaL_error(T, "out of memory");
+		r->parts = parts;
+		r->size = size;
+	}
+	return &r->parts[r->n++];
+}
+
+static void
+rope__inline(lua_State *T, struct rope *r, const char *str, size_t len)
+{
+	struct rope_part *p;
+
+	if (r->ilen + len > r->isize) {
+		size_t size = r->isize ? 2*r->isize : 256;
+		char *ibuf;
+
+		while (size < r->ilen + len)
+			size *= 2;
+		ibuf = realloc(r->ibuf, size);
+		if (ibuf == NULL)
+			luaL_error(T, "out of memory");
+		r->ibuf = ibuf;
+		r->isize = size;
+	}
+
+	/* extend the previous fragment if it ends right here */
+	p = r->n > 0 ? &r->parts[r->n - 1] : NULL;
+	if (p == NULL || p->str != NULL || p->off + p->len != r->ilen) {
+		p = rope__part(T, r);
+		p->str = NULL;
+		p->off = r->ilen;
+		p->len = 0;
+	}
+
+	memcpy(r->ibuf + r->ilen, str, len);
+	r->ilen += len;
+	p->len += len;
+	r->total += len;
+}
+
+/*
+ * rope:add(...) appends strings and numbers
+ */
+static int
+rope_add(lua_State *T)
+{
+	struct rope *r = luaL_checkudata(T, 1, ROPE_MT);
+	int top = lua_gettop(T);
+	int i;
+
+	if (r->busy)
+		return luaL_error(T, "rope busy");
+
+	rope_getrefs(T, 1);
+	for (i = 2; i <= top; i++) {
+		const char *str;
+		size_t len;
+
+#if LUA_VERSION_NUM >= 503
+		if (lua_type(T, i) == LUA_TNUMBER && lua_isinteger(T, i)) {
+			char num[32];
+
+			len = snprintf(num, sizeof(num), LUA_INTEGER_FMT,
+					(LUAI_UACINT)lua_tointeger(T, i));
+			rope__inline(T, r, num, len);
+			continue;
+		}
+#else
+		if (lua_type(T, i) == LUA_TNUMBER) {
+			char num[32];
+
+			len = snprintf(num, sizeof(num), LUA_NUMBER_FMT,
+					(LUAI_UACNUMBER)lua_tonumber(T, i));
+			rope__inline(T, r, num, len);
+			continue;
+		}
+#endif
+
+		str = luaL_checklstring(T, i, &len);
+		if (len == 0)
+			continue;
+		if (len <= ROPE_INLINE_MAX) {
+			rope__inline(T, r, str, len);
+		} else {
+			struct rope_part *p = rope__part(T, r);
+
+			/* keep the string alive while referenced */
+			lua_pushvalue(T, i);
+			lua_rawseti(T, top + 1, ++r->refs);
+			p->str = str;
+			p->off = 0;
+			p->len = len;
+			r->total += len;
+		}
+	}
+
+	lua_settop(T, 1);
+	return 1;
+}
+
+static int
+rope_clear(lua_State *T)
+{
+	struct rope *r = luaL_checkudata(T, 1, ROPE_MT);
+
+	if (r->busy)
+		return luaL_error(T, "rope busy");
+
+	r->n = 0;
+	r->refs = 0;
+	r->ilen = 0;
+	r->total = 0;
+	lua_newtable(T);
+	rope_setrefs(T, 1);
+	lua_settop(T, 1);
+	return 1;
+}
+
+static int
+rope_tostring(lua_State *T)
+{
+	struct rope *r = luaL_checkudata(T, 1, ROPE_MT);
+	luaL_Buffer B;
+	unsigned int i;
+
+	luaL_buffinit(T, &B);
+	for (i = 0; i < r->n; i++) {
+		struct rope_part *p = &r->parts[i];
+
+		luaL_addlstring(&B, rope_partdata(r, p), p->len);
+	}
+	luaL_pushresult(&B);
+	return 1;
+}
+
+/* number of iovecs a write of the rope needs */
+static int
+rope_parts(lua_State *T)
+{
+	struct rope *r = luaL_checkudata(T, 1, ROPE_MT);
+
+	lua_pushinteger(T, r->n);
+	return 1;
+}
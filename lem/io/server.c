@@ -19,8 +19,25 @@
 struct server_io {
 	ev_io w;
 	enum {STREAM, DATAGRAM} server_kind;
+	ev_tstamp timeout;
+	struct lem_timer t;
 };
 
+static void
+server_accept_timeout(struct lem_timer *t)
+{
+	struct server_io *io_server = (struct server_io *)
+		(((char *)t) - offsetof(struct server_io, t));
+	struct ev_io *w = &io_server->w;
+	lua_State *T = w->data;
+
+	ev_io_stop(LEM_ w);
+	w->data = NULL;
+	lua_pushnil(T);
+	lua_pushliteral(T, "timeout");
+	lem_queue(T, 2);
+}
+
 static struct server_io *
 server_new(lua_State *T, int fd, int mt, int kind)
 {
@@ -35,6 +52,8 @@ server_new(lua_State *T, int fd, int mt, int kind)
 #pragma GCC diagnostic pop
 	ret->w.data = NULL;
 	ret->server_kind = kind;
+	ret->timeout = 0;
+	lem_timer_init(&ret->t, server_accept_timeout);
 
 	return ret;
 }
@@ -86,6 +105,7 @@ server_close(lua_State *T)
 	if (w->data != NULL) {
 		lem_debug("interrupting listen");
 		ev_io_stop(LEM_ w);
+		lem_timer_stop(&((struct server_io *)w)->t);
 		lua_pushnil(w->data);
 		lua_pushliteral(w->data, "interrupted");
 		lem_queue(w->data, 2);
@@ -118,6 +138,7 @@ server_interrupt(lua_State *T)
 
 	lem_debug("interrupting listening");
 	ev_io_stop(LEM_ w);
+	lem_timer_stop(&((struct server_io *)w)->t);
 	lua_pushnil(w->data);
 	lua_pushliteral(w->data, "interrupted");
 	lem_queue(w->data, 2);
@@ -170,30 +191,34 @@ server__accept(lua_State *T, struct ev_io *w, int mt)
 static void
 server_accept_cb(EV_P_ struct ev_io *w, int revents)
 {
+	lua_State *T = w->data;
 	int ret;
 
 	(void)revents;
 
-	ret = server__accept(w->data, w, 2);
+	ret = server__accept(T, w, 2);
 	if (ret == 0)
 		return;
 
 	w->data = NULL;
 	ev_io_stop(EV_A_ w);
+	lem_timer_stop(&((struct server_io *)w)->t);
 	if (ret == 2) {
 		close(w->fd);
 		w->fd = -1;
 	}
-	lem_queue(w->data, ret);
+	lem_queue(T, ret);
 }
 
 static int
 server_accept(lua_State *T)
 {
+	struct server_io *io_server;
 	struct ev_io *w;
 
 	luaL_checktype(T, 1, LUA_TUSERDATA);
-	w = lua_touserdata(T, 1);
+	io_server = lua_touserdata(T, 1);
+	w = &io_server->w;
 	if (w->fd < 0)
 		return io_closed(T);
 	if (w->data != NULL)
@@ -211,11 +236,32 @@ server_accept(lua_State *T)
 	w->cb = server_accept_cb;
 	w->data = T;
 	ev_io_start(LEM_ w);
+	if (io_server->timeout > 0)
+		lem_timer_start(&io_server->t, io_server->timeout);
 	lua_settop(T, 1);
 	lua_pushvalue(T, lua_upvalueindex(1));
 	return lua_yield(T, 2);
 }
 
+/*
+ * server:settimeout() method
+ */
+static int
+server_settimeout(lua_State *T)
+{
+	struct server_io *io_server;
+	ev_tstamp timeout;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	timeout = (ev_tstamp)luaL_optnumber(T, 2, 0);
+	luaL_argcheck(T, timeout >= 0, 2, "expected a non-negative number");
+
+	io_server = lua_touserdata(T, 1);
+	lua_pushnumber(T, io_server->timeout);
+	io_server->timeout = timeout;
+	return 1;
+}
+
 static void
 server_autospawn_cb(EV_P_ struct ev_io *w, int revents)
 {
@@ -16,14 +16,43 @@
  * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define STREAM_INITIAL_WRITERS 4 /* this must be a power of 2 */
+
+/*
+ * a coroutine waiting for the arguments idx..top
+ * on its stack to be written, off bytes of the
+ * idx'th argument are already written
+ */
+struct stream_writer {
+	lua_State *T;
+	int idx;
+	int top;
+	size_t off;
+};
+
 struct stream {
 	struct ev_io r;
 	struct ev_io w;
 	unsigned int open;
-	int idx;
-	const char *out;
-	size_t out_len;
+	struct {
+		struct stream_writer *w;
+		unsigned int mask;
+		unsigned int first;
+		unsigned int last;
+	} wq;
+	struct {
+		char *buf;
+		size_t size;
+		size_t start;
+		size_t end;
+		int closing;
+		struct stream *next;
+		struct stream **pprev;
+	} ob;
 	struct lem_parser *p;
+	ev_tstamp timeout;
+	struct lem_timer rt;
+	struct lem_timer wt;
 	struct lem_inputbuf buf;
 };
 
@@ -40,6 +69,113 @@ stream_watch_init(struct stream *s, int fd)
 }
 #pragma GCC diagnostic pop
 
+/*
+ * buffered streams with output pending are linked
+ * into this list and flushed together right before
+ * the loop blocks for new events
+ */
+static struct stream *stream_dirty;
+static struct ev_prepare stream_flush_w;
+static void stream_flush_init(void);
+
+static void
+stream__dirty(struct stream *s)
+{
+	struct ev_prepare *w = &stream_flush_w;
+
+	if (s->ob.pprev != NULL)
+		return;
+
+	s->ob.next = stream_dirty;
+	if (s->ob.next)
+		s->ob.next->ob.pprev = &s->ob.next;
+	s->ob.pprev = &stream_dirty;
+	stream_dirty = s;
+
+	if (!ev_is_active(w)) {
+		/* set up on first use, which is always on the loop
+		 * thread, rather than every time the module is opened */
+		if (ev_cb(w) == NULL)
+			stream_flush_init();
+		ev_prepare_start(LEM_ w);
+	}
+}
+
+static void
+stream__clean(struct stream *s)
+{
+	if (s->ob.pprev == NULL)
+		return;
+
+	*s->ob.pprev = s->ob.next;
+	if (s->ob.next)
+		s->ob.next->ob.pprev = s->ob.pprev;
+	s->ob.pprev = NULL;
+}
+
+static void stream__push(struct stream *s, lua_State *T, int idx, int top);
+static int stream__write(lua_State *T, struct stream *s);
+static void stream_write_cb(EV_P_ struct ev_io *w, int revents);
+static void stream_sendfile_cb(EV_P_ struct ev_io *w, int revents);
+static lua_State *stream__sendfile_cancel(struct stream *s);
+static void stream_splice_r_cb(EV_P_ struct ev_io *w, int revents);
+static void stream_splice_w_cb(EV_P_ struct ev_io *w, int revents);
+struct stream_splice;
+static void stream__splice_abort(struct stream_splice *sp);
+
+/* drop the first queued writer, returning its coroutine */
+static lua_State *
+stream__shift(struct stream *s)
+{
+	struct stream_writer *w = &s->wq.w[s->wq.first];
+
+	io_pindata(w->T, w->idx, w->top, 0);
+	s->wq.first = (s->wq.first + 1) & s->wq.mask;
+	return w->T;
+}
+
+static void
+stream_readp_timeout(struct lem_timer *t)
+{
+	struct stream *s = STREAM_FROM_WATCH(t, rt);
+	lua_State *T = s->r.data;
+
+	ev_io_stop(LEM_ &s->r);
+	s->r.data = NULL;
+	lua_pushnil(T);
+	lua_pushliteral(T, "timeout");
+	lem_queue(T, 2);
+}
+
+static void
+stream_write_timeout(struct lem_timer *t)
+{
+	struct stream *s = STREAM_FROM_WATCH(t, wt);
+
+	ev_io_stop(LEM_ &s->w);
+	if (s->w.cb == stream_sendfile_cb) {
+		lua_State *T = stream__sendfile_cancel(s);
+
+		lua_pushnil(T);
+		lua_pushliteral(T, "timeout");
+		lem_queue(T, 2);
+		return;
+	}
+	s->w.data = NULL;
+	s->ob.start = s->ob.end = 0;
+	while (s->wq.first != s->wq.last) {
+		lua_State *T = stream__shift(s);
+
+		lua_pushnil(T);
+		lua_pushliteral(T, "timeout");
+		lem_queue(T, 2);
+	}
+	if (s->ob.closing) {
+		s->ob.closing = 0;
+		close(s->w.fd);
+	}
+}
+
 static struct stream *
 stream_new(lua_State *T, int fd, int mt)
 {
@@ -53,7 +189,20 @@ stream_new(lua_State *T, int fd, int mt)
 	s->open = 1;
 	s->r.data = NULL;
 	s->w.data = NULL;
-	lem_inputbuf_init(&s->buf);
+	s->wq.w = NULL;
+	s->wq.mask = 0;
+	s->wq.first = 0;
+	s->wq.last = 0;
+	s->ob.buf = NULL;
+	s->ob.size = 0;
+	s->ob.start = 0;
+	s->ob.end = 0;
+	s->ob.closing = 0;
+	s->ob.pprev = NULL;
+	s->timeout = 0;
+	lem_timer_init(&s->rt, stream_readp_timeout);
+	lem_timer_init(&s->wt, stream_write_timeout);
+	lem_inputbuf_setup(&s->buf, io_bufsize);
 
 	return s;
 }
@@ -63,10 +212,25 @@ stream_gc(lua_State *T)
 {
 	struct stream *s = lua_touserdata(T, 1);
 
-	if (s->open & 1)
-		close(s->r.fd);
+	lem_timer_stop(&s->rt);
+	lem_timer_stop(&s->wt);
+	ev_io_stop(LEM_ &s->r);
+	ev_io_stop(LEM_ &s->w);
+	stream__clean(s);
+	free(s->wq.w);
+	s->wq.first = s->wq.last = 0;
 	if (s->open & 2)
 		fcntl(s->w.fd, F_SETFL, 0);
+	if (s->open && s->ob.end > s->ob.start) {
+		/* last chance to get buffered output out,
+		 * this blocks for the standard streams */
+		while (stream__write(NULL, s) == 0 && (s->open & 2))
+			;
+	}
+	if (s->open & 1)
+		close(s->r.fd);
+	free(s->ob.buf);
+	lem_inputbuf_free(&s->buf);
 
 	return 0;
 }
@@ -91,17 +255,67 @@ stream_close(lua_State *T)
 	s = lua_touserdata(T, 1);
 	if (!s->open)
 		return io_closed(T);
+	if (s->r.data != NULL && s->r.cb == stream_splice_r_cb)
+		stream__splice_abort(s->r.data);
+	if (s->w.data != NULL && s->w.cb == stream_splice_w_cb)
+		stream__splice_abort(s->w.data);
 	if (s->r.data != NULL) {
 		ev_io_stop(LEM_ &s->r);
+		lem_timer_stop(&s->rt);
 		lem_queue(s->r.data, io_closed(s->r.data));
 		s->r.data = NULL;
 	}
-	if (s->w.data != NULL) {
+	/* unread input is of no use anymore */
+	lem_inputbuf_free(&s->buf);
+	if (s->w.data == s) {
+		/* queued writers fail, but buffered output was
+		 * already reported written, so wait for it */
+		while (s->wq.first != s->wq.last) {
+			lua_State *S = stream__shift(s);
+
+			lem_queue(S, io_closed(S));
+		}
+		if (s->ob.end > s->ob.start) {
+			s->open = 0;
+			s->ob.closing = 1;
+			stream__push(s, T, 2, 1);
+			lua_settop(T, 1);
+			return lua_yield(T, 1);
+		}
+		ev_io_stop(LEM_ &s->w);
+		lem_timer_stop(&s->wt);
+		s->w.data = NULL;
+	} else if (s->w.data != NULL && s->w.cb == stream_sendfile_cb) {
+		lua_State *S = stream__sendfile_cancel(s);
+
+		lem_queue(S, io_closed(S));
+	} else if (s->w.data != NULL) {
 		ev_io_stop(LEM_ &s->w);
 		lem_queue(s->w.data, io_closed(s->w.data));
 		s->w.data = NULL;
 	}
 
+	stream__clean(s);
+	if (s->ob.end > s->ob.start) {
+		/* flush buffered output before closing */
+		switch (stream__write(T, s)) {
+		case -1:
+			/* the error is on the stack */
+			return 2;
+		case 0:
+			s->open = 0;
+			s->ob.closing = 1;
+			stream__push(s, T, 2, 1);
+			s->w.data = s;
+			s->w.cb = stream_write_cb;
+			ev_io_start(LEM_ &s->w);
+			if (s->timeout > 0)
+				lem_timer_start(&s->wt, s->timeout);
+			lua_settop(T, 1);
+			return lua_yield(T, 1);
+		}
+	}
+
 	s->open = 0;
 	if (close(s->r.fd))
 		return io_strerror(T, errno);
@@ -122,7 +336,7 @@ stream__readp(lua_State *T, struct stream *s)
 	enum lem_preason res;
 
 	while ((bytes = read(s->r.fd, s->buf.buf + s->buf.end,
-					LEM_INPUTBUF_SIZE - s->buf.end)) > 0) {
+					s->buf.size - s->buf.end)) > 0) {
 		lem_debug("read %ld bytes from %d", bytes, s->r.fd);
 
 		s->buf.end += bytes;
@@ -164,19 +378,21 @@ stream_readp_cb(EV_P_ struct ev_io *w, int revents)
 
 	(void)revents;
 
+	lem_inputbuf_get(&s->buf);
 	if (!s->open) {
 		ret = 0;
 		if (s->p->destroy)
 			ret = s->p->destroy(T, &s->buf, LEM_PCLOSED);
 		if (ret <= 0)
 			ret = io_closed(T);
-	} else {
+	} else
 		ret = stream__readp(T, s);
-		if (ret == 0)
-			return;
-	}
+	lem_inputbuf_put(&s->buf);
+	if (ret == 0)
+		return;
 
 	ev_io_stop(EV_A_ &s->r);
+	lem_timer_stop(&s->rt);
 	s->r.data = NULL;
 	lem_queue(T, ret);
 }
@@ -200,54 +416,64 @@ stream_readp(lua_State *T)
 		return io_busy(T);
 
 	p = lua_touserdata(T, 2);
+	lem_inputbuf_get(&s->buf);
 	if (p->init)
 		p->init(T, &s->buf);
 
 	ret = p->process(T, &s->buf);
-	if (ret > 0)
-		return ret;
-
-	s->p = p;
-	ret = stream__readp(T, s);
+	if (ret == 0) {
+		s->p = p;
+		ret = stream__readp(T, s);
+	}
+	/* don't hold on to an empty buffer while waiting */
+	lem_inputbuf_put(&s->buf);
 	if (ret > 0)
 		return ret;
 
 	s->r.data = T;
 	s->r.cb = stream_readp_cb;
 	ev_io_start(LEM_ &s->r);
+	if (s->timeout > 0)
+		lem_timer_start(&s->rt, s->timeout);
 	return lua_yield(T, lua_gettop(T));
 }
 
 /*
- * stream:write() method
+ * stream:readinto() method
+ *
+ * reads up to n bytes straight into a lem.buffer,
+ * bypassing the input buffer and Lua strings
  */
 static int
-stream__write(lua_State *T, struct stream *s)
+stream__readinto(lua_State *T, struct stream *s)
 {
+	struct lem_buffer *b = lua_touserdata(T, 2);
+	size_t n = (size_t)lua_tointeger(T, 3);
+	char *p = lem_buffer_reserve(b, n);
 	ssize_t bytes;
 	int err;
 
-	while ((bytes = write(s->w.fd, s->out, s->out_len)) > 0) {
-		lem_debug("wrote %ld bytes to fd %d", bytes, s->w.fd);
-		s->out += bytes;
-		s->out_len -= bytes;
-		while (s->out_len == 0) {
-			if (s->idx >= lua_gettop(T)) {
-				lua_pushboolean(T, 1);
-				return 1;
-			}
-			s->out = lua_tolstring(T, ++s->idx, &s->out_len);
-		}
+	if (p == NULL) {
+		lua_settop(T, 0);
+		return b->busy ? io_busy(T) : io_strerror(T, ENOMEM);
 	}
-	err = errno;
-	lem_debug("wrote %ld bytes to fd %d", bytes, s->w.fd);
 
-	if (bytes < 0 && (err == EAGAIN || err == EINTR || err == ECONNREFUSED))
+	bytes = read(s->r.fd, p, n);
+	lem_debug("read %ld bytes from %d", bytes, s->r.fd);
+	if (bytes > 0) {
+		b->len += bytes;
+		lua_settop(T, 0);
+		lua_pushinteger(T, bytes);
+		return 1;
+	}
+	err = errno;
+	if (bytes < 0 && (err == EAGAIN || err == EINTR))
 		return 0;
 
 	s->open = 0;
-	close(s->w.fd);
+	close(s->r.fd);
 
+	lua_settop(T, 0);
 	if (bytes == 0 || err == ECONNRESET || err == EPIPE)
 		return io_closed(T);
 
@@ -255,163 +481,585 @@ stream__write(lua_State *T, struct stream *s)
 }
 
 static void
-stream_write_cb(EV_P_ struct ev_io *w, int revents)
+stream_readinto_cb(EV_P_ struct ev_io *w, int revents)
 {
-	struct stream *s = STREAM_FROM_WATCH(w, w);
-	lua_State *T = s->w.data;
+	struct stream *s = STREAM_FROM_WATCH(w, r);
+	lua_State *T = s->r.data;
 	int ret;
 
 	(void)revents;
 
-	if (!s->open)
+	if (!s->open) {
+		lua_settop(T, 0);
 		ret = io_closed(T);
-	else {
-		ret = stream__write(T, s);
+	} else {
+		ret = stream__readinto(T, s);
 		if (ret == 0)
 			return;
 	}
 
-	ev_io_stop(EV_A_ &s->w);
-	s->w.data = NULL;
+	ev_io_stop(EV_A_ &s->r);
+	lem_timer_stop(&s->rt);
+	s->r.data = NULL;
 	lem_queue(T, ret);
 }
 
 static int
-stream_write(lua_State *T)
+stream_readinto(lua_State *T)
 {
 	struct stream *s;
-	const char *out;
-	size_t out_len;
-	int idx;
-	int i;
-	int top;
+	struct lem_buffer *b;
+	lua_Integer n;
 	int ret;
 
 	luaL_checktype(T, 1, LUA_TUSERDATA);
-	top = lua_gettop(T);
-	idx = 1;
-	do {
-		out = luaL_checklstring(T, ++idx, &out_len);
-	} while (out_len == 0 && idx < top);
-	for (i = idx+1; i <= top; i++)
-		(void)luaL_checkstring(T, i);
+	b = lem_buffer_test(T, 2);
+	if (b == NULL)
+		return luaL_argerror(T, 2, "expected buffer");
 
 	s = lua_touserdata(T, 1);
+	n = luaL_optinteger(T, 3, s->buf.defsize);
+	luaL_argcheck(T, n > 0, 3, "expected a positive number");
+
 	if (!s->open)
 		return io_closed(T);
-	if (s->w.data != NULL)
+	if (s->r.data != NULL)
 		return io_busy(T);
-	if (out_len == 0) {
-		lua_pushboolean(T, 1);
+
+	/* hand out what is already buffered first */
+	if (s->buf.end > s->buf.start) {
+		size_t len = s->buf.end - s->buf.start;
+		char *p;
+
+		if ((size_t)n < len)
+			len = (size_t)n;
+		p = lem_buffer_reserve(b, len);
+		if (p == NULL)
+			return b->busy ? io_busy(T) : io_strerror(T, ENOMEM);
+		memcpy(p, s->buf.buf + s->buf.start, len);
+		b->len += len;
+		s->buf.start += len;
+		if (s->buf.start == s->buf.end) {
+			s->buf.start = s->buf.end = 0;
+			lem_inputbuf_put(&s->buf);
+		}
+		lua_pushinteger(T, (lua_Integer)len);
 		return 1;
 	}
 
-	s->out = out;
-	s->out_len = out_len;
-	s->idx = idx;
-	ret = stream__write(T, s);
+	lua_settop(T, 2);
+	lua_pushinteger(T, n);
+	ret = stream__readinto(T, s);
 	if (ret > 0)
 		return ret;
 
-	s->w.data = T;
-	s->w.cb = stream_write_cb;
-	ev_io_start(LEM_ &s->w);
-	return lua_yield(T, top);
+	s->r.data = T;
+	s->r.cb = stream_readinto_cb;
+	ev_io_start(LEM_ &s->r);
+	if (s->timeout > 0)
+		lem_timer_start(&s->rt, s->timeout);
+	return lua_yield(T, 3);
 }
 
-#ifdef TCP_CORK
-static int
-stream_setcork(lua_State *T, int state)
+/*
+ * stream:write() method
+ *
+ * concurrent writers are queued on the stream rather
+ * than told to wait, and whenever the socket is
+ * writable everything queued is flushed with a
+ * single writev(). buffered output, if any, always
+ * goes out before the queued writers.
+ */
+static void
+stream__push(struct stream *s, lua_State *T, int idx, int top)
 {
-	struct stream *s;
-
-	luaL_checktype(T, 1, LUA_TUSERDATA);
-	s = lua_touserdata(T, 1);
-	if (!s->open)
-		return io_closed(T);
-	if (s->w.data != NULL)
-		return io_busy(T);
+	struct stream_writer *w;
+
+	if (s->wq.w == NULL ||
+			((s->wq.last + 1) & s->wq.mask) == s->wq.first) {
+		unsigned int size = s->wq.w == NULL ? STREAM_INITIAL_WRITERS
+			: 2*(s->wq.mask + 1);
+		struct stream_writer *ring =
+			lem_xmalloc(size * sizeof(struct stream_writer));
+		unsigned int i = 0;
+
+		while (s->wq.first != s->wq.last) {
+			ring[i++] = s->wq.w[s->wq.first];
+			s->wq.first = (s->wq.first + 1) & s->wq.mask;
+		}
 
-	if (setsockopt(s->w.fd, IPPROTO_TCP, TCP_CORK, &state, sizeof(int)))
-		return io_strerror(T, errno);
+		free(s->wq.w);
+		s->wq.w = ring;
+		s->wq.mask = size - 1;
+		s->wq.first = 0;
+		s->wq.last = i;
+	}
 
-	lua_pushboolean(T, 1);
-	return 1;
+	w = &s->wq.w[s->wq.last];
+	w->T = T;
+	w->idx = idx;
+	w->top = top;
+	w->off = 0;
+	io_pindata(T, idx, top, 1);
+	s->wq.last = (s->wq.last + 1) & s->wq.mask;
 }
 
-static int
-stream_cork(lua_State *T)
+/* consume bytes from the queue and wake up the
+ * writers done, except the one currently running */
+static void
+stream__advance(struct stream *s, lua_State *T, size_t bytes)
 {
-	return stream_setcork(T, 1);
+	if (s->ob.end > s->ob.start) {
+		size_t len = s->ob.end - s->ob.start;
+
+		if (bytes < len) {
+			s->ob.start += bytes;
+			return;
+		}
+		bytes -= len;
+		s->ob.start = s->ob.end = 0;
+	}
+
+	while (s->wq.first != s->wq.last) {
+		struct stream_writer *w = &s->wq.w[s->wq.first];
+		size_t len;
+
+		while (w->idx <= w->top) {
+			len = io_datalen(w->T, w->idx) - w->off;
+			if (bytes < len) {
+				w->off += bytes;
+				return;
+			}
+			bytes -= len;
+			io_pindata(w->T, w->idx, w->idx, 0);
+			w->idx++;
+			w->off = 0;
+		}
+
+		(void)stream__shift(s);
+		if (w->T != T) {
+			lua_pushboolean(w->T, 1);
+			lem_queue(w->T, 1);
+		}
+	}
 }
 
 static int
-stream_uncork(lua_State *T)
+stream__werror(lua_State *T, int err)
 {
-	return stream_setcork(T, 0);
+	if (err == 0 || err == ECONNRESET || err == EPIPE)
+		return io_closed(T);
+
+	return io_strerror(T, err);
 }
-#endif
-#ifdef TCP_NODELAY
+
+/*
+ * returns 1 when the queue is empty, 0 when the socket
+ * is full and -1 on errors, in which case every queued
+ * writer but T is woken up with the error and the error
+ * is pushed onto T
+ */
 static int
-stream_setnodelay(lua_State *T, int state)
+stream__write(lua_State *T, struct stream *s)
 {
-	struct stream *s;
+	struct iovec iov[IO_IOVMAX];
+	ssize_t bytes;
+	int err;
 
-	luaL_checktype(T, 1, LUA_TUSERDATA);
-	s = lua_touserdata(T, 1);
-	if (!s->open)
-		return io_closed(T);
-	if (s->w.data != NULL)
-		return io_busy(T);
+	while (s->wq.first != s->wq.last || s->ob.end > s->ob.start) {
+		unsigned int i;
+		size_t total = 0;
+		int n = 0;
 
-	if (setsockopt(s->w.fd, IPPROTO_TCP, TCP_NODELAY, &state, sizeof(int)))
-		return io_strerror(T, errno);
+		if (s->ob.end > s->ob.start) {
+			iov[0].iov_base = s->ob.buf + s->ob.start;
+			iov[0].iov_len = s->ob.end - s->ob.start;
+			total = iov[0].iov_len;
+			n = 1;
+		}
+
+		for (i = s->wq.first; i != s->wq.last && n < IO_IOVMAX;
+				i = (i + 1) & s->wq.mask) {
+			struct stream_writer *w = &s->wq.w[i];
+			size_t off = w->off;
+			int j;
+
+			/* a rope cut short by IO_IOVMAX always
+			 * fills the array, so the order is kept */
+			for (j = w->idx; j <= w->top && n < IO_IOVMAX; j++) {
+				n += io_dataiov(w->T, j, off, iov + n,
+						IO_IOVMAX - n, &total);
+				off = 0;
+			}
+		}
+
+		if (total == 0) {
+			stream__advance(s, T, 0);
+			continue;
+		}
+
+		bytes = writev(s->w.fd, iov, n);
+		lem_debug("wrote %ld bytes to fd %d", bytes, s->w.fd);
+		if (bytes <= 0)
+			goto error;
+
+		stream__advance(s, T, bytes);
+		if ((size_t)bytes < total)
+			return 0;
+	}
 
-	lua_pushboolean(T, 1);
 	return 1;
-}
 
-static int
-stream_nodelay(lua_State *T)
-{
-	return stream_setnodelay(T, 1);
+error:
+	err = errno;
+	if (bytes < 0 && (err == EAGAIN || err == EINTR || err == ECONNREFUSED))
+		return 0;
+	if (bytes == 0)
+		err = 0;
+
+	s->open = 0;
+	s->ob.closing = 0;
+	s->ob.start = s->ob.end = 0;
+	close(s->w.fd);
+
+	while (s->wq.first != s->wq.last) {
+		lua_State *S = stream__shift(s);
+
+		if (S != T)
+			lem_queue(S, stream__werror(S, err));
+	}
+
+	if (T != NULL)
+		stream__werror(T, err);
+	return -1;
 }
 
-static int
-stream_nagle(lua_State *T)
+static void
+stream_write_cb(EV_P_ struct ev_io *w, int revents)
 {
-	return stream_setnodelay(T, 0);
+	struct stream *s = STREAM_FROM_WATCH(w, w);
+
+	(void)revents;
+
+	if (stream__write(NULL, s) == 0) {
+		/* still blocked, but progress was made */
+		if (s->timeout > 0) {
+			lem_timer_stop(&s->wt);
+			lem_timer_start(&s->wt, s->timeout);
+		}
+		return;
+	}
+
+	ev_io_stop(EV_A_ &s->w);
+	lem_timer_stop(&s->wt);
+	s->w.data = NULL;
+
+	/* stream:close() was waiting for the output */
+	if (s->ob.closing) {
+		s->ob.closing = 0;
+		close(s->w.fd);
+	}
 }
-#endif
 
+/* copy arguments idx..top into the output buffer if they fit */
 static int
-stream_set_blocking(lua_State *T)
+stream__buffer(lua_State *T, struct stream *s, int idx, int top)
 {
-	struct stream *s;
+	size_t total = 0;
+	int i;
 
-	luaL_checktype(T, 1, LUA_TUSERDATA);
-	s = lua_touserdata(T, 1);
+	for (i = idx; i <= top; i++)
+		total += io_datalen(T, i);
 
-	int block = lua_tointeger(T, 2);
+	if (total > s->ob.size - (s->ob.end - s->ob.start))
+		return 0;
 
-	if (!s->open)
-		return io_closed(T);
+	if (s->ob.end + total > s->ob.size) {
+		memmove(s->ob.buf, s->ob.buf + s->ob.start,
+				s->ob.end - s->ob.start);
+		s->ob.end -= s->ob.start;
+		s->ob.start = 0;
+	}
 
-	if (fcntl(s->w.fd, F_SETFL, block) == -1) {
-		return io_strerror(T, errno);
+	for (i = idx; i <= top; i++) {
+		io_datacopy(T, i, s->ob.buf + s->ob.end);
+		s->ob.end += io_datalen(T, i);
 	}
 
-	return 0;
+	/* if we're already waiting for the socket
+	 * the write watcher will take care of it */
+	if (s->w.data == NULL)
+		stream__dirty(s);
+	return 1;
 }
 
-static int
-stream_getpeer(lua_State *T)
+static void
+stream_flush_cb(EV_P_ struct ev_prepare *w, int revents)
 {
-	struct stream *s;
-	union {
-		struct sockaddr all;
-		struct sockaddr_in in;
-		struct sockaddr_in6 in6;
+	(void)revents;
+
+	while (stream_dirty != NULL) {
+		struct stream *s = stream_dirty;
+
+		stream__clean(s);
+		if (s->ob.end == s->ob.start || s->w.data != NULL)
+			continue;
+		if (!s->open) {
+			s->ob.start = s->ob.end = 0;
+			continue;
+		}
+
+		if (stream__write(NULL, s) == 0) {
+			s->w.data = s;
+			s->w.cb = stream_write_cb;
+			ev_io_start(EV_A_ &s->w);
+			if (s->timeout > 0)
+				lem_timer_start(&s->wt, s->timeout);
+		}
+	}
+
+	ev_prepare_stop(EV_A_ w);
+}
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wstrict-aliasing"
+static void
+stream_flush_init(void)
+{
+	ev_prepare_init(&stream_flush_w, stream_flush_cb);
+}
+#pragma GCC diagnostic pop
+
+static int
+stream_write(lua_State *T)
+{
+	struct stream *s;
+	size_t out_len;
+	int idx;
+	int i;
+	int top;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	top = lua_gettop(T);
+	idx = 1;
+	do {
+		out_len = io_checkdata(T, ++idx);
+	} while (out_len == 0 && idx < top);
+	for (i = idx+1; i <= top; i++)
+		(void)io_checkdata(T, i);
+
+	s = lua_touserdata(T, 1);
+	if (!s->open)
+		return io_closed(T);
+	if (out_len == 0) {
+		lua_pushboolean(T, 1);
+		return 1;
+	}
+	if (s->w.data != NULL && s->w.data != s)
+		return io_busy(T);
+
+	if (s->ob.buf != NULL && s->wq.first == s->wq.last &&
+			stream__buffer(T, s, idx, top)) {
+		lua_pushboolean(T, 1);
+		return 1;
+	}
+
+	stream__push(s, T, idx, top);
+	if (s->w.data == s) /* wait in line */
+		return lua_yield(T, top);
+
+	switch (stream__write(T, s)) {
+	case 1:
+		lua_pushboolean(T, 1);
+		return 1;
+	case -1:
+		return 2;
+	}
+
+	s->w.data = s;
+	s->w.cb = stream_write_cb;
+	ev_io_start(LEM_ &s->w);
+	if (s->timeout > 0)
+		lem_timer_start(&s->wt, s->timeout);
+	return lua_yield(T, top);
+}
+
+/*
+ * stream:setbuffered() method
+ */
+static int
+stream_setbuffered(lua_State *T)
+{
+	struct stream *s;
+	lua_Integer size;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	size = luaL_optinteger(T, 2, 0);
+	luaL_argcheck(T, size >= 0 && size <= INT_MAX, 2,
+			"not an integer in proper range");
+
+	s = lua_touserdata(T, 1);
+	if (!s->open)
+		return io_closed(T);
+	if (s->w.data != NULL)
+		return io_busy(T);
+	if (s->ob.end > s->ob.start) {
+		if (stream__write(T, s) < 0)
+			return 2;
+		if (s->ob.end > s->ob.start)
+			return io_busy(T);
+	}
+
+	stream__clean(s);
+	free(s->ob.buf);
+	s->ob.buf = NULL;
+	s->ob.size = 0;
+	s->ob.start = s->ob.end = 0;
+	if (size > 0) {
+		s->ob.buf = lem_xmalloc(size);
+		s->ob.size = size;
+	}
+
+	lua_pushboolean(T, 1);
+	return 1;
+}
+
+/*
+ * stream:settimeout() method
+ */
+static int
+stream_settimeout(lua_State *T)
+{
+	struct stream *s;
+	ev_tstamp timeout;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	timeout = (ev_tstamp)luaL_optnumber(T, 2, 0);
+	luaL_argcheck(T, timeout >= 0, 2, "expected a non-negative number");
+
+	s = lua_touserdata(T, 1);
+	lua_pushnumber(T, s->timeout);
+	s->timeout = timeout;
+	return 1;
+}
+
+/*
+ * stream:setbufsize() method
+ */
+static int
+stream_setbufsize(lua_State *T)
+{
+	struct stream *s;
+	unsigned int size;
+	int ret;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	size = io_checkbufsize(T, 2);
+
+	s = lua_touserdata(T, 1);
+	if (s->r.data != NULL)
+		return io_busy(T);
+
+	lua_pushinteger(T, s->buf.defsize);
+	ret = io_resizebuf(T, &s->buf, size);
+	if (ret > 0)
+		return ret;
+	return 1;
+}
+
+#ifdef TCP_CORK
+static int
+stream_setcork(lua_State *T, int state)
+{
+	struct stream *s;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	s = lua_touserdata(T, 1);
+	if (!s->open)
+		return io_closed(T);
+	if (s->w.data != NULL)
+		return io_busy(T);
+
+	if (setsockopt(s->w.fd, IPPROTO_TCP, TCP_CORK, &state, sizeof(int)))
+		return io_strerror(T, errno);
+
+	lua_pushboolean(T, 1);
+	return 1;
+}
+
+static int
+stream_cork(lua_State *T)
+{
+	return stream_setcork(T, 1);
+}
+
+static int
+stream_uncork(lua_State *T)
+{
+	return stream_setcork(T, 0);
+}
+#endif
+#ifdef TCP_NODELAY
+static int
+stream_setnodelay(lua_State *T, int state)
+{
+	struct stream *s;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	s = lua_touserdata(T, 1);
+	if (!s->open)
+		return io_closed(T);
+	if (s->w.data != NULL)
+		return io_busy(T);
+
+	if (setsockopt(s->w.fd, IPPROTO_TCP, TCP_NODELAY, &state, sizeof(int)))
+		return io_strerror(T, errno);
+
+	lua_pushboolean(T, 1);
+	return 1;
+}
+
+static int
+stream_nodelay(lua_State *T)
+{
+	return stream_setnodelay(T, 1);
+}
+
+static int
+stream_nagle(lua_State *T)
+{
+	return stream_setnodelay(T, 0);
+}
+#endif
+
+static int
+stream_set_blocking(lua_State *T)
+{
+	struct stream *s;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	s = lua_touserdata(T, 1);
+
+	int block = lua_tointeger(T, 2);
+
+	if (!s->open)
+		return io_closed(T);
+
+	if (fcntl(s->w.fd, F_SETFL, block) == -1) {
+		return io_strerror(T, errno);
+	}
+
+	return 0;
+}
+
+static int
+stream_getpeer(lua_State *T)
+{
+	struct stream *s;
+	union {
+		struct sockaddr all;
+		struct sockaddr_in in;
+		struct sockaddr_in6 in6;
 	} addr;
 	socklen_t len;
 
@@ -485,90 +1133,143 @@ stream_getpeer(lua_State *T)
 	return io_strerror(T, EINVAL);
 }
 
+/*
+ * stream:sendfile() method
+ *
+ * the socket stays non-blocking and sendfile(2) is called
+ * from the write watcher whenever the socket is writable,
+ * so a slow client doesn't tie up a thread in the pool
+ */
 struct sfhandle {
-	struct lem_async a;
 	lua_State *T;
-	struct stream *s;
 	off_t size;
 	off_t offset;
+	off_t sent;
 	int fd;
-	int ret;
+	int err;
 };
 
-static void
-stream_sendfile_work(struct lem_async *a)
+/* returns 1 when done, 0 if blocked and -1 on error */
+static int
+stream__sendfile(struct stream *s, struct sfhandle *sf)
 {
-	struct sfhandle *sf = (struct sfhandle *)a;
-	struct stream *s = sf->s;
-
-	/* make socket blocking */
-	if (fcntl(s->w.fd, F_SETFL, 0) == -1) {
-		sf->ret = errno;
-		return;
+	/* buffered output goes first */
+	if (s->ob.end > s->ob.start) {
+		switch (stream__write(NULL, s)) {
+		case 0:
+			return 0;
+		case -1:
+			sf->err = 0;
+			return -1;
+		}
 	}
 
+	while (sf->sent < sf->size) {
 #ifdef __FreeBSD__
-	off_t written;
-	int ret = sendfile(sf->fd, s->w.fd,
-			sf->offset, sf->size,
-			NULL, &written, SF_SYNC);
-	if (ret == 0) {
-		sf->ret = 0;
-		sf->size = written;
-	} else
-		sf->ret = errno;
-	lem_debug("wrote = %ld bytes", written);
+		off_t written = 0;
+		int ret = sendfile(sf->fd, s->w.fd, sf->offset,
+				sf->size - sf->sent, NULL, &written, 0);
+
+		sf->offset += written;
+		sf->sent += written;
+		lem_debug("wrote = %ld bytes", written);
+		if (ret == 0 && written == 0)
+			break; /* end of file */
 #else
 #ifdef __APPLE__
-	int ret = sendfile(sf->fd, s->w.fd,
-			sf->offset, &sf->size,
-			NULL, 0);
-	if (ret == 0)
-		sf->ret = 0;
-	else
-		sf->ret = errno;
-	lem_debug("wrote = %lld bytes", sf->size);
+		off_t written = sf->size - sf->sent;
+		int ret = sendfile(sf->fd, s->w.fd, sf->offset,
+				&written, NULL, 0);
+
+		sf->offset += written;
+		sf->sent += written;
+		lem_debug("wrote = %lld bytes", written);
+		if (ret == 0 && written == 0)
+			break; /* end of file */
 #else
-	ssize_t ret = sendfile(s->w.fd, sf->fd,
-			&sf->offset, sf->size);
-	if (ret >= 0) {
-		sf->ret = 0;
-		sf->size = ret;
-	} else
-		sf->ret = errno;
-	lem_debug("wrote = %ld bytes", ret);
+		ssize_t ret = sendfile(s->w.fd, sf->fd,
+				&sf->offset, sf->size - sf->sent);
+
+		lem_debug("wrote = %ld bytes", ret);
+		if (ret == 0)
+			break; /* end of file */
+		if (ret > 0) {
+			sf->sent += ret;
+			continue;
+		}
 #endif
 #endif
+		if (ret == 0)
+			continue;
 
-	/* make socket non-blocking again */
-	if (fcntl(s->w.fd, F_SETFL, O_NONBLOCK) == -1) {
-		sf->ret = errno;
-		return;
+		if (errno == EAGAIN)
+			return 0;
+		if (errno != EINTR) {
+			sf->err = errno;
+			return -1;
+		}
+	}
+
+	return 1;
+}
+
+static int
+stream__sendfile_result(lua_State *T, struct stream *s,
+		struct sfhandle *sf, int ret)
+{
+	if (ret < 0) {
+		if (s->open) {
+			s->open = 0;
+			close(s->w.fd);
+		}
+		ret = sf->err ? io_strerror(T, sf->err) : io_closed(T);
+	} else {
+		lua_pushinteger(T, sf->sent);
+		ret = 1;
 	}
+
+	free(sf);
+	return ret;
 }
 
 static void
-stream_sendfile_reap(struct lem_async *a)
+stream_sendfile_cb(EV_P_ struct ev_io *w, int revents)
 {
-	struct sfhandle *sf = (struct sfhandle *)a;
+	struct stream *s = STREAM_FROM_WATCH(w, w);
+	struct sfhandle *sf = w->data;
 	lua_State *T = sf->T;
-	struct stream *s = sf->s;
+	off_t sent = sf->sent;
 	int ret;
 
-	if (sf->ret == 0) {
-		lua_pushinteger(T, sf->size);
-		ret = 1;
-	} else {
-		if (s->open)
-			close(s->w.fd);
-		s->open = 0;
-		ret = io_strerror(T, sf->ret);
+	(void)revents;
+
+	ret = stream__sendfile(s, sf);
+	if (ret == 0) {
+		if (sf->sent != sent && s->timeout > 0) {
+			lem_timer_stop(&s->wt);
+			lem_timer_start(&s->wt, s->timeout);
+		}
+		return;
 	}
 
-	free(sf);
+	ev_io_stop(EV_A_ &s->w);
+	lem_timer_stop(&s->wt);
+	s->w.data = NULL;
+	lem_queue(T, stream__sendfile_result(T, s, sf, ret));
+}
+
+/* stop a running sendfile and return the waiting coroutine */
+static lua_State *
+stream__sendfile_cancel(struct stream *s)
+{
+	struct sfhandle *sf = s->w.data;
+	lua_State *T = sf->T;
 
+	ev_io_stop(LEM_ &s->w);
+	lem_timer_stop(&s->wt);
 	s->w.data = NULL;
-	lem_queue(T, ret);
+	free(sf);
+	return T;
 }
 
 static int
@@ -579,6 +1280,7 @@ stream_sendfile(lua_State *T)
 	off_t size;
 	off_t offset;
 	struct sfhandle *sf;
+	int ret;
 
 	luaL_checktype(T, 1, LUA_TUSERDATA);
 	luaL_checktype(T, 2, LUA_TUSERDATA);
@@ -598,20 +1300,432 @@ stream_sendfile(lua_State *T)
 		return 2;
 	}
 
-	s->w.data = T;
-
 	sf = lem_xmalloc(sizeof(struct sfhandle));
 	sf->T = T;
-	sf->s = s;
 	sf->size = size;
 	sf->offset = offset;
+	sf->sent = 0;
 	sf->fd = f->fd;
-	lem_async_do(&sf->a, stream_sendfile_work, stream_sendfile_reap);
+	sf->err = 0;
+
+	ret = stream__sendfile(s, sf);
+	if (ret != 0)
+		return stream__sendfile_result(T, s, sf, ret);
+
+	s->w.data = sf;
+	s->w.cb = stream_sendfile_cb;
+	ev_io_start(LEM_ &s->w);
+	if (s->timeout > 0)
+		lem_timer_start(&s->wt, s->timeout);
 
 	lua_settop(T, 2);
 	return lua_yield(T, 2);
 }
 
+/*
+ * stream:splice() method and io.proxy()
+ *
+ * data is moved from src to dst through a pipe with
+ * splice(2) where available and through a plain buffer
+ * elsewhere. the read watcher of src and the write
+ * watcher of dst are reserved for the duration and at
+ * most one of them is active at any time.
+ */
+#define SPLICE_CHUNK (64*1024)
+
+enum splice_state {
+	SPLICE_READ,
+	SPLICE_WRITE,
+	SPLICE_DONE,
+	SPLICE_EOF,
+	SPLICE_ERROR,
+};
+
+struct stream_splice {
+	lua_State *T;
+	struct stream *src;
+	struct stream *dst;
+	struct stream_splice *peer;
+	size_t max;
+	size_t moved;
+	size_t inpipe;
+	int idx;
+	int err;
+	int closesrc;
+	int closedst;
+#ifdef __linux__
+	int pipe[2];
+#else
+	size_t off;
+	char *buf;
+#endif
+};
+
+static ssize_t
+splice__fill(struct stream_splice *sp, size_t len)
+{
+#ifdef __linux__
+	return splice(sp->src->r.fd, NULL, sp->pipe[1], NULL, len,
+			SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+#else
+	sp->off = 0;
+	return read(sp->src->r.fd, sp->buf, len);
+#endif
+}
+
+static ssize_t
+splice__drain(struct stream_splice *sp)
+{
+#ifdef __linux__
+	return splice(sp->pipe[0], NULL, sp->dst->w.fd, NULL, sp->inpipe,
+			SPLICE_F_NONBLOCK | SPLICE_F_MOVE);
+#else
+	ssize_t bytes = write(sp->dst->w.fd, sp->buf + sp->off, sp->inpipe);
+
+	if (bytes > 0)
+		sp->off += bytes;
+	return bytes;
+#endif
+}
+
+static int
+stream__splice(struct stream_splice *sp)
+{
+	struct stream *src = sp->src;
+	struct stream *dst = sp->dst;
+	ssize_t bytes;
+
+	/* buffered output of the destination goes first */
+	if (dst->ob.end > dst->ob.start) {
+		switch (stream__write(NULL, dst)) {
+		case 0:
+			return SPLICE_WRITE;
+		case -1:
+			sp->err = 0;
+			return SPLICE_ERROR;
+		}
+	}
+
+	/* then whatever is left in the input buffer */
+	while (src->buf.end > src->buf.start && sp->moved < sp->max) {
+		size_t len = src->buf.end - src->buf.start;
+
+		if (len > sp->max - sp->moved)
+			len = sp->max - sp->moved;
+
+		bytes = write(dst->w.fd, src->buf.buf + src->buf.start, len);
+		if (bytes < 0)
+			goto write_error;
+		src->buf.start += bytes;
+		sp->moved += bytes;
+	}
+	if (src->buf.start == src->buf.end) {
+		src->buf.start = src->buf.end = 0;
+		lem_inputbuf_put(&src->buf);
+	}
+
+	for (;;) {
+		size_t len;
+
+		if (sp->inpipe > 0) {
+			bytes = splice__drain(sp);
+			if (bytes < 0)
+				goto write_error;
+			lem_debug("spliced %ld bytes to fd %d", bytes, dst->w.fd);
+			sp->inpipe -= bytes;
+			sp->moved += bytes;
+			continue;
+		}
+
+		if (sp->moved >= sp->max)
+			return SPLICE_DONE;
+
+		len = sp->max - sp->moved;
+		if (len > SPLICE_CHUNK)
+			len = SPLICE_CHUNK;
+
+		bytes = splice__fill(sp, len);
+		if (bytes == 0) {
+			sp->closesrc = 1;
+			return SPLICE_EOF;
+		}
+		if (bytes < 0) {
+			switch (errno) {
+			case EAGAIN: case EINTR:
+				return SPLICE_READ;
+			case ECONNRESET: case EPIPE:
+				sp->closesrc = 1;
+				return SPLICE_EOF;
+			}
+			sp->err = errno;
+			sp->closesrc = 1;
+			return SPLICE_ERROR;
+		}
+		lem_debug("spliced %ld bytes from fd %d", bytes, src->r.fd);
+		sp->inpipe += bytes;
+	}
+
+write_error:
+	switch (errno) {
+	case EAGAIN: case EINTR: case ECONNREFUSED:
+		return SPLICE_WRITE;
+	case ECONNRESET: case EPIPE:
+		sp->err = 0;
+		break;
+	default:
+		sp->err = errno;
+	}
+	sp->closedst = 1;
+	return SPLICE_ERROR;
+}
+
+static void
+stream__splice_stop(struct stream_splice *sp)
+{
+	struct stream *src = sp->src;
+	struct stream *dst = sp->dst;
+
+	ev_io_stop(LEM_ &src->r);
+	src->r.data = NULL;
+	ev_io_stop(LEM_ &dst->w);
+	dst->w.data = NULL;
+
+	if (sp->closesrc && src->open) {
+		src->open = 0;
+		close(src->r.fd);
+	}
+	if (sp->closedst && dst->open) {
+		dst->open = 0;
+		close(dst->w.fd);
+	}
+
+#ifdef __linux__
+	close(sp->pipe[0]);
+	close(sp->pipe[1]);
+#else
+	free(sp->buf);
+#endif
+}
+
+/* tear everything down and push the results onto T */
+static int
+stream__splice_finish(struct stream_splice *sp, int state)
+{
+	struct stream_splice *base = sp - sp->idx;
+	lua_State *T = sp->T;
+	int ret;
+
+	if (state == SPLICE_ERROR)
+		ret = sp->err ? io_strerror(T, sp->err) : io_closed(T);
+	else if (base->peer != NULL) {
+		lua_pushinteger(T, base[0].moved);
+		lua_pushinteger(T, base[1].moved);
+		ret = 2;
+	} else if (sp->moved == 0 && state == SPLICE_EOF)
+		ret = io_closed(T);
+	else {
+		lua_pushinteger(T, sp->moved);
+		ret = 1;
+	}
+
+	stream__splice_stop(&base[0]);
+	if (base->peer != NULL)
+		stream__splice_stop(&base[1]);
+	free(base);
+	return ret;
+}
+
+/* returns 0 if waiting, otherwise the number of results */
+static int
+stream__splice_run(struct stream_splice *sp)
+{
+	int state = stream__splice(sp);
+
+	switch (state) {
+	case SPLICE_READ:
+		ev_io_stop(LEM_ &sp->dst->w);
+		ev_io_start(LEM_ &sp->src->r);
+		return 0;
+	case SPLICE_WRITE:
+		ev_io_stop(LEM_ &sp->src->r);
+		ev_io_start(LEM_ &sp->dst->w);
+		return 0;
+	}
+
+	return stream__splice_finish(sp, state);
+}
+
+static void
+stream_splice_r_cb(EV_P_ struct ev_io *w, int revents)
+{
+	struct stream_splice *sp = w->data;
+	lua_State *T = sp->T;
+	int ret;
+
+	(void)EV_A;
+	(void)revents;
+
+	ret = stream__splice_run(sp);
+	if (ret > 0)
+		lem_queue(T, ret);
+}
+
+static void
+stream_splice_w_cb(EV_P_ struct ev_io *w, int revents)
+{
+	struct stream_splice *sp = w->data;
+	lua_State *T = sp->T;
+	int ret;
+
+	(void)EV_A;
+	(void)revents;
+
+	ret = stream__splice_run(sp);
+	if (ret > 0)
+		lem_queue(T, ret);
+}
+
+/* called by stream:close() on a stream in use */
+static void
+stream__splice_abort(struct stream_splice *sp)
+{
+	lua_State *T = sp->T;
+
+	sp->err = 0;
+	lem_queue(T, stream__splice_finish(sp, SPLICE_ERROR));
+}
+
+static int
+stream__splice_init(lua_State *T, struct stream_splice *sp,
+		struct stream *src, struct stream *dst, size_t max)
+{
+	sp->T = T;
+	sp->src = src;
+	sp->dst = dst;
+	sp->peer = NULL;
+	sp->max = max;
+	sp->moved = 0;
+	sp->inpipe = 0;
+	sp->err = 0;
+	sp->closesrc = 0;
+	sp->closedst = 0;
+#ifdef __linux__
+	if (pipe2(sp->pipe, O_NONBLOCK | O_CLOEXEC))
+		return errno;
+#else
+	sp->buf = lem_xmalloc(SPLICE_CHUNK);
+	sp->off = 0;
+#endif
+
+	src->r.data = sp;
+	src->r.cb = stream_splice_r_cb;
+	dst->w.data = sp;
+	dst->w.cb = stream_splice_w_cb;
+	return 0;
+}
+
+static int
+stream_splice(lua_State *T)
+{
+	struct stream *src;
+	struct stream *dst;
+	struct stream_splice *sp;
+	lua_Integer max;
+	int err;
+	int ret;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	luaL_checktype(T, 2, LUA_TUSERDATA);
+	max = luaL_optinteger(T, 3, -1);
+	luaL_argcheck(T, max == -1 || max > 0, 3,
+			"not an integer in proper range");
+	lua_getmetatable(T, 1);
+	lua_getmetatable(T, 2);
+	luaL_argcheck(T, lua_rawequal(T, -1, -2), 2, "expected stream");
+	lua_settop(T, 2);
+
+	src = lua_touserdata(T, 1);
+	dst = lua_touserdata(T, 2);
+	if (!src->open || !dst->open)
+		return io_closed(T);
+	if (src->r.data != NULL || dst->w.data != NULL)
+		return io_busy(T);
+
+	sp = lem_xmalloc(sizeof(struct stream_splice));
+	sp->idx = 0;
+	err = stream__splice_init(T, sp, src, dst,
+			max < 0 ? (size_t)-1 : (size_t)max);
+	if (err) {
+		free(sp);
+		return io_strerror(T, err);
+	}
+
+	ret = stream__splice_run(sp);
+	if (ret > 0)
+		return ret;
+
+	return lua_yield(T, 2);
+}
+
+static int
+io_proxy(lua_State *T)
+{
+	struct stream *a;
+	struct stream *b;
+	struct stream_splice *sp;
+	int err;
+	int ret;
+
+	luaL_checktype(T, 1, LUA_TUSERDATA);
+	luaL_checktype(T, 2, LUA_TUSERDATA);
+	lua_getmetatable(T, 1);
+	luaL_argcheck(T, lua_rawequal(T, -1, lua_upvalueindex(1)), 1,
+			"expected stream");
+	lua_getmetatable(T, 2);
+	luaL_argcheck(T, lua_rawequal(T, -1, lua_upvalueindex(1)), 2,
+			"expected stream");
+	lua_settop(T, 2);
+
+	a = lua_touserdata(T, 1);
+	b = lua_touserdata(T, 2);
+	luaL_argcheck(T, a != b, 2, "cannot proxy a stream to itself");
+	if (!a->open || !b->open)
+		return io_closed(T);
+	if (a->r.data != NULL || a->w.data != NULL ||
+			b->r.data != NULL || b->w.data != NULL)
+		return io_busy(T);
+
+	sp = lem_xmalloc(2 * sizeof(struct stream_splice));
+	sp[0].idx = 0;
+	sp[1].idx = 1;
+	err = stream__splice_init(T, &sp[0], a, b, (size_t)-1);
+	if (err == 0) {
+		err = stream__splice_init(T, &sp[1], b, a, (size_t)-1);
+		if (err) {
+			sp[0].peer = NULL;
+			stream__splice_stop(&sp[0]);
+		}
+	} else {
+		a->r.data = NULL;
+		b->w.data = NULL;
+	}
+	if (err) {
+		free(sp);
+		return io_strerror(T, err);
+	}
+	sp[0].peer = &sp[1];
+	sp[1].peer = &sp[0];
+
+	ret = stream__splice_run(&sp[0]);
+	if (ret > 0)
+		return ret;
+	ret = stream__splice_run(&sp[1]);
+	if (ret > 0)
+		return ret;
+
+	return lua_yield(T, 2);
+}
+
 static int
 stream_fileno(lua_State *T)
 {
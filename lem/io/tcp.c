@@ -208,7 +208,8 @@ tcp_connect(lua_State *T)
 		g->bind_port = 0;
 	}
 
-	lem_async_do(&g->a, tcp_connect_work, tcp_connect_reap);
+	lem_async_do_lane(&g->a, LEM_LANE_NET,
+			tcp_connect_work, tcp_connect_reap);
 
 	lua_settop(T, 2);
 	lua_pushvalue(T, lua_upvalueindex(1));
@@ -355,7 +356,8 @@ tcp_listen(lua_State *T, int family)
 	g->service = service;
 	g->sock = family;
 	g->err = backlog;
-	lem_async_do(&g->a, tcp_listen_work, tcp_listen_reap);
+	lem_async_do_lane(&g->a, LEM_LANE_NET,
+			tcp_listen_work, tcp_listen_reap);
 
 	lua_settop(T, 2);
 	lua_pushvalue(T, lua_upvalueindex(1));
@@ -163,7 +163,8 @@ udp_connect(lua_State *T)
 	g->service = service;
 	g->sock = family;
 	g->broadcast = broadcast;
-	lem_async_do(&g->a, udp_connect_work, udp_connect_reap);
+	lem_async_do_lane(&g->a, LEM_LANE_NET,
+			udp_connect_work, udp_connect_reap);
 
 	lua_settop(T, 2);
 	lua_pushvalue(T, lua_upvalueindex(1));
@@ -309,7 +310,8 @@ udp_listen(lua_State *T, int family)
 	g->sock = family;
 	g->broadcast = broadcast;
 
-	lem_async_do(&g->a, udp_listen_work, udp_listen_reap);
+	lem_async_do_lane(&g->a, LEM_LANE_NET,
+			udp_listen_work, udp_listen_reap);
 
 	lua_settop(T, 2);
 	lua_pushvalue(T, lua_upvalueindex(1));
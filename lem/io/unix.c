@@ -117,7 +117,8 @@ unix_connect(lua_State *T)
 	u->T = T;
 	u->path = path;
 	u->len = len;
-	lem_async_do(&u->a, unix_connect_work, unix_connect_reap);
+	lem_async_do_lane(&u->a, LEM_LANE_NET,
+			unix_connect_work, unix_connect_reap);
 
 	lua_settop(T, 1);
 	lua_pushvalue(T, lua_upvalueindex(1));
@@ -308,7 +309,8 @@ unix_listen(lua_State *T)
 	u->len = len;
 	u->sock = perm;
 	u->err = backlog;
-	lem_async_do(&u->a, unix_listen_work, unix_listen_reap);
+	lem_async_do_lane(&u->a, LEM_LANE_NET,
+			unix_listen_work, unix_listen_reap);
 
 	lua_settop(T, 1);
 	lua_pushvalue(T, lua_upvalueindex(1));
@@ -532,7 +534,8 @@ unix_passfd_send_cb(EV_P_ ev_io *w, int revents)
 	struct pfhandle *pf = w->data;
 	(void) revents;
 
-	lem_async_do(&pf->a, unix_passfd_send_work, unix_passfd_send_reap);
+	lem_async_do_lane(&pf->a, LEM_LANE_NET,
+			unix_passfd_send_work, unix_passfd_send_reap);
 	ev_io_stop(EV_A_ w);
 }
 
@@ -542,7 +545,8 @@ unix_passfd_recv_cb(EV_P_ ev_io *w, int revents)
 	struct pfhandle *pf = w->data;
 	(void) revents;
 
-	lem_async_do(&pf->a, unix_passfd_recv_work, unix_passfd_recv_reap);
+	lem_async_do_lane(&pf->a, LEM_LANE_NET,
+			unix_passfd_recv_work, unix_passfd_recv_reap);
 	ev_io_stop(EV_A_ w);
 }
 
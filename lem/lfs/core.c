@@ -897,5 +897,20 @@ luaopen_lem_lfs_core(lua_State *L)
 	lua_pushcfunction(L, lfs_basename);
 	lua_setfield(L, -2, "basename");
 
+	/* name pool jobs for utils.poolstats() */
+	lem_async_name(lfs_dir_work, "lfs.dir");
+	lem_async_name(lfs_dir_next_work, "lfs.dir.next");
+	lem_async_name(lfs_chdir_work, "lfs.chdir");
+	lem_async_name(lfs_mkdir_work, "lfs.mkdir");
+	lem_async_name(lfs_rmdir_work, "lfs.rmdir");
+	lem_async_name(lfs_remove_work, "lfs.remove");
+	lem_async_name(lfs_link_work, "lfs.link");
+	lem_async_name(lfs_symlink_work, "lfs.symlink");
+	lem_async_name(lfs_readlink_work, "lfs.readlink");
+	lem_async_name(lfs_rename_work, "lfs.rename");
+	lem_async_name(lfs_stat_work, "lfs.attributes");
+	lem_async_name(lfs_lstat_work, "lfs.symlinkattributes");
+	lem_async_name(lfs_touch_work, "lfs.touch");
+
 	return 1;
 }
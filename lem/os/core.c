@@ -121,7 +121,8 @@ os_waitpid(lua_State *T)
 	g->pid = pid;
 	g->options = options;
 
-	lem_async_do(&g->a, os_waitpid_work, os_waitpid_reap);
+	lem_async_do_lane(&g->a, LEM_LANE_BLOCKING,
+			os_waitpid_work, os_waitpid_reap);
 
 	lua_settop(T, 0);
 	return lua_yield(T, 0);
@@ -237,5 +238,8 @@ luaopen_lem_os_core(lua_State *L)
 	
 	lua_setfield(L, -2, "waitpid_options");
 
+	/* name pool jobs for utils.poolstats() */
+	lem_async_name(os_waitpid_work, "os.waitpid");
+
 	return 1;
 }
@@ -16,10 +16,40 @@
  * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdint.h>
+#include <limits.h>
+#include <string.h>
 #include <lem-parsers.h>
 
 #define LEM_PSTATE_CHECK(x) LEM_BUILD_ASSERT(sizeof(x) < LEM_INPUTBUF_PSIZE)
 
+/*
+ * reads of up to this many bytes grow the input buffer to hold
+ * everything, so the data is read straight into place with large
+ * read() calls and only the final string is created
+ */
+#define PARSE_DIRECT_MAX (256*1024*1024)
+
+/* move unread data to the front and make room for size bytes */
+static int
+parse_reserve(struct lem_inputbuf *b, size_t size)
+{
+	unsigned int len = b->end - b->start;
+
+	if (size > PARSE_DIRECT_MAX)
+		return -1;
+
+	if (b->start > 0) {
+		memmove(b->buf, b->buf + b->start, len);
+		b->start = 0;
+		b->end = len;
+	}
+
+	if (size <= b->size)
+		return 0;
+	return lem_inputbuf_resize(b, size);
+}
+
 /*
  * read available data
  */
@@ -75,7 +105,10 @@ parse_target_process(lua_State *T, struct lem_inputbuf *b)
 		return 1;
 	}
 
-	if (b->end == LEM_INPUTBUF_SIZE) {
+	if (b->start + s->target > b->size)
+		(void)parse_reserve(b, s->target);
+
+	if (b->end == b->size) {
 		lua_pushlstring(T, b->buf + b->start, size);
 		s->parts++;
 		if (s->parts == LUA_MINSTACK-2) {
@@ -94,6 +127,152 @@ static const struct lem_parser parser_target = {
 	.process = parse_target_process,
 };
 
+/*
+ * read a length prefixed frame
+ *
+ * the prefix is a 2, 4 or 8 byte big or little endian
+ * integer or an unsigned LEB128 varint. once it is parsed
+ * the payload is read just like a target read
+ */
+enum parse_frame_kind {
+	FRAME_U16BE,
+	FRAME_U16LE,
+	FRAME_U32BE,
+	FRAME_U32LE,
+	FRAME_U64BE,
+	FRAME_U64LE,
+	FRAME_VARINT,
+};
+
+#define FRAME_HEADERMAX 10 /* longest varint */
+
+struct parse_frame_state {
+	struct parse_target_state t; /* must be first */
+	unsigned int max;
+	unsigned char kind;
+	unsigned char header;
+	unsigned char payload;
+};
+LEM_PSTATE_CHECK(struct parse_frame_state);
+
+static void
+parse_frame_init(lua_State *T, struct lem_inputbuf *b, enum parse_frame_kind kind)
+{
+	struct parse_frame_state *s = (struct parse_frame_state *)&b->pstate;
+	lua_Integer max = luaL_optinteger(T, 3, 0);
+
+	luaL_argcheck(T, max >= 0 && max <= UINT_MAX, 3,
+			"not an integer in proper range");
+	s->t.parts = 0;
+	s->max = max;
+	s->kind = kind;
+	s->header = lua_toboolean(T, 4);
+	s->payload = 0;
+	lua_settop(T, 2);
+}
+
+/* returns the size of the header, 0 if incomplete and -1 if invalid */
+static int
+parse_frame_header(enum parse_frame_kind kind,
+		const unsigned char *p, unsigned int avail, uint64_t *len)
+{
+	static const unsigned char width[] = { 2, 2, 4, 4, 8, 8 };
+	uint64_t v = 0;
+	unsigned int n;
+	unsigned int i;
+
+	if (kind == FRAME_VARINT) {
+		for (i = 0; i < avail; i++) {
+			if (i == 9 && p[i] > 1)
+				return -1; /* more than 64 bits */
+			v |= (uint64_t)(p[i] & 0x7F) << (7*i);
+			if ((p[i] & 0x80) == 0) {
+				*len = v;
+				return i + 1;
+			}
+		}
+		return 0;
+	}
+
+	n = width[kind];
+	if (avail < n)
+		return 0;
+
+	if (kind & 1) {
+		for (i = n; i > 0; i--)
+			v = (v << 8) | p[i-1];
+	} else {
+		for (i = 0; i < n; i++)
+			v = (v << 8) | p[i];
+	}
+
+	*len = v;
+	return n;
+}
+
+static int
+parse_frame_process(lua_State *T, struct lem_inputbuf *b)
+{
+	struct parse_frame_state *s = (struct parse_frame_state *)&b->pstate;
+
+	if (!s->payload) {
+		uint64_t len;
+		int ret = parse_frame_header(s->kind,
+				(unsigned char *)b->buf + b->start,
+				b->end - b->start, &len);
+
+		if (ret == 0) {
+			if (b->start + FRAME_HEADERMAX > b->size)
+				(void)parse_reserve(b, FRAME_HEADERMAX);
+			return 0;
+		}
+
+		if (ret < 0 || len > SIZE_MAX ||
+				(s->max > 0 && len > s->max)) {
+			/* leave the frame in the buffer */
+			lua_settop(T, 0);
+			lua_pushnil(T);
+			if (ret < 0)
+				lua_pushliteral(T, "invalid frame");
+			else
+				lua_pushliteral(T, "frame too large");
+			return 2;
+		}
+
+		b->start += ret;
+		s->t.target = (size_t)len;
+		s->payload = 1;
+	}
+
+	if (parse_target_process(T, b) == 0)
+		return 0;
+
+	if (s->header) {
+		lua_pushinteger(T, (lua_Integer)lua_objlen(T, -1));
+		return 2;
+	}
+	return 1;
+}
+
+#define FRAME_PARSER(name, kind) \
+static void \
+parse_##name##_init(lua_State *T, struct lem_inputbuf *b) \
+{ \
+	parse_frame_init(T, b, kind); \
+} \
+static const struct lem_parser parser_##name = { \
+	.init    = parse_##name##_init, \
+	.process = parse_frame_process, \
+}
+
+FRAME_PARSER(u16be, FRAME_U16BE);
+FRAME_PARSER(u16le, FRAME_U16LE);
+FRAME_PARSER(u32be, FRAME_U32BE);
+FRAME_PARSER(u32le, FRAME_U32LE);
+FRAME_PARSER(u64be, FRAME_U64BE);
+FRAME_PARSER(u64le, FRAME_U64LE);
+FRAME_PARSER(varint, FRAME_VARINT);
+
 /*
  * read all data until stream closes
  */
@@ -109,6 +288,10 @@ parse_all_init(lua_State *T, struct lem_inputbuf *b)
 
 	s->parts = 0;
 	lua_settop(T, 2);
+
+	/* room for the rest of a file and a last read returning 0 */
+	if (b->hint > 0)
+		(void)parse_reserve(b, b->end - b->start + b->hint + 1);
 }
 
 static int
@@ -116,9 +299,9 @@ parse_all_process(lua_State *T, struct lem_inputbuf *b)
 {
 	struct parse_all_state *s = (struct parse_all_state *)&b->pstate;
 
-	if (b->end == LEM_INPUTBUF_SIZE) {
+	if (b->end == b->size && parse_reserve(b, 2*(size_t)b->size)) {
 		lua_pushlstring(T, b->buf + b->start,
-				LEM_INPUTBUF_SIZE - b->start);
+				b->size - b->start);
 		s->parts++;
 		if (s->parts == LUA_MINSTACK-2) {
 			lua_concat(T, LUA_MINSTACK-2);
@@ -158,10 +341,18 @@ static const struct lem_parser parser_all = {
 
 /*
  * read a line
+ *
+ * the delimiter may be up to PARSE_LINE_DELIMMAX bytes.
+ * scanning resumes where the last call left off, so data
+ * arriving in small pieces is only looked at once
  */
+#define PARSE_LINE_DELIMMAX 16
+
 struct parse_line_state {
-	int parts;
-	char stopbyte;
+	unsigned int off;  /* bytes after b->start already scanned */
+	unsigned char parts;
+	unsigned char len;
+	char delim[PARSE_LINE_DELIMMAX];
 };
 LEM_PSTATE_CHECK(struct parse_line_state);
 
@@ -169,41 +360,80 @@ static void
 parse_line_init(lua_State *T, struct lem_inputbuf *b)
 {
 	struct parse_line_state *s = (struct parse_line_state *)&b->pstate;
-	const char *stopbyte = luaL_optstring(T, 3, "\n");
+	size_t len;
+	const char *delim = luaL_optlstring(T, 3, "\n", &len);
 
+	luaL_argcheck(T, len > 0 && len <= PARSE_LINE_DELIMMAX, 3,
+			"invalid delimiter");
 	s->parts = 0;
-	s->stopbyte = stopbyte[0];
+	s->off = 0;
+	s->len = len;
+	memcpy(s->delim, delim, len);
 	lua_settop(T, 2);
 }
 
+/* memchr() is vectorised in any libc worth its salt,
+ * longer delimiters are found by checking each match
+ * of the first byte */
+static const char *
+parse_line_find(const char *p, const char *end,
+		const char *delim, unsigned int len)
+{
+	if (len == 1)
+		return memchr(p, delim[0], end - p);
+
+	end -= len - 1;
+	while (p < end) {
+		p = memchr(p, delim[0], end - p);
+		if (p == NULL)
+			return NULL;
+		if (memcmp(p + 1, delim + 1, len - 1) == 0)
+			return p;
+		p++;
+	}
+	return NULL;
+}
+
 static int
 parse_line_process(lua_State *T, struct lem_inputbuf *b)
 {
 	struct parse_line_state *s = (struct parse_line_state *)&b->pstate;
-	unsigned int i;
+	const char *p = parse_line_find(b->buf + b->start + s->off,
+			b->buf + b->end, s->delim, s->len);
+	unsigned int keep;
 
-	for (i = b->start; i < b->end; i++) {
-		if (b->buf[i] == s->stopbyte) {
-			lua_pushlstring(T, b->buf + b->start, i - b->start);
-			lua_concat(T, s->parts + 1);
-			i++;
-			if (i == b->end)
-				b->start = b->end = 0;
-			else
-				b->start = i;
-			return 1;
-		}
+	if (p != NULL) {
+		unsigned int i = p - b->buf;
+
+		lua_pushlstring(T, b->buf + b->start, i - b->start);
+		lua_concat(T, s->parts + 1);
+		i += s->len;
+		if (i == b->end)
+			b->start = b->end = 0;
+		else
+			b->start = i;
+		return 1;
 	}
 
-	if (b->end == LEM_INPUTBUF_SIZE) {
-		lua_pushlstring(T, b->buf + b->start,
-				LEM_INPUTBUF_SIZE - b->start);
+	/* a delimiter may start in the last len-1 bytes */
+	keep = s->len - 1;
+	if (b->end - b->start > keep)
+		s->off = b->end - b->start - keep;
+	else
+		s->off = 0;
+
+	if (b->end == b->size) {
+		lua_pushlstring(T, b->buf + b->start, s->off);
 		s->parts++;
 		if (s->parts == LUA_MINSTACK-2) {
 			lua_concat(T, LUA_MINSTACK-2);
 			s->parts = 1;
 		}
-		b->start = b->end = 0;
+		b->start += s->off;
+		b->end -= b->start;
+		memmove(b->buf, b->buf + b->start, b->end);
+		b->start = 0;
+		s->off = 0;
 	}
 
 	return 0;
@@ -214,6 +444,67 @@ static const struct lem_parser parser_line = {
 	.process = parse_line_process,
 };
 
+/*
+ * read all complete lines in the buffer, at least one
+ */
+struct parse_lines_state {
+	struct parse_line_state l; /* must be first */
+	unsigned int max;
+};
+LEM_PSTATE_CHECK(struct parse_lines_state);
+
+static void
+parse_lines_init(lua_State *T, struct lem_inputbuf *b)
+{
+	struct parse_lines_state *s = (struct parse_lines_state *)&b->pstate;
+	lua_Integer max = luaL_optinteger(T, 3, 0);
+
+	luaL_argcheck(T, max >= 0 && max <= INT_MAX, 3,
+			"not an integer in proper range");
+	s->max = max;
+	/* the delimiter is the next argument */
+	if (lua_gettop(T) >= 3)
+		lua_remove(T, 3);
+	parse_line_init(T, b);
+}
+
+static int
+parse_lines_process(lua_State *T, struct lem_inputbuf *b)
+{
+	struct parse_lines_state *s = (struct parse_lines_state *)&b->pstate;
+	unsigned int n = 1;
+
+	/* wait for the first line like '*l' does */
+	if (parse_line_process(T, b) == 0)
+		return 0;
+
+	lua_createtable(T, 16, 0);
+	lua_insert(T, -2);
+	lua_rawseti(T, -2, 1);
+
+	while (b->end > 0 && (s->max == 0 || n < s->max)) {
+		const char *start = b->buf + b->start;
+		const char *p = parse_line_find(start, b->buf + b->end,
+				s->l.delim, s->l.len);
+
+		if (p == NULL)
+			break;
+
+		lua_pushlstring(T, start, p - start);
+		lua_rawseti(T, -2, ++n);
+		b->start = p - b->buf + s->l.len;
+		if (b->start == b->end)
+			b->start = b->end = 0;
+	}
+
+	return 1;
+}
+
+static const struct lem_parser parser_lines = {
+	.init    = parse_lines_init,
+	.process = parse_lines_process,
+};
+
 int
 luaopen_lem_parsers_core(lua_State *L)
 {
@@ -221,7 +512,7 @@ luaopen_lem_parsers_core(lua_State *L)
 	lua_newtable(L);
 
 	/* create lookup table */
-	lua_createtable(L, 0, 4);
+	lua_createtable(L, 0, 12);
 	/* push parser_line */
 	lua_pushlightuserdata(L, (void *)&parser_available);
 	lua_setfield(L, -2, "available");
@@ -234,6 +525,24 @@ luaopen_lem_parsers_core(lua_State *L)
 	/* push parser_line */
 	lua_pushlightuserdata(L, (void *)&parser_line);
 	lua_setfield(L, -2, "*l");
+	/* push parser_lines */
+	lua_pushlightuserdata(L, (void *)&parser_lines);
+	lua_setfield(L, -2, "*L");
+	/* push framing parsers */
+	lua_pushlightuserdata(L, (void *)&parser_u16be);
+	lua_setfield(L, -2, "u16be");
+	lua_pushlightuserdata(L, (void *)&parser_u16le);
+	lua_setfield(L, -2, "u16le");
+	lua_pushlightuserdata(L, (void *)&parser_u32be);
+	lua_setfield(L, -2, "u32be");
+	lua_pushlightuserdata(L, (void *)&parser_u32le);
+	lua_setfield(L, -2, "u32le");
+	lua_pushlightuserdata(L, (void *)&parser_u64be);
+	lua_setfield(L, -2, "u64be");
+	lua_pushlightuserdata(L, (void *)&parser_u64le);
+	lua_setfield(L, -2, "u64le");
+	lua_pushlightuserdata(L, (void *)&parser_varint);
+	lua_setfield(L, -2, "varint");
 	/* insert lookup table */
 	lua_setfield(L, -2, "lookup");
 
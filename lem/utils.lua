@@ -132,11 +132,6 @@ lem_utils.usleep = function (t)
 	lem_utils.sleep(t/1000.)
 end
 
-lem_utils.sleep = function (t)
-	local sleeper = lem_utils.newsleeper(t)
-	sleeper:sleep(t)
-end
-
 do
 	-- Tony serializer
 	-- http://lua-users.org/lists/lua-l/2009-11/msg00533.html
@@ -249,6 +244,64 @@ do
 	end
 end
 
+do
+	-- run f(...) on a pool thread of the 'user' lane and return its
+	-- results. f travels with serialize(), so its upvalues and the
+	-- arguments and results must be plain data. worker states cache
+	-- loaded functions, so changes f makes to its upvalues persist
+	-- on that worker. at most `limit` calls are handed to the pool
+	-- at once, further callers wait their turn
+	local offloadcode = lem_utils.offloadcode
+	local serialize = lem_utils.serialize
+	local load = compatshim.load
+	local pcall, select, type = pcall, select, type
+
+	local limit, running = 64, 0
+	local waiting, first, last = {}, 1, 0
+
+	function lem_utils.offloadconfig(n)
+		if type(n) ~= 'number' or n < 1 or n % 1 ~= 0 then
+			error('bad argument #1 to offloadconfig (integer >= 1 expected)', 2)
+		end
+		limit = n
+	end
+
+	function lem_utils.offload(f, ...)
+		if type(f) ~= 'function' then
+			return nil, 'not a function'
+		end
+
+		local ok, fcode = pcall(serialize, f)
+		if not ok then return nil, fcode end
+		local ok, acode = pcall(serialize, { n = select('#', ...), ... })
+		if not ok then return nil, acode end
+
+		if running < limit then
+			running = running + 1
+		else
+			last = last + 1
+			waiting[last] = thisthread()
+			-- the slot is handed over by the finishing call
+			lem_utils.suspend()
+		end
+
+		local ok, res = offloadcode(fcode, acode)
+
+		if first <= last then
+			local t = waiting[first]
+			waiting[first] = nil
+			first = first + 1
+			resume(t)
+		else
+			running = running - 1
+		end
+
+		if not ok then return nil, res end
+		res = load(res)()
+		return table_unpack(res, 1, res.n)
+	end
+end
+
 return lem_utils
 
 -- vim: ts=2 sw=2 noet:
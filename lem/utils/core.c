@@ -17,33 +17,52 @@
  */
 
 #include <sys/time.h>
+#include <pthread.h>
 #include <lem.h>
+#include <lualib.h>
+#include <lem-channel.h>
+#include <lem-parsers.h>
 #include <stdint.h>
+#include <limits.h>
 #include <stdlib.h>
 
+struct sleeper {
+	struct lem_timer t;
+	lua_State *T;
+};
+
+/* functions that touch the event loop or the main Lua state
+ * must not be called from states on pool threads */
+static void
+utils_checkloop(lua_State *T)
+{
+	if (!lem_on_loop_thread())
+		(void)luaL_error(T, "only available on the event loop thread");
+}
+
 static int
 sleeper_wakeup(lua_State *T)
 {
-	struct ev_timer *w;
+	struct sleeper *s;
 	lua_State *S;
 	int nargs;
 
 	luaL_checktype(T, 1, LUA_TUSERDATA);
-	w = lua_touserdata(T, 1);
-	S = w->data;
+	s = lua_touserdata(T, 1);
+	S = s->T;
 	if (S == NULL) {
 		lua_pushnil(T);
 		lua_pushliteral(T, "not sleeping");
 		return 2;
 	}
 
-	ev_timer_stop(LEM_ w);
+	lem_timer_stop(&s->t);
 
 	nargs = lua_gettop(T) - 1;
 	lua_settop(S, 0);
 	lua_xmove(T, S, nargs);
 	lem_queue(S, nargs);
-	w->data = NULL;
+	s->T = NULL;
 
 	/* return true */
 	lua_pushboolean(T, 1);
@@ -51,26 +70,24 @@ sleeper_wakeup(lua_State *T)
 }
 
 static void
-sleep_handler(EV_P_ struct ev_timer *w, int revents)
+sleep_handler(struct lem_timer *t)
 {
-	lua_State *T = w->data;
-
-	(void)revents;
-	(void)EV_A;
+	struct sleeper *s = (struct sleeper *)t;
+	lua_State *T = s->T;
 
 	/* return nil, "timeout" */
 	lem_queue(T, 2);
-	w->data = NULL;
+	s->T = NULL;
 }
 
 static int
 sleeper_sleep(lua_State *T)
 {
-	struct ev_timer *w;
+	struct sleeper *s;
 
 	luaL_checktype(T, 1, LUA_TUSERDATA);
-	w = lua_touserdata(T, 1);
-	if (w->data != NULL) {
+	s = lua_touserdata(T, 1);
+	if (s->T != NULL) {
 		lua_pushnil(T);
 		lua_pushliteral(T, "busy");
 		return 2;
@@ -89,11 +106,10 @@ sleeper_sleep(lua_State *T)
 			return lua_yield(T, 2);
 		}
 
-		ev_timer_set(w, delay, 0);
-		ev_timer_start(LEM_ w);
+		lem_timer_start(&s->t, delay);
 	}
 
-	w->data = T;
+	s->T = T;
 
 	/* yield sleeper, nil, "timeout" */
 	lua_settop(T, 1);
@@ -105,16 +121,272 @@ sleeper_sleep(lua_State *T)
 static int
 sleeper_new(lua_State *T)
 {
-	struct ev_timer *w;
+	struct sleeper *s;
+
+	utils_checkloop(T);
 
 	/* create new sleeper object and set metatable */
-	w = lua_newuserdata(T, sizeof(struct ev_timer));
+	s = lua_newuserdata(T, sizeof(struct sleeper));
 	lua_pushvalue(T, lua_upvalueindex(1));
 	lua_setmetatable(T, -2);
 
-	ev_init(w, sleep_handler);
-	w->data = NULL;
+	lem_timer_init(&s->t, sleep_handler);
+	s->T = NULL;
+
+	return 1;
+}
+
+/*
+ * utils.sleep() doesn't need a sleeper object,
+ * so recycle plain timers through a free list
+ */
+struct sleep {
+	struct lem_timer t;
+	lua_State *T;
+	struct sleep *next;
+};
+
+static struct sleep *sleep_free;
+
+static void
+utils_sleep_handler(struct lem_timer *t)
+{
+	struct sleep *s = (struct sleep *)t;
+
+	lem_queue(s->T, 0);
+	s->next = sleep_free;
+	sleep_free = s;
+}
+
+static int
+utils_sleep(lua_State *T)
+{
+	struct sleep *s;
+	ev_tstamp delay;
+
+	utils_checkloop(T);
+
+	/* no timeout means sleep forever */
+	if (lua_isnoneornil(T, 1))
+		return lua_yield(T, 0);
+
+	delay = (ev_tstamp)luaL_checknumber(T, 1);
+	if (delay <= 0) {
+		lem_queue(T, 0);
+		return lua_yield(T, 0);
+	}
+
+	s = sleep_free;
+	if (s != NULL)
+		sleep_free = s->next;
+	else {
+		s = lem_xmalloc(sizeof(struct sleep));
+		lem_timer_init(&s->t, utils_sleep_handler);
+	}
+	s->T = T;
+	lem_timer_start(&s->t, delay);
+
+	return lua_yield(T, 0);
+}
+
+static int
+utils_timerwheel(lua_State *T)
+{
+	ev_tstamp granularity = (ev_tstamp)luaL_optnumber(T, 1, 0);
+
+	utils_checkloop(T);
+	luaL_argcheck(T, granularity >= 0, 1, "negative granularity");
+	if (lem_timerwheel_config(granularity)) {
+		lua_pushnil(T);
+		lua_pushliteral(T, "busy");
+		return 2;
+	}
+
+	lua_pushboolean(T, 1);
+	return 1;
+}
+
+/*
+ * bounded channels
+ */
+static int
+channel_closed(lua_State *T)
+{
+	lua_pushnil(T);
+	lua_pushliteral(T, "closed");
+	return 2;
+}
+
+static int
+channel_gc(lua_State *T)
+{
+	lem_channel_free(T, lua_touserdata(T, 1));
+	return 0;
+}
+
+static int
+channel_put(lua_State *T)
+{
+	struct lem_channel *ch = luaL_checkudata(T, 1, LEM_CHANNEL_MT);
+
+	luaL_argcheck(T, !lua_isnoneornil(T, 2), 2, "value expected");
+	lua_settop(T, 2);
+	switch (lem_channel_tryput(T, ch)) {
+	case LEM_CHANNEL_OK:
+		lua_pushboolean(T, 1);
+		return 1;
+	case LEM_CHANNEL_CLOSED:
+		return channel_closed(T);
+	}
+
+	/* full, yield with the value on top */
+	lem_channel_wait(ch, T);
+	return lua_yield(T, 2);
+}
+
+static int
+channel_try_put(lua_State *T)
+{
+	struct lem_channel *ch = luaL_checkudata(T, 1, LEM_CHANNEL_MT);
+
+	luaL_argcheck(T, !lua_isnoneornil(T, 2), 2, "value expected");
+	lua_settop(T, 2);
+	switch (lem_channel_tryput(T, ch)) {
+	case LEM_CHANNEL_OK:
+		lua_pushboolean(T, 1);
+		return 1;
+	case LEM_CHANNEL_CLOSED:
+		return channel_closed(T);
+	}
+
+	lua_pushnil(T);
+	lua_pushliteral(T, "full");
+	return 2;
+}
+
+static int
+channel_get(lua_State *T)
+{
+	struct lem_channel *ch = luaL_checkudata(T, 1, LEM_CHANNEL_MT);
+
+	lua_settop(T, 1);
+	switch (lem_channel_tryget(T, ch)) {
+	case LEM_CHANNEL_OK:
+		return 1;
+	case LEM_CHANNEL_CLOSED:
+		return channel_closed(T);
+	}
+
+	lem_channel_wait(ch, T);
+	return lua_yield(T, 1);
+}
+
+static int
+channel_try_get(lua_State *T)
+{
+	struct lem_channel *ch = luaL_checkudata(T, 1, LEM_CHANNEL_MT);
+
+	lua_settop(T, 1);
+	switch (lem_channel_tryget(T, ch)) {
+	case LEM_CHANNEL_OK:
+		return 1;
+	case LEM_CHANNEL_CLOSED:
+		return channel_closed(T);
+	}
+
+	lua_pushnil(T);
+	lua_pushliteral(T, "empty");
+	return 2;
+}
+
+static int
+channel_get_many(lua_State *T)
+{
+	struct lem_channel *ch = luaL_checkudata(T, 1, LEM_CHANNEL_MT);
+	lua_Integer max = luaL_optinteger(T, 2, ch->cap);
+	int n;
+
+	luaL_argcheck(T, max > 0 && max <= INT_MAX, 2,
+			"not an integer in proper range");
+
+	lua_settop(T, 1);
+	switch (lem_channel_tryget(T, ch)) {
+	case LEM_CHANNEL_AGAIN:
+		/* block for the first value only */
+		lem_channel_wait(ch, T);
+		return lua_yield(T, 1);
+	case LEM_CHANNEL_CLOSED:
+		return channel_closed(T);
+	}
+
+	for (n = 1; n < max; n++) {
+		luaL_checkstack(T, 4, NULL);
+		if (lem_channel_tryget(T, ch) != LEM_CHANNEL_OK)
+			break;
+	}
+
+	return n;
+}
+
+static int
+channel_close(lua_State *T)
+{
+	struct lem_channel *ch = luaL_checkudata(T, 1, LEM_CHANNEL_MT);
+
+	if (ch->closed)
+		return channel_closed(T);
+
+	lem_channel_close(ch);
+	lua_pushboolean(T, 1);
+	return 1;
+}
+
+static int
+channel_isclosed(lua_State *T)
+{
+	struct lem_channel *ch = luaL_checkudata(T, 1, LEM_CHANNEL_MT);
+
+	lua_pushboolean(T, ch->closed);
+	return 1;
+}
+
+static int
+channel_len(lua_State *T)
+{
+	struct lem_channel *ch = luaL_checkudata(T, 1, LEM_CHANNEL_MT);
+
+	lua_pushinteger(T, ch->len);
+	return 1;
+}
+
+static int
+channel_cap(lua_State *T)
+{
+	struct lem_channel *ch = luaL_checkudata(T, 1, LEM_CHANNEL_MT);
+
+	lua_pushinteger(T, ch->cap);
+	return 1;
+}
+
+static int
+channel_waiting(lua_State *T)
+{
+	struct lem_channel *ch = luaL_checkudata(T, 1, LEM_CHANNEL_MT);
+
+	lua_pushinteger(T, lem_channel_waiting(ch));
+	return 1;
+}
+
+static int
+utils_newchannel(lua_State *T)
+{
+	lua_Integer cap = luaL_checkinteger(T, 1);
+
+	utils_checkloop(T);
+	luaL_argcheck(T, cap > 0 && cap <= INT_MAX, 1,
+			"not an integer in proper range");
 
+	lem_channel_new(T, (unsigned int)cap);
 	return 1;
 }
 
@@ -124,6 +396,7 @@ utils_spawn(lua_State *T)
 	lua_State *S;
 	int nargs;
 
+	utils_checkloop(T);
 	luaL_checktype(T, 1, LUA_TFUNCTION);
 
 	S = lem_newthread();
@@ -140,6 +413,7 @@ utils_spawn(lua_State *T)
 static int
 utils_yield(lua_State *T)
 {
+	utils_checkloop(T);
 	lem_queue(T, 0);
 	return lua_yield(T, 0);
 }
@@ -148,6 +422,8 @@ static int
 utils_exit(lua_State *T)
 {
 	int status = (int)luaL_checknumber(T, 1);
+
+	utils_checkloop(T);
 	lem_exit(status);
 	return lua_yield(T, 0);
 }
@@ -162,6 +438,7 @@ utils_thisthread(lua_State *T)
 static int
 utils_suspend(lua_State *T)
 {
+	utils_checkloop(T);
 	return lua_yield(T, 0);
 }
 
@@ -171,6 +448,7 @@ utils_resume(lua_State *T)
 	int args;
 	lua_State *S;
 
+	utils_checkloop(T);
 	luaL_checktype(T, 1, LUA_TTHREAD);
 	S = lua_tothread(T, 1);
 
@@ -191,6 +469,7 @@ utils_now(lua_State *T)
 static int
 utils_updatenow(lua_State *T)
 {
+	utils_checkloop(T);
 	ev_now_update(LEM);
 	lua_pushnumber(T, (lua_Number)ev_now(LEM));
 	return 1;
@@ -203,6 +482,7 @@ utils_poolconfig(lua_State *T)
 	int delay;
 	int min;
 	int max;
+	int lane;
 
 	n = luaL_checknumber(T, 1);
 	delay = (int)n;
@@ -216,11 +496,405 @@ utils_poolconfig(lua_State *T)
 	max = (int)n;
 	luaL_argcheck(T, (lua_Number)max == n && max > 0 && max >= min,
 			3, "not an integer in proper range");
+	lane = luaL_checkoption(T, 4, "fs", lem_lane_names);
+
+	(void)lem_async_lane_config(lane, delay, min, max);
+	return 0;
+}
+
+static int
+utils_poolaffinity(lua_State *T)
+{
+	int enable;
+	int lane;
+
+	luaL_checkany(T, 1);
+	enable = lua_toboolean(T, 1);
+	lane = luaL_checkoption(T, 2, "fs", lem_lane_names);
+
+	(void)lem_async_lane_affinity(lane, enable);
+	return 0;
+}
+
+static void
+utils_pushhistogram(lua_State *T, const unsigned long *hist)
+{
+	int i;
+
+	lua_createtable(T, LEM_POOL_HISTSIZE, 0);
+	for (i = 0; i < LEM_POOL_HISTSIZE; i++) {
+		lua_pushnumber(T, (lua_Number)hist[i]);
+		lua_rawseti(T, -2, i + 1);
+	}
+}
+
+static int
+utils_poolstats(lua_State *T)
+{
+	struct lem_pool_lane_stats lanes[LEM_LANES];
+	struct lem_pool_job_stats *jobs;
+	unsigned long spawned = 0;
+	unsigned long exited = 0;
+	unsigned int n;
+	unsigned int i;
+
+	lem_pool_getstats(lanes);
+
+	lua_createtable(T, 0, 4);
+	lua_createtable(T, 0, LEM_LANES);
+	for (i = 0; i < LEM_LANES; i++) {
+		lua_createtable(T, 0, 7);
+		lua_pushnumber(T, (lua_Number)lanes[i].spawned);
+		lua_setfield(T, -2, "spawned");
+		lua_pushnumber(T, (lua_Number)lanes[i].exited);
+		lua_setfield(T, -2, "exited");
+		lua_pushinteger(T, lanes[i].threads);
+		lua_setfield(T, -2, "threads");
+		lua_pushinteger(T, lanes[i].idle);
+		lua_setfield(T, -2, "idle");
+		lua_pushinteger(T, lanes[i].jobs);
+		lua_setfield(T, -2, "jobs");
+		lua_pushinteger(T, lanes[i].queued);
+		lua_setfield(T, -2, "queued");
+		lua_pushinteger(T, lanes[i].maxqueued);
+		lua_setfield(T, -2, "maxqueued");
+		lua_setfield(T, -2, lem_lane_names[i]);
+		spawned += lanes[i].spawned;
+		exited += lanes[i].exited;
+	}
+	lua_setfield(T, -2, "lanes");
+	lua_pushnumber(T, (lua_Number)spawned);
+	lua_setfield(T, -2, "spawned");
+	lua_pushnumber(T, (lua_Number)exited);
+	lua_setfield(T, -2, "exited");
+
+	/* jobs[name] = { jobs = n, wait = { ... }, service = { ... } }
+	 * where wait[i] and service[i] count jobs taking less than
+	 * 2^(i-1) us */
+	jobs = lem_xmalloc((LEM_POOL_JOBTYPES + 1) *
+			sizeof(struct lem_pool_job_stats));
+	n = lem_pool_getjobstats(jobs, LEM_POOL_JOBTYPES + 1);
+	lua_createtable(T, 0, n);
+	for (i = 0; i < n; i++) {
+		if (jobs[i].name != NULL)
+			lua_pushstring(T, jobs[i].name);
+		else
+			lua_pushfstring(T, "%p", (void *)jobs[i].work);
+		lua_createtable(T, 0, 3);
+		lua_pushnumber(T, (lua_Number)jobs[i].jobs);
+		lua_setfield(T, -2, "jobs");
+		utils_pushhistogram(T, jobs[i].wait);
+		lua_setfield(T, -2, "wait");
+		utils_pushhistogram(T, jobs[i].service);
+		lua_setfield(T, -2, "service");
+		lua_rawset(T, -3);
+	}
+	free(jobs);
+	lua_setfield(T, -2, "jobs");
+	return 1;
+}
+
+/*
+ * utils.poolping(n[, batch[, lane]]) runs n empty jobs on the
+ * pool, submitted batch at a time with lem_async_run_batch(),
+ * or one by one if batch is 1, and returns n once all are reaped.
+ * it measures the cost of the pool itself
+ */
+struct ping;
+
+struct ping_job {
+	struct lem_async a;
+	struct ping *p;
+};
+
+struct ping {
+	lua_State *T;
+	unsigned int n;
+	unsigned int left;
+	struct ping_job jobs[];
+};
+
+static void
+ping_work(struct lem_async *a)
+{
+	(void)a;
+}
 
-	lem_async_config(delay, min, max);
+static void
+ping_reap(struct lem_async *a)
+{
+	struct ping *p = ((struct ping_job *)a)->p;
+	lua_State *T = p->T;
+
+	if (--p->left > 0)
+		return;
+
+	lua_pushinteger(T, p->n);
+	free(p);
+	lem_queue(T, 1);
+}
+
+static int
+utils_poolping(lua_State *T)
+{
+	lua_Number n;
+	unsigned int count;
+	unsigned int batch;
+	int lane;
+	struct ping *p;
+	struct lem_async **jobs;
+	unsigned int i;
+
+	utils_checkloop(T);
+	n = luaL_checknumber(T, 1);
+	count = (unsigned int)n;
+	luaL_argcheck(T, (lua_Number)count == n && count > 0 &&
+			count <= 1000000, 1, "not an integer in proper range");
+	n = luaL_optnumber(T, 2, 1);
+	batch = (unsigned int)n;
+	luaL_argcheck(T, (lua_Number)batch == n && batch > 0,
+			2, "not an integer in proper range");
+	lane = luaL_checkoption(T, 3, "fs", lem_lane_names);
+	if (batch > count)
+		batch = count;
+
+	p = lem_xmalloc(sizeof(struct ping) + count * sizeof(struct ping_job));
+	p->T = T;
+	p->n = p->left = count;
+	for (i = 0; i < count; i++) {
+		struct lem_async *a = &p->jobs[i].a;
+
+		/* not through lem_async_do(), so set up everything */
+		a->work = ping_work;
+		a->reap = ping_reap;
+		a->lane = lane;
+		a->worker = 0;
+		p->jobs[i].p = p;
+	}
+
+	if (batch == 1) {
+		for (i = 0; i < count; i++)
+			lem_async_run(&p->jobs[i].a);
+	} else {
+		jobs = lem_xmalloc(batch * sizeof(struct lem_async *));
+		for (i = 0; i < count; i += batch) {
+			unsigned int m = count - i < batch ? count - i : batch;
+			unsigned int j;
+
+			for (j = 0; j < m; j++)
+				jobs[j] = &p->jobs[i + j].a;
+			lem_async_run_batch(jobs, m);
+		}
+		free(jobs);
+	}
+
+	lua_settop(T, 0);
+	return lua_yield(T, 0);
+}
+
+static int
+utils_runqueueconfig(lua_State *T)
+{
+	lua_Number n;
+	int batch;
+	ev_tstamp budget;
+
+	n = luaL_checknumber(T, 1);
+	batch = (int)n;
+	luaL_argcheck(T, (lua_Number)batch == n && batch >= 0,
+			1, "not an integer in proper range");
+	budget = (ev_tstamp)luaL_optnumber(T, 2, 0);
+	luaL_argcheck(T, budget >= 0, 2, "negative budget");
+
+	lem_runqueue_config(batch, budget);
 	return 0;
 }
 
+static int
+utils_runqueuestats(lua_State *T)
+{
+	struct lem_runqueue_stats st;
+
+	lem_runqueue_getstats(&st);
+
+	lua_createtable(T, 0, 4);
+	lua_pushnumber(T, (lua_Number)st.iterations);
+	lua_setfield(T, -2, "iterations");
+	lua_pushnumber(T, (lua_Number)st.resumed);
+	lua_setfield(T, -2, "resumed");
+	lua_pushnumber(T, (lua_Number)st.overruns);
+	lua_setfield(T, -2, "overruns");
+	lua_pushnumber(T, (lua_Number)st.maxbatch);
+	lua_setfield(T, -2, "maxbatch");
+	return 1;
+}
+
+static int
+utils_threadcacheconfig(lua_State *T)
+{
+	lua_Number n;
+	int cap;
+
+	n = luaL_checknumber(T, 1);
+	cap = (int)n;
+	luaL_argcheck(T, (lua_Number)cap == n && cap >= 0,
+			1, "not an integer in proper range");
+
+	lem_threadcache_config(cap);
+	return 0;
+}
+
+static int
+utils_threadcachestats(lua_State *T)
+{
+	struct lem_threadcache_stats st;
+
+	lem_threadcache_getstats(&st);
+
+	lua_createtable(T, 0, 6);
+	lua_pushnumber(T, (lua_Number)st.hits);
+	lua_setfield(T, -2, "hits");
+	lua_pushnumber(T, (lua_Number)st.misses);
+	lua_setfield(T, -2, "misses");
+	lua_pushnumber(T, (lua_Number)st.recycled);
+	lua_setfield(T, -2, "recycled");
+	lua_pushnumber(T, (lua_Number)st.dropped);
+	lua_setfield(T, -2, "dropped");
+	lua_pushnumber(T, (lua_Number)st.size);
+	lua_setfield(T, -2, "size");
+	lua_pushnumber(T, (lua_Number)st.cap);
+	lua_setfield(T, -2, "cap");
+	return 1;
+}
+
+static int
+utils_inputbufstats(lua_State *T)
+{
+	struct lem_inputbuf_stats st;
+
+	lem_inputbuf_getstats(&st);
+
+	lua_createtable(T, 0, 7);
+	lua_pushnumber(T, (lua_Number)st.hits);
+	lua_setfield(T, -2, "hits");
+	lua_pushnumber(T, (lua_Number)st.misses);
+	lua_setfield(T, -2, "misses");
+	lua_pushnumber(T, (lua_Number)st.buffers);
+	lua_setfield(T, -2, "buffers");
+	lua_pushnumber(T, (lua_Number)st.resident);
+	lua_setfield(T, -2, "resident");
+	lua_pushnumber(T, (lua_Number)st.pooled);
+	lua_setfield(T, -2, "pooled");
+	lua_pushnumber(T, (lua_Number)st.cap);
+	lua_setfield(T, -2, "cap");
+	lua_pushnumber(T, (lua_Number)st.size);
+	lua_setfield(T, -2, "size");
+	return 1;
+}
+
+static int
+utils_idlegc(lua_State *T)
+{
+	lua_Number n;
+	int kb;
+	ev_tstamp budget;
+	ev_tstamp quiet;
+
+	if (lua_isnoneornil(T, 1) || lua_toboolean(T, 1) == 0) {
+		lem_idlegc_config(0, 0, 0, 0);
+		return 0;
+	}
+
+	n = luaL_checknumber(T, 1);
+	kb = (int)n;
+	luaL_argcheck(T, (lua_Number)kb == n && kb >= 0,
+			1, "not an integer in proper range");
+	budget = (ev_tstamp)luaL_optnumber(T, 2, 0);
+	luaL_argcheck(T, budget >= 0, 2, "negative budget");
+	quiet = (ev_tstamp)luaL_optnumber(T, 3, 0);
+	luaL_argcheck(T, quiet >= 0, 3, "negative delay");
+
+	lem_idlegc_config(1, kb, budget, quiet);
+	return 0;
+}
+
+static int
+utils_gcmode(lua_State *T)
+{
+	static const char *const modenames[] = {
+		"incremental", "generational", NULL };
+	int prev;
+
+	prev = lem_gc_setmode(luaL_checkoption(T, 1, NULL, modenames));
+	if (prev < 0) {
+		lua_pushnil(T);
+		lua_pushliteral(T, "not supported");
+		return 2;
+	}
+
+	lua_pushstring(T, modenames[prev]);
+	return 1;
+}
+
+static int
+utils_gcstats(lua_State *T)
+{
+	struct lem_gc_stats st;
+	int i;
+
+	lem_idlegc_getstats(&st);
+
+	lua_createtable(T, 0, 4);
+	lua_pushnumber(T, (lua_Number)st.steps);
+	lua_setfield(T, -2, "steps");
+	lua_pushnumber(T, (lua_Number)st.cycles);
+	lua_setfield(T, -2, "cycles");
+	lua_pushnumber(T, (lua_Number)st.maxpause);
+	lua_setfield(T, -2, "maxpause");
+	/* pauses[i] = number of steps taking less than 2^(i-1) us */
+	lua_createtable(T, LEM_GC_HISTSIZE, 0);
+	for (i = 0; i < LEM_GC_HISTSIZE; i++) {
+		lua_pushnumber(T, (lua_Number)st.pauses[i]);
+		lua_rawseti(T, -2, i + 1);
+	}
+	lua_setfield(T, -2, "pauses");
+	return 1;
+}
+
+static int
+utils_allocstats(lua_State *T)
+{
+	struct lem_alloc_stats st;
+	int i;
+
+	if (lem_alloc_getstats(&st)) {
+		lua_pushnil(T);
+		lua_pushliteral(T, "not using the slab allocator");
+		return 2;
+	}
+
+	lua_createtable(T, 0, 3);
+	lua_createtable(T, LEM_ALLOC_CLASSES, 0);
+	for (i = 0; i < LEM_ALLOC_CLASSES; i++) {
+		lua_createtable(T, 0, 4);
+		lua_pushinteger(T, (i + 1) * LEM_ALLOC_GRANULE);
+		lua_setfield(T, -2, "size");
+		lua_pushnumber(T, (lua_Number)st.classes[i].allocs);
+		lua_setfield(T, -2, "allocs");
+		lua_pushnumber(T, (lua_Number)st.classes[i].inuse);
+		lua_setfield(T, -2, "inuse");
+		lua_pushnumber(T, (lua_Number)st.classes[i].slabs);
+		lua_setfield(T, -2, "slabs");
+		lua_rawseti(T, -2, i + 1);
+	}
+	lua_setfield(T, -2, "classes");
+	lua_pushnumber(T, (lua_Number)st.large_allocs);
+	lua_setfield(T, -2, "large_allocs");
+	lua_pushnumber(T, (lua_Number)st.large_inuse);
+	lua_setfield(T, -2, "large_inuse");
+	return 1;
+}
+
 static size_t
 fast_szstr(const char *in_str, size_t len, char *out_str)
 {
@@ -348,6 +1022,8 @@ utils_szstr(lua_State *T)
 	return 1;
 }
 
+#include "offload.c"
+
 int
 luaopen_lem_utils_core(lua_State *L)
 {
@@ -370,6 +1046,56 @@ luaopen_lem_utils_core(lua_State *L)
 	lua_pushcclosure(L, sleeper_new, 1);
 	lua_setfield(L, -2, "newsleeper");
 
+	/* set sleep function */
+	lua_pushcfunction(L, utils_sleep);
+	lua_setfield(L, -2, "sleep");
+	/* set timerwheel function */
+	lua_pushcfunction(L, utils_timerwheel);
+	lua_setfield(L, -2, "timerwheel");
+
+	/* create channel metatable */
+	luaL_newmetatable(L, LEM_CHANNEL_MT);
+	/* mt.__index = mt */
+	lua_pushvalue(L, -1);
+	lua_setfield(L, -2, "__index");
+	/* mt.__gc = <channel_gc> */
+	lua_pushcfunction(L, channel_gc);
+	lua_setfield(L, -2, "__gc");
+	/* mt.put = <channel_put> */
+	lua_pushcfunction(L, channel_put);
+	lua_setfield(L, -2, "put");
+	/* mt.try_put = <channel_try_put> */
+	lua_pushcfunction(L, channel_try_put);
+	lua_setfield(L, -2, "try_put");
+	/* mt.get = <channel_get> */
+	lua_pushcfunction(L, channel_get);
+	lua_setfield(L, -2, "get");
+	/* mt.try_get = <channel_try_get> */
+	lua_pushcfunction(L, channel_try_get);
+	lua_setfield(L, -2, "try_get");
+	/* mt.get_many = <channel_get_many> */
+	lua_pushcfunction(L, channel_get_many);
+	lua_setfield(L, -2, "get_many");
+	/* mt.close = <channel_close> */
+	lua_pushcfunction(L, channel_close);
+	lua_setfield(L, -2, "close");
+	/* mt.closed = <channel_isclosed> */
+	lua_pushcfunction(L, channel_isclosed);
+	lua_setfield(L, -2, "closed");
+	/* mt.len = <channel_len> */
+	lua_pushcfunction(L, channel_len);
+	lua_setfield(L, -2, "len");
+	/* mt.cap = <channel_cap> */
+	lua_pushcfunction(L, channel_cap);
+	lua_setfield(L, -2, "cap");
+	/* mt.waiting = <channel_waiting> */
+	lua_pushcfunction(L, channel_waiting);
+	lua_setfield(L, -2, "waiting");
+	lua_pop(L, 1);
+	/* set newchannel function */
+	lua_pushcfunction(L, utils_newchannel);
+	lua_setfield(L, -2, "newchannel");
+
 	/* set spawn function */
 	lua_pushcfunction(L, utils_spawn);
 	lua_setfield(L, -2, "spawn");
@@ -402,10 +1128,60 @@ luaopen_lem_utils_core(lua_State *L)
 	/* set poolconfig function */
 	lua_pushcfunction(L, utils_poolconfig);
 	lua_setfield(L, -2, "poolconfig");
+	/* set poolaffinity function */
+	lua_pushcfunction(L, utils_poolaffinity);
+	lua_setfield(L, -2, "poolaffinity");
+
+	/* set poolstats function */
+	lua_pushcfunction(L, utils_poolstats);
+	lua_setfield(L, -2, "poolstats");
+	/* set poolping function */
+	lua_pushcfunction(L, utils_poolping);
+	lua_setfield(L, -2, "poolping");
+
+	/* set runqueueconfig function */
+	lua_pushcfunction(L, utils_runqueueconfig);
+	lua_setfield(L, -2, "runqueueconfig");
+	/* set runqueuestats function */
+	lua_pushcfunction(L, utils_runqueuestats);
+	lua_setfield(L, -2, "runqueuestats");
+
+	/* set threadcacheconfig function */
+	lua_pushcfunction(L, utils_threadcacheconfig);
+	lua_setfield(L, -2, "threadcacheconfig");
+	/* set threadcachestats function */
+	lua_pushcfunction(L, utils_threadcachestats);
+	lua_setfield(L, -2, "threadcachestats");
+
+	/* set inputbufstats function */
+	lua_pushcfunction(L, utils_inputbufstats);
+	lua_setfield(L, -2, "inputbufstats");
+
+	/* set idlegc function */
+	lua_pushcfunction(L, utils_idlegc);
+	lua_setfield(L, -2, "idlegc");
+	/* set gcmode function */
+	lua_pushcfunction(L, utils_gcmode);
+	lua_setfield(L, -2, "gcmode");
+	/* set gcstats function */
+	lua_pushcfunction(L, utils_gcstats);
+	lua_setfield(L, -2, "gcstats");
+
+	/* set allocstats function */
+	lua_pushcfunction(L, utils_allocstats);
+	lua_setfield(L, -2, "allocstats");
+
+	/* set offloadcode function */
+	lua_pushcfunction(L, utils_offloadcode);
+	lua_setfield(L, -2, "offloadcode");
 
 	/* a lua quote escape string */
 	lua_pushcfunction(L, utils_szstr);
 	lua_setfield(L, -2, "szstr");
 
+	/* name pool jobs for utils.poolstats() */
+	lem_async_name(offload_work, "utils.offload");
+	lem_async_name(ping_work, "utils.poolping");
+
 	return 1;
 }
@@ -0,0 +1,272 @@
+/*
+ * This file is part of LEM, a Lua Event Machine.
+ *
+ * LEM is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU Lesser General Public License as
+ * published by the Free Software Foundation, either version 3 of
+ * the License, or (at your option) any later version.
+ *
+ * LEM is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+
+/*
+ * utils.offloadcode(fcode, acode) runs a serialized function on its
+ * serialized arguments in a Lua state of one of the pool threads of
+ * the user lane, and returns true and the serialized results, or nil
+ * and an error message. see utils.offload() in lem/utils.lua.
+ *
+ * every pool thread keeps its state until it exits, so modules it
+ * required stay loaded, and the functions loaded from a given code
+ * string are cached, upvalues and all.
+ *
+ * worker states only get a restricted lem.utils with the serializer,
+ * as everything else in it needs the event loop. for the same reason
+ * the C modules of lem can't be loaded there at all, as they would
+ * submit jobs and queue threads from a pool thread.
+ */
+#define OFFLOAD_CACHE_MAX 64
+
+/* slots on the stack of a worker state */
+#define OFFLOAD_RUN   1
+#define OFFLOAD_CACHE 2
+#define OFFLOAD_COUNT 3
+
+struct offload {
+	struct lem_async a;
+	lua_State *T;
+	const char *fcode;
+	size_t flen;
+	const char *acode;
+	size_t alen;
+	const char *path;
+	const char *cpath;
+	char *res;
+	size_t rlen;
+	int ok;
+};
+
+static const char offload_boot[] =
+	"local searchers = package.searchers or package.loaders\n"
+	"table.insert(searchers, 3, function(name)\n"
+	"	if name:match('^lem%.') then\n"
+	"		error(\"module '\" .. name .. \"' needs the event loop and \"\n"
+	"			.. \"can't be loaded in an offloaded function\", 0)\n"
+	"	end\n"
+	"	return nil\n"
+	"end)\n"
+	"local full = require 'lem.utils'\n"
+	"local utils = {\n"
+	"	serialize = full.serialize,\n"
+	"	unserialize = full.unserialize,\n"
+	"	szstr = full.szstr,\n"
+	"}\n"
+	"package.loaded['lem.utils'] = utils\n"
+	"require 'lem.json'\n"
+	"local serialize, select = utils.serialize, select\n"
+	"local unpack = table.unpack or unpack\n"
+	"local function pack(...)\n"
+	"	return { n = select('#', ...), ... }\n"
+	"end\n"
+	"return function(f, args)\n"
+	"	return serialize(pack(f(unpack(args, 1, args.n))))\n"
+	"end\n";
+
+/* the lem.utils.core of worker states */
+static int
+offload_open_core(lua_State *L)
+{
+	lua_newtable(L);
+	lua_pushcfunction(L, utils_szstr);
+	lua_setfield(L, -2, "szstr");
+	return 1;
+}
+
+static pthread_key_t offload_key;
+static pthread_once_t offload_once = PTHREAD_ONCE_INIT;
+
+static void
+offload_close(void *L)
+{
+	lua_close(L);
+}
+
+static void
+offload_key_init(void)
+{
+	(void)pthread_key_create(&offload_key, offload_close);
+}
+
+static void
+offload_result(struct offload *o, lua_State *L, int ok)
+{
+	const char *s;
+	size_t len;
+
+	s = lua_tolstring(L, -1, &len);
+	if (s == NULL) {
+		s = "(error object is not a string)";
+		len = strlen(s);
+	}
+	o->res = lem_xmalloc(len);
+	memcpy(o->res, s, len);
+	o->rlen = len;
+	o->ok = ok;
+}
+
+/* the state of this thread, or NULL with the error in o */
+static lua_State *
+offload_state(struct offload *o)
+{
+	lua_State *L;
+
+	(void)pthread_once(&offload_once, offload_key_init);
+	L = pthread_getspecific(offload_key);
+	if (L != NULL)
+		return L;
+
+	L = luaL_newstate();
+	if (L == NULL) {
+		o->res = NULL;
+		o->rlen = 0;
+		o->ok = 0;
+		return NULL;
+	}
+	luaL_openlibs(L);
+#if LUA_VERSION_NUM >= 502
+	luaL_requiref(L, "lem.utils.core", offload_open_core, 0);
+	lua_pop(L, 1);
+#else
+	lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+	(void)offload_open_core(L);
+	lua_setfield(L, -2, "lem.utils.core");
+	lua_pop(L, 1);
+#endif
+
+	lua_getglobal(L, "package");
+	lua_pushstring(L, o->path);
+	lua_setfield(L, -2, "path");
+	lua_pushstring(L, o->cpath);
+	lua_setfield(L, -2, "cpath");
+	lua_pop(L, 1);
+
+	if (luaL_loadbuffer(L, offload_boot, sizeof(offload_boot) - 1,
+				"=offload") || lua_pcall(L, 0, 1, 0)) {
+		offload_result(o, L, 0);
+		lua_close(L);
+		return NULL;
+	}
+	lua_newtable(L);
+	lua_pushinteger(L, 0);
+
+	(void)pthread_setspecific(offload_key, L);
+	return L;
+}
+
+static void
+offload_work(struct lem_async *a)
+{
+	struct offload *o = (struct offload *)a;
+	lua_State *L = offload_state(o);
+	lua_Integer count;
+
+	if (L == NULL)
+		return;
+
+	/* look up the function, or load and cache it */
+	lua_pushlstring(L, o->fcode, o->flen);
+	lua_pushvalue(L, -1);
+	lua_rawget(L, OFFLOAD_CACHE);
+	if (lua_isnil(L, -1)) {
+		lua_pop(L, 1);
+		if (luaL_loadbuffer(L, o->fcode, o->flen, "=offload") ||
+				lua_pcall(L, 0, 1, 0))
+			goto error;
+
+		count = lua_tointeger(L, OFFLOAD_COUNT) + 1;
+		if (count > OFFLOAD_CACHE_MAX) {
+			lua_newtable(L);
+			lua_replace(L, OFFLOAD_CACHE);
+			count = 1;
+		}
+		lua_pushinteger(L, count);
+		lua_replace(L, OFFLOAD_COUNT);
+
+		lua_pushvalue(L, -2);
+		lua_pushvalue(L, -2);
+		lua_rawset(L, OFFLOAD_CACHE);
+	}
+	lua_remove(L, -2);
+
+	lua_pushvalue(L, OFFLOAD_RUN);
+	lua_insert(L, -2);
+	if (luaL_loadbuffer(L, o->acode, o->alen, "=offload") ||
+			lua_pcall(L, 0, 1, 0))
+		goto error;
+	if (lua_pcall(L, 2, 1, 0))
+		goto error;
+
+	offload_result(o, L, 1);
+	lua_settop(L, OFFLOAD_COUNT);
+	return;
+error:
+	offload_result(o, L, 0);
+	lua_settop(L, OFFLOAD_COUNT);
+}
+
+static void
+offload_reap(struct lem_async *a)
+{
+	struct offload *o = (struct offload *)a;
+	lua_State *T = o->T;
+
+	if (o->ok)
+		lua_pushboolean(T, 1);
+	else
+		lua_pushnil(T);
+	if (o->res != NULL)
+		lua_pushlstring(T, o->res, o->rlen);
+	else
+		lua_pushliteral(T, "out of memory");
+
+	free(o->res);
+	free(o);
+	lem_queue(T, 2);
+}
+
+static int
+utils_offloadcode(lua_State *T)
+{
+	struct offload *o;
+
+	utils_checkloop(T);
+	luaL_checktype(T, 1, LUA_TSTRING);
+	luaL_checktype(T, 2, LUA_TSTRING);
+	lua_settop(T, 2);
+
+	/* new worker states look for modules where we do */
+	lua_getglobal(T, "package");
+	lua_getfield(T, 3, "path");
+	lua_getfield(T, 3, "cpath");
+
+	o = lem_xmalloc(sizeof(struct offload));
+	o->T = T;
+	o->fcode = lua_tolstring(T, 1, &o->flen);
+	o->acode = lua_tolstring(T, 2, &o->alen);
+	o->path = lua_tostring(T, 4);
+	o->cpath = lua_tostring(T, 5);
+	if (o->path == NULL)
+		o->path = "";
+	if (o->cpath == NULL)
+		o->cpath = "";
+	o->res = NULL;
+	lem_async_do_lane(&o->a, LEM_LANE_USER, offload_work, offload_reap);
+
+	return lua_yield(T, 5);
+}
@@ -0,0 +1,52 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+-- run with LEM_ALLOCATOR=slab to use the size-class allocator
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local utils = require 'lem.utils'
+
+local format = string.format
+
+local t = utils.updatenow()
+for i = 1, 20 do
+	local garbage = {}
+	for j = 1, 50000 do
+		garbage[j] = { j, tostring(j), string.rep('x', j % 300) }
+	end
+end
+collectgarbage()
+print(format('%.3fs', utils.updatenow() - t))
+
+local st, err = utils.allocstats()
+if not st then
+	print(err)
+	return
+end
+
+print(' size      allocs     inuse  slabs  util')
+for _, c in ipairs(st.classes) do
+	if c.allocs > 0 then
+		print(format('%5d %11d %9d %6d %4.0f%%', c.size, c.allocs, c.inuse,
+			c.slabs, 100 * c.inuse * c.size / (c.slabs * 65536)))
+	end
+end
+print(format('large: %d allocs, %d bytes in use', st.large_allocs, st.large_inuse))
+
+-- vim: syntax=lua ts=2 sw=2 noet:
@@ -0,0 +1,123 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+-- Check read('*L') and compare reading lines one by one with
+-- reading them in batches.
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local format = string.format
+local n = tonumber(arg[1]) or 1000000
+
+local line = string.rep('l', 60)
+
+local function feed(s)
+	local batch = string.rep(line .. '\n', 1000)
+	utils.spawn(function()
+		for i = 1, n, 1000 do
+			assert(s:write(batch))
+		end
+		assert(s:close())
+	end)
+end
+
+local function bench(name, read)
+	local s1, s2 = assert(io.unix.socketpair())
+	feed(s1)
+	local t = utils.updatenow()
+	local count = read(s2)
+	t = utils.updatenow() - t
+	assert(count == n, format('%s: %d lines', name, count))
+	print(format('%-12s %9.0f lines/s', name, n / t))
+end
+
+utils.spawn(function()
+	local s1, s2 = assert(io.unix.socketpair())
+
+	assert(s1:write('a\nb\nc\nd'))
+	local lines = assert(s2:read('*L'))
+	assert(#lines == 3 and lines[1] == 'a' and lines[3] == 'c')
+	utils.spawn(function() assert(s1:write('\ne\r\nf\r\ng')) end)
+	lines = assert(s2:read('*L', 1))
+	assert(#lines == 1 and lines[1] == 'd')
+	lines = assert(s2:read('*L', nil, '\r\n'))
+	assert(#lines == 2 and lines[1] == 'e' and lines[2] == 'f')
+	assert(s1:close())
+	local ok, err = s2:read('*L')
+	assert(ok == nil and err == 'closed', err)
+
+	-- leaving a lines() loop early keeps the rest of the stream
+	s1, s2 = assert(io.unix.socketpair())
+	assert(s1:write('header\n\nbody 1\nbody 2\n'))
+	assert(s1:close())
+	for l in s2:lines() do
+		if l == '' then break end
+		assert(l == 'header')
+	end
+	assert(s2:read('*l') == 'body 1')
+	assert(s2:read('*l') == 'body 2')
+	assert(s2:close())
+
+	-- io.lines() owns its file, so it reads batches
+	local name = os.tmpname()
+	local file = assert(io.open(name, 'w'))
+	assert(file:write('one\ntwo\nthree\n'))
+	assert(file:close())
+	local t = {}
+	for l in io.lines(name) do t[#t+1] = l end
+	assert(#t == 3 and t[1] == 'one' and t[3] == 'three')
+	os.remove(name)
+
+	bench("read('*l')", function(s)
+		local count = 0
+		while true do
+			local l = s:read('*l')
+			if not l then break end
+			assert(l == line)
+			count = count + 1
+		end
+		return count
+	end)
+
+	bench("read('*L')", function(s)
+		local count = 0
+		while true do
+			local ls = s:read('*L')
+			if not ls then break end
+			for i = 1, #ls do
+				assert(ls[i] == line)
+			end
+			count = count + #ls
+		end
+		return count
+	end)
+
+	bench('lines()', function(s)
+		local count = 0
+		for l in s:lines() do
+			assert(l == line)
+			count = count + 1
+		end
+		return count
+	end)
+end)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
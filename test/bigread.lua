@@ -0,0 +1,85 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- Time large stream:read(n), stream:read('*a') and file:read('*a')
+-- calls and count the read syscalls they take (Linux only).
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local stdio = io
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local format = string.format
+local size = (tonumber(arg[1]) or 64) * 1024 * 1024
+
+local function syscr()
+	local f = stdio.open('/proc/self/io')
+	if not f then return 0 end
+	local c = f:read('*a'):match('syscr:%s*(%d+)')
+	f:close()
+	return tonumber(c)
+end
+
+local chunk = {}
+for i = 1, 4096 do chunk[i] = format('%15d\n', i) end
+chunk = table.concat(chunk)
+local expect = string.rep(chunk, size / #chunk)
+
+local function bench(name, read)
+	local before = syscr()
+	local t = utils.updatenow()
+	local data = read()
+	t = utils.updatenow() - t
+	local calls = syscr() - before
+	assert(#data == size, format('%s: got %d bytes', name, #data))
+	assert(data == expect, name .. ': garbled data')
+	print(format('%-18s %4d MB in %.3fs, %7.1f MB/s, %6d reads',
+		name, size / 1048576, t, size / 1048576 / t, calls))
+end
+
+local function feed(s)
+	utils.spawn(function()
+		for i = 1, size / #chunk do
+			assert(s:write(chunk))
+		end
+		assert(s:close())
+	end)
+end
+
+utils.spawn(function()
+	local s1, s2 = assert(io.unix.socketpair())
+	feed(s1)
+	bench('stream:read(n)', function() return assert(s2:read(size)) end)
+	assert(s2:read() == nil)
+
+	s1, s2 = assert(io.unix.socketpair())
+	feed(s1)
+	bench("stream:read('*a')", function() return assert(s2:read('*a')) end)
+
+	local name = os.tmpname()
+	local file = assert(io.open(name, 'w'))
+	assert(file:write(expect))
+	assert(file:close())
+	file = assert(io.open(name))
+	bench("file:read('*a')", function() return assert(file:read('*a')) end)
+	assert(file:close())
+	os.remove(name)
+
+	-- the grown buffers are gone again
+	assert(utils.inputbufstats().resident < 1024 * 1024)
+end)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
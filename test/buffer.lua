@@ -0,0 +1,166 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- Exercise lem.buffer objects: packing, views, readinto() and
+-- writing buffers, then compare reading a stream into one buffer
+-- with reading it as Lua strings.
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local utils  = require 'lem.utils'
+local io     = require 'lem.io'
+local buffer = require 'lem.buffer'
+
+local format = string.format
+local size = (tonumber(arg[1]) or 64) * 1024 * 1024
+
+-- basics
+local b = buffer.new('hello')
+assert(#b == 5 and tostring(b) == 'hello')
+b:append(', ', buffer.new('world'))
+assert(b:tostring() == 'hello, world')
+assert(b:tostring(-5) == 'world')
+assert(b:byte(1) == 104)
+assert(select('#', b:byte(1, -1)) == 12)
+assert(b:find('world') == 8)
+assert(b:find('o', 6) == 9)
+assert(b:find('nope') == nil)
+
+-- views share memory until one of them is written to
+local v = b:sub(8, 12)
+assert(tostring(v) == 'world')
+b:setlen(7)
+b:append('there')
+assert(tostring(v) == 'world' and tostring(b) == 'hello, there')
+v:clear()
+v:append('moon')
+assert(tostring(v) == 'moon' and tostring(b) == 'hello, there')
+v = b:sub(1, 5)
+v:append('!')
+assert(tostring(v) == 'hello!' and tostring(b) == 'hello, there')
+
+-- sizes are checked
+assert(not pcall(buffer.new, -1))
+assert(not pcall(buffer.new, math.maxinteger))
+
+-- binary packing, compatible with string.pack()
+local p = buffer.new()
+p:pack('>I2 <i4 B s1 z d', 513, -2, 255, 'abc', 'zero', 1.5)
+assert(p:tostring() == string.pack('>I2 <i4 B s1 z d', 513, -2, 255, 'abc', 'zero', 1.5))
+local a, c, d, e, f, g = p:unpack('>I2 <i4 B')
+assert(a == 513 and c == -2 and d == 255)
+assert(p:pos() == 8)
+e, f, g = p:unpack('s1 z d')
+assert(e == 'abc' and f == 'zero' and g == 1.5)
+assert(p:remaining() == 0)
+assert(p:unpack('>I2', 1) == 513)
+assert(not pcall(p.unpack, p, 'd'))
+
+utils.spawn(function()
+	-- readinto() and writes from buffers
+	local s1, s2 = assert(io.unix.socketpair())
+	local msg = buffer.new('ping')
+	assert(s1:write(msg, ' ', msg))
+	local r = buffer.new()
+	local n = 0
+	while n < 9 do n = n + assert(s2:readinto(r)) end
+	assert(tostring(r) == 'ping ping')
+
+	-- buffered input is handed out first
+	assert(s1:write('line\nrest'))
+	assert(s2:read('*l') == 'line')
+	r:clear()
+	assert(s2:readinto(r, 2) == 2 and tostring(r) == 're')
+	assert(s2:readinto(r) == 2 and tostring(r) == 'rest')
+	assert(s1:close())
+	local ok, err = s2:readinto(r)
+	assert(ok == nil and err == 'closed')
+
+	-- files
+	local name = os.tmpname()
+	local file = assert(io.open(name, 'w'))
+	assert(file:write(msg, buffer.new(' pong')))
+	assert(file:close())
+	file = assert(io.open(name))
+	r:clear()
+	assert(file:readinto(r, 4) == 4 and tostring(r) == 'ping')
+	assert(file:readinto(r) == 5 and tostring(r) == 'ping pong')
+	ok, err = file:readinto(r)
+	assert(ok == nil and err == 'eof')
+	assert(file:close())
+	os.remove(name)
+
+	-- a buffer waiting to be written can't change length
+	s1, s2 = assert(io.unix.socketpair())
+	local big = buffer.new(string.rep('x', 8 * 1024 * 1024))
+	local done = false
+	utils.spawn(function()
+		assert(s1:write(big))
+		done = true
+	end)
+	utils.yield()
+	assert(not done)
+	assert(not pcall(big.append, big, 'y'))
+	r = buffer.new()
+	while #r < #big do assert(s2:readinto(r, 1024 * 1024)) end
+	utils.yield()
+	assert(done)
+	big:append('y')
+	assert(r:tostring() == big:tostring(1, -2))
+	s1:close()
+	s2:close()
+
+	-- throughput
+	local chunk = string.rep('0123456789abcdef', 4096)
+	local function feed(s)
+		utils.spawn(function()
+			for i = 1, size / #chunk do
+				assert(s:write(chunk))
+			end
+			assert(s:close())
+		end)
+	end
+
+	local function bench(name, read)
+		local s1, s2 = assert(io.unix.socketpair())
+		feed(s1)
+		local t = utils.updatenow()
+		local got = read(s2)
+		t = utils.updatenow() - t
+		assert(got == size, format('%s: got %d bytes', name, got))
+		print(format('%-18s %4d MB in %.3fs, %7.1f MB/s',
+			name, size / 1048576, t, size / 1048576 / t))
+	end
+
+	bench('stream:read()', function(s)
+		local t, got = {}, 0
+		while true do
+			local data = s:read()
+			if not data then break end
+			got = got + #data
+			t[#t+1] = data
+		end
+		t = table.concat(t)
+		return #t
+	end)
+
+	bench('stream:readinto()', function(s)
+		local r = buffer.new(size)
+		while s:readinto(r, 65536) do end
+		return #r
+	end)
+end)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
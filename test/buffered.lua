@@ -0,0 +1,115 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+-- Write lots of tiny frames to plain and buffered streams and compare
+-- the number of write syscalls (from /proc/self/io when available).
+-- Also check that buffered output keeps its order with respect to
+-- large writes and is flushed on close.
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local stdio = io
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local format = string.format
+local n = tonumber(arg[1]) or 100000
+
+local function syscw()
+	local f = stdio.open('/proc/self/io')
+	if not f then return 0 end
+	local c = f:read('*a'):match('syscw:%s*(%d+)')
+	f:close()
+	return tonumber(c)
+end
+
+local function reader(s)
+	local got = {}
+	utils.spawn(function()
+		while true do
+			local line = s:read('*l')
+			if not line then break end
+			got[#got+1] = line
+		end
+		got.done = true
+	end)
+	return got
+end
+
+utils.spawn(function()
+	for _, size in ipairs{ 0, 4096, 65536 } do
+		local s1, s2 = assert(io.unix.socketpair())
+		local got = reader(s2)
+		if size > 0 then assert(s1:setbuffered(size)) end
+
+		local before = syscw()
+		local t = utils.updatenow()
+		for i = 1, n do
+			assert(s1:write(format('%d\n', i)))
+			if i % 64 == 0 then utils.yield() end
+		end
+		assert(s1:close())
+		while not got.done do utils.yield() end
+		t = utils.updatenow() - t
+
+		assert(#got == n, #got)
+		for i = 1, n do assert(got[i] == tostring(i)) end
+		print(format('buffer %6d: %7d write syscalls, %.3fs',
+			size, syscw() - before, t))
+	end
+
+	-- large writes and concurrent writers keep their place
+	local s1, s2 = assert(io.unix.socketpair())
+	local got = reader(s2)
+	assert(s1:setbuffered(16))
+	local big = string.rep('x', 200000)
+	assert(s1:write('1\n'))
+	assert(s1:write(big, '\n'))
+	assert(s1:write('2\n'))
+	utils.spawn(function() assert(s1:write('3\n')) end)
+	utils.spawn(function() assert(s1:write(big, '\n')) end)
+	utils.spawn(function() assert(s1:write('4\n')) end)
+	utils.yield()
+	assert(s1:close())
+	while not got.done do utils.yield() end
+	assert(#got == 6)
+	assert(got[1] == '1' and got[2] == big and got[3] == '2')
+	assert(got[4] == '3' and got[5] == big and got[6] == '4')
+
+	-- output buffered while the socket is full survives close()
+	s1, s2 = assert(io.unix.socketpair())
+	local size = 4 * 1024 * 1024
+	assert(s1:setbuffered(2 * size))
+	assert(s1:write(string.rep('y', size)))
+	utils.yield() -- let the flush fill the socket
+	local total, done = 0, false
+	utils.spawn(function()
+		while true do
+			local data = s2:read(65536)
+			if not data then break end
+			total = total + #data
+		end
+		done = true
+	end)
+	assert(s1:close())
+	while not done do utils.yield() end
+	assert(total == size, total)
+	print('ok')
+end)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
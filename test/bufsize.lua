@@ -0,0 +1,109 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+-- Check input buffer sizes, HTTP headers larger than the default
+-- buffer and count read syscalls for a bulk transfer with small and
+-- large buffers. The syscall count needs /proc/self/io.
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local stdio = io
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+require 'lem.http'
+
+local format = string.format
+local size = (tonumber(arg[1]) or 64) * 1024 * 1024
+
+local function syscr()
+	local f = stdio.open('/proc/self/io')
+	if not f then return nil end
+	local c = f:read('*a'):match('syscr:%s*(%d+)')
+	f:close()
+	return tonumber(c)
+end
+
+local function bench(bufsize)
+	local s1, s2 = assert(io.unix.socketpair())
+	local chunk = string.rep('x', 65536)
+
+	assert(s2:setbufsize(bufsize))
+	utils.spawn(function()
+		for i = 1, size / #chunk do
+			assert(s1:write(chunk))
+		end
+		assert(s1:close())
+	end)
+
+	local before = syscr()
+	local t = utils.updatenow()
+	local n = 0
+	while true do
+		local data = s2:read()
+		if not data then break end
+		n = n + #data
+	end
+	t = utils.updatenow() - t
+	assert(n == size)
+
+	local calls = before and format('%7d reads', syscr() - before) or ''
+	print(format('%6d byte buffer %s %7.1f MB/s',
+		bufsize, calls, size / 1048576 / t))
+end
+
+utils.spawn(function()
+	-- defaults and resizing
+	assert(io.setbufsize(8192) == 4096)
+	local s1, s2 = assert(io.unix.socketpair())
+	assert(s2:setbufsize(100) == 8192)
+	assert(io.setbufsize(4096) == 8192)
+	assert(not pcall(s2.setbufsize, s2, 0))
+
+	-- buffered data survives a resize, even to less than what's held
+	assert(s1:write('abcdefghij'))
+	assert(s2:read(2) == 'ab')
+	assert(s2:setbufsize(64) == 100)
+	assert(s2:read(8) == 'cdefghij')
+
+	-- a line longer than the buffer
+	local long = string.rep('y', 1000)
+	assert(s1:write(long, '\n'))
+	assert(s2:read('*l') == long)
+
+	-- HTTP headers larger than the default buffer
+	local value = string.rep('v', 20000)
+	assert(s1:write('GET / HTTP/1.1\r\nX-Long: ', value, '\r\nHost: x\r\n\r\n'))
+	local req = assert(s2:read('HTTPRequest'))
+	local headers = req.header_list
+	assert(#headers == 2)
+	assert(headers[1][1] == 'X-Long' and headers[1][2] == value)
+	assert(headers[2][1] == 'Host' and headers[2][2] == 'x')
+
+	-- but not without limit
+	value = string.rep('v', 100000)
+	utils.spawn(function()
+		s1:write('GET / HTTP/1.1\r\nX-Long: ', value, '\r\n\r\n')
+	end)
+	local ok, err = s2:read('HTTPRequest')
+	assert(ok == nil and err == 'out of buffer space', err)
+
+	bench(4096)
+	bench(65536)
+end)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
@@ -0,0 +1,148 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+-- Check the semantics of bounded channels and compare their
+-- throughput with lem.queue.
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local utils = require 'lem.utils'
+local queue = require 'lem.queue'
+
+local format = string.format
+local n = tonumber(arg[1]) or 200000
+
+utils.spawn(function()
+	local ch = utils.newchannel(2)
+
+	-- non-blocking operations
+	assert(ch:cap() == 2 and ch:len() == 0)
+	local ok, err = ch:try_get()
+	assert(ok == nil and err == 'empty')
+	assert(ch:try_put(1))
+	assert(ch:try_put(2))
+	ok, err = ch:try_put(3)
+	assert(ok == nil and err == 'full')
+	assert(ch:try_get() == 1)
+	assert(ch:try_put(3))
+	assert(select('#', ch:get_many()) == 2)
+
+	-- huge capacities don't allocate up front
+	local big = utils.newchannel(1e9)
+	assert(big:cap() == 1e9)
+	for i = 1, 1000 do assert(big:try_put(i)) end
+	for i = 1, 1000 do assert(big:try_get() == i) end
+
+	-- blocked putters are woken in order
+	local order = {}
+	for i = 1, 4 do
+		utils.spawn(function()
+			assert(ch:put(i))
+			order[#order+1] = i
+		end)
+	end
+	utils.yield()
+	assert(ch:len() == 2 and ch:waiting() == 2)
+	for i = 1, 4 do
+		assert(ch:get() == i)
+	end
+	utils.yield()
+	assert(table.concat(order) == '1234', table.concat(order))
+
+	-- blocked getters are woken in order
+	local got = {}
+	for i = 1, 3 do
+		utils.spawn(function()
+			local v = ch:get()
+			got[#got+1] = i .. v
+		end)
+	end
+	utils.yield()
+	assert(ch:waiting() == 3)
+	ch:put('a') ch:put('b') ch:put('c')
+	utils.yield()
+	assert(table.concat(got, ' ') == '1a 2b 3c', table.concat(got, ' '))
+
+	-- closing wakes everyone but remaining values can be drained
+	utils.spawn(function()
+		local ok, err = ch:get()
+		assert(ok == nil and err == 'closed')
+		got.closed = true
+	end)
+	utils.yield()
+	ch:close()
+	utils.yield()
+	assert(got.closed)
+	ok, err = ch:put(1)
+	assert(ok == nil and err == 'closed')
+
+	ch = utils.newchannel(1)
+	ch:put('x')
+	ch:close()
+	assert(ch:get() == 'x')
+	ok, err = ch:get()
+	assert(ok == nil and err == 'closed')
+
+	-- throughput
+	local function bench(name, n, put, get)
+		local t = utils.updatenow()
+		utils.spawn(function()
+			for i = 1, n do put(i) end
+		end)
+		for i = 1, n do
+			assert(get() == i)
+		end
+		t = utils.updatenow() - t
+		print(format('%-14s %8.0f items/s', name, n / t))
+	end
+
+	-- lem.queue is quadratic in the backlog, so keep it short
+	local q = queue.new()
+	bench('lem.queue', math.min(n, 20000),
+		function(v) q:put(v) end, function() return q:get() end)
+
+	for _, cap in ipairs{ 16, 1024 } do
+		local c = utils.newchannel(cap)
+		bench(format('channel(%d)', cap), n,
+			function(v) c:put(v) end, function() return c:get() end)
+	end
+
+	local c = utils.newchannel(1024)
+	local t = utils.updatenow()
+	utils.spawn(function()
+		for i = 1, n do c:put(i) end
+		c:close()
+	end)
+	local function count(v, ...)
+		if v == nil then return 0 end
+		return select('#', ...) + 1
+	end
+	local total = 0
+	while true do
+		local got = count(c:get_many(256))
+		if got == 0 then break end
+		total = total + got
+	end
+	assert(total == n)
+	t = utils.updatenow() - t
+	print(format('%-14s %8.0f items/s', 'get_many(256)', n / t))
+
+	print('ok')
+end)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
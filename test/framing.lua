@@ -0,0 +1,115 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+-- Check the length prefixed framing parsers and compare them to
+-- reading the header and payload separately from Lua.
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local format = string.format
+local pack, unpack = string.pack, string.unpack
+local frames = tonumber(arg[1]) or 200000
+
+local function varint(n)
+	local t = {}
+	repeat
+		local b = n & 0x7F
+		n = n >> 7
+		t[#t+1] = string.char(n > 0 and b | 0x80 or b)
+	until n == 0
+	return table.concat(t)
+end
+
+local prefix = {
+	u16be = function(n) return pack('>I2', n) end,
+	u16le = function(n) return pack('<I2', n) end,
+	u32be = function(n) return pack('>I4', n) end,
+	u32le = function(n) return pack('<I4', n) end,
+	u64be = function(n) return pack('>I8', n) end,
+	u64le = function(n) return pack('<I8', n) end,
+	varint = varint,
+}
+
+utils.spawn(function()
+	local s1, s2 = assert(io.unix.socketpair())
+
+	for fmt, enc in pairs(prefix) do
+		for _, len in ipairs{ 0, 1, 127, 128, 300, 5000, 65535 } do
+			local payload = string.rep(string.char(len % 256), len)
+			assert(s1:write(enc(len), payload))
+			local got, n = s2:read(fmt, nil, true)
+			assert(got == payload, format('%s: frame of %d', fmt, len))
+			assert(n == len)
+		end
+	end
+
+	-- headers and payloads split across writes
+	local payload = string.rep('p', 100000)
+	local frame = varint(#payload) .. payload
+	utils.spawn(function()
+		for i = 1, #frame, 999 do
+			assert(s1:write(frame:sub(i, i + 998)))
+			utils.yield()
+		end
+	end)
+	assert(s2:read('varint') == payload)
+
+	-- frames larger than max are left in the buffer
+	assert(s1:write(pack('>I4', 1000), string.rep('q', 1000)))
+	local ok, err = s2:read('u32be', 999)
+	assert(ok == nil and err == 'frame too large', err)
+	assert(s2:read('u32be', 1000) == string.rep('q', 1000))
+
+	assert(s1:write(string.rep('\xff', 10), '\x01'))
+	ok, err = s2:read('varint')
+	assert(ok == nil and err == 'invalid frame', err)
+	assert(s2:read(11))
+
+	-- compare with parsing the header in Lua
+	local body = string.rep('b', 100)
+	local function feed()
+		local batch = string.rep(pack('>I4', #body) .. body, 500)
+		utils.spawn(function()
+			for i = 1, frames, 500 do
+				assert(s1:write(batch))
+			end
+		end)
+	end
+
+	feed()
+	local t = utils.updatenow()
+	for i = 1, frames do
+		local n = unpack('>I4', s2:read(4))
+		assert(s2:read(n) == body)
+	end
+	t = utils.updatenow() - t
+	print(format('read(4) + read(n)  %8.0f frames/s', frames / t))
+
+	feed()
+	t = utils.updatenow()
+	for i = 1, frames do
+		assert(s2:read('u32be') == body)
+	end
+	t = utils.updatenow() - t
+	print(format("read('u32be')      %8.0f frames/s", frames / t))
+end)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
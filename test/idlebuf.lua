@@ -0,0 +1,91 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+-- Keep a lot of connections waiting for input and check that only
+-- those holding unread data have an input buffer attached.
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local format = string.format
+local n = tonumber(arg[1]) or 400
+
+local function resident(what)
+	local st = utils.inputbufstats()
+	print(format('%-28s %5d buffers %9d bytes resident, %d pooled',
+		what, st.buffers, st.resident, st.pooled))
+	return st
+end
+
+utils.spawn(function()
+	local base = utils.inputbufstats()
+	local ends = {}
+	local lines = {}
+	local got = 0
+
+	for i = 1, n do
+		local s1, s2 = assert(io.unix.socketpair())
+		ends[i] = s1
+		utils.spawn(function()
+			while true do
+				local line = s2:read('*l')
+				if not line then break end
+				lines[i] = line
+				got = got + 1
+			end
+		end)
+	end
+	utils.yield()
+
+	local st = resident(format('%d idle readers', n))
+	assert(st.buffers == base.buffers)
+
+	-- half a line leaves data in the buffer
+	for i = 1, n, 2 do
+		assert(ends[i]:write('hello'))
+	end
+	while utils.inputbufstats().buffers < base.buffers + n/2 do
+		utils.yield()
+	end
+	st = resident('half of them with half a line')
+	assert(st.buffers == base.buffers + n/2)
+	assert(st.resident == base.resident + n/2 * st.size)
+
+	-- finishing the lines gives the buffers back
+	for i = 1, n, 2 do
+		assert(ends[i]:write(' world\n'))
+	end
+	while got < n/2 do utils.yield() end
+	for i = 1, n, 2 do
+		assert(lines[i] == 'hello world')
+	end
+	st = resident('after the lines were read')
+	assert(st.buffers == base.buffers)
+	assert(st.pooled > 0 and st.hits > 0)
+
+	print(format('%d bytes would be resident with permanent buffers',
+		n * st.size))
+
+	for i = 1, n do
+		assert(ends[i]:close())
+	end
+end)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
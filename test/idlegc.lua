@@ -0,0 +1,61 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local utils = require 'lem.utils'
+
+local format = string.format
+
+if arg[1] then
+	print(format('switching from %s to %s mode', utils.gcmode(arg[1]), arg[1]))
+end
+
+-- 64KB steps, at most 1ms per idle callback,
+-- but only after 10ms without any Lua running
+utils.idlegc(64, 0.001, 0.01)
+
+local sleeper = utils.newsleeper()
+for i = 1, 20 do
+	local garbage = {}
+	for j = 1, 10000 do
+		garbage[j] = { j, tostring(j) }
+	end
+	sleeper:sleep(0.02)
+end
+
+local st = utils.gcstats()
+print(format('%d steps, %d cycles, max pause %.3fms',
+	st.steps, st.cycles, 1000 * st.maxpause))
+
+local total = 0
+for i = 1, #st.pauses do total = total + st.pauses[i] end
+local acc = 0
+for i = 1, #st.pauses do
+	local n = st.pauses[i]
+	if n > 0 then
+		acc = acc + n
+		print(format('  < %6dus: %6d (%5.1f%%)', 2^(i-1), n, 100 * acc / total))
+	end
+end
+
+assert(st.steps > 0)
+utils.idlegc(false)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
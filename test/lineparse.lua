@@ -0,0 +1,97 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+-- Check multi-byte line delimiters and measure line parser
+-- throughput for short lines and for long lines arriving in
+-- small pieces.
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local format = string.format
+local size = (tonumber(arg[1]) or 32) * 1024 * 1024
+
+local function bench(name, line, delim, piece, bufsize)
+	local s1, s2 = assert(io.unix.socketpair())
+	local n = size // (#line + #delim)
+	local data = line .. delim
+
+	if bufsize then assert(s2:setbufsize(bufsize)) end
+	utils.spawn(function()
+		if piece then
+			for i = 1, n do
+				for j = 1, #data, piece do
+					assert(s1:write(data:sub(j, j + piece - 1)))
+					utils.yield()
+				end
+			end
+		else
+			local batch = string.rep(data, 65536 // #data + 1)
+			local lines = #batch // #data
+			for i = 1, n, lines do
+				assert(s1:write(i + lines <= n and batch
+					or string.rep(data, n - i + 1)))
+			end
+		end
+		assert(s1:close())
+	end)
+
+	local t = utils.updatenow()
+	for i = 1, n do
+		local got = s2:read('*l', delim)
+		assert(got == line, format('%s: line %d', name, i))
+	end
+	t = utils.updatenow() - t
+	assert(s2:read('*l', delim) == nil)
+	print(format('%-26s %8.1f MB/s', name, n * #data / 1048576 / t))
+end
+
+utils.spawn(function()
+	local s1, s2 = assert(io.unix.socketpair())
+
+	-- delimiters split across writes
+	assert(s1:write('abc\r'))
+	utils.spawn(function() assert(s1:write('\ndef\r\n\r\nghi\n')) end)
+	assert(s2:read('*l', '\r\n') == 'abc')
+	assert(s2:read('*l', '\r\n\r\n') == 'def')
+	assert(s2:read('*l') == 'ghi')
+
+	-- a delimiter straddling the end of a full buffer
+	assert(s2:setbufsize(64))
+	local long = string.rep('x', 63)
+	assert(s1:write(long, '\r\n', long, long, '\r\n'))
+	assert(s2:read('*l', '\r\n') == long)
+	assert(s2:read('*l', '\r\n') == long .. long)
+
+	assert(not pcall(s2.read, s2, '*l', ''))
+	assert(not pcall(s2.read, s2, '*l', string.rep('-', 17)))
+
+	local short = string.rep('y', 78)
+	bench('short lines, \\n', short, '\n')
+	bench('short lines, \\r\\n', short, '\r\n')
+
+	local size0 = size
+	size = size // 8
+	local huge = string.rep('z', 256 * 1024)
+	bench('256KB lines in 1KB pieces', huge, '\r\n', 1024, 1024 * 1024)
+	size = size0
+end)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
@@ -0,0 +1,109 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local utils = require 'lem.utils'
+
+local format = string.format
+
+local function spin(n)
+	local x = 0
+	for i = 1, n do
+		x = (x + i * i) % 1000003
+	end
+	return x
+end
+
+utils.spawn(function()
+	-- results, nils included, come back in order
+	local a, b, c, d = utils.offload(function(x, y) return x + y, nil, 'z', { x } end, 1, 2)
+	assert(a == 3 and b == nil and c == 'z' and d[1] == 1)
+	assert(select('#', utils.offload(function() end)) == 0)
+
+	-- upvalues travel with the function
+	local k = 10
+	assert(utils.offload(function(x) return x * k end, 4) == 40)
+	assert(utils.offload(spin, 1000) == spin(1000))
+
+	-- errors are returned
+	local ok, err = utils.offload(function() error('boom') end)
+	assert(ok == nil and err:match('boom'))
+	ok, err = utils.offload(function() return io.stdout end)
+	assert(ok == nil and type(err) == 'string')
+	ok, err = utils.offload(print, 1)
+	assert(ok == nil and type(err) == 'string')
+
+	-- workers only get the parts of lem.utils that don't need the loop
+	assert(utils.offload(function()
+		local u = require 'lem.utils'
+		assert(u.spawn == nil and u.sleep == nil and u.newchannel == nil)
+		return u.unserialize(u.serialize({ 7 }))[1]
+	end) == 7)
+	-- nor the C modules of lem, which would use the loop from a pool thread
+	ok, err = utils.offload(function()
+		return require('lem.io').open('/dev/null')
+	end)
+	assert(ok == nil and err:match('event loop'), err)
+	ok, err = utils.offload(function() return require 'lem.io.core' end)
+	assert(ok == nil and err:match('event loop'), err)
+	assert(not pcall(utils.offloadconfig, 0))
+	assert(not pcall(utils.offloadconfig, 1.5))
+	assert(not pcall(utils.offloadconfig))
+
+	-- workers keep their modules loaded
+	assert(utils.offload(function(t)
+		return require('lem.json').encode(t)
+	end, { 1, 2 }) == '[1,2]')
+
+	-- the loop keeps going while spin runs elsewhere
+	local want = spin(20000000)
+	local ticks, busy = 0, true
+	utils.spawn(function()
+		while busy do
+			utils.sleep(0.01)
+			ticks = ticks + 1
+		end
+	end)
+	local t = utils.updatenow()
+	assert(utils.offload(spin, 20000000) == want)
+	busy = false
+	t = utils.updatenow() - t
+	print(format('spin offloaded in %.3fs, %d timer ticks meanwhile', t, ticks))
+	assert(ticks > 0)
+
+	-- no more than the limit run at once, but all complete
+	utils.offloadconfig(2)
+	local n, done = 32, utils.newsleeper()
+	local left = n
+	t = utils.updatenow()
+	for i = 1, n do
+		utils.spawn(function()
+			assert(utils.offload(function(x) return x * x end, i) == i * i)
+			left = left - 1
+			if left == 0 then done:wakeup() end
+		end)
+	end
+	done:sleep()
+	t = utils.updatenow() - t
+	print(format('%d small offloads in %.3fs (%.0f/s)', n, t, n / t))
+	print('ok')
+end)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
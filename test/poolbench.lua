@@ -0,0 +1,102 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+-- Thread pool throughput: many coroutines doing file:size(), which
+-- is one fstat() on the pool, with 1, 4 and 16 threads. The context
+-- switches counted are those of the event loop thread. Then empty
+-- jobs from utils.poolping(), submitted one by one and in batches.
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local stdio = io
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local format = string.format
+local jobs = tonumber(arg[1]) or 200000
+local width = tonumber(arg[2]) or 64
+
+local function ctxsw()
+	local f = stdio.open('/proc/self/status')
+	if not f then return 0 end
+	local s = f:read('*a')
+	f:close()
+	return tonumber(s:match('voluntary_ctxt_switches:%s*(%d+)') or 0)
+		+ tonumber(s:match('nonvoluntary_ctxt_switches:%s*(%d+)') or 0)
+end
+
+local name = os.tmpname()
+
+local function bench(threads)
+	utils.poolconfig(1, threads, threads)
+
+	local files = {}
+	for i = 1, width do
+		files[i] = assert(io.open(name))
+	end
+
+	local running = width
+	local done = utils.newsleeper()
+	local sw = ctxsw()
+	local t = utils.updatenow()
+	for i = 1, width do
+		utils.spawn(function(file)
+			for j = 1, jobs / width do
+				assert(file:size() == 0)
+			end
+			file:close()
+			running = running - 1
+			if running == 0 then done:wakeup() end
+		end, files[i])
+	end
+	done:sleep()
+	t = utils.updatenow() - t
+	sw = ctxsw() - sw
+
+	print(format('%2d threads %9.0f jobs/s %8.3f loop context switches/job',
+		threads, jobs / t, sw / jobs))
+end
+
+local function ping(threads, batch)
+	utils.poolconfig(1, threads, threads)
+
+	local t = utils.updatenow()
+	assert(utils.poolping(jobs, batch) == jobs)
+	t = utils.updatenow() - t
+
+	print(format('%2d threads %9.0f empty jobs/s in batches of %d',
+		threads, jobs / t, batch))
+end
+
+utils.spawn(function()
+	bench(1)
+	bench(4)
+	bench(16)
+	os.remove(name)
+
+	assert(not pcall(utils.poolping, 0))
+	assert(not pcall(utils.poolping, 1, 0))
+	assert(utils.poolping(3, 2, 'user') == 3)
+	for _, threads in ipairs{ 1, 4, 16 } do
+		ping(threads, 1)
+		ping(threads, 64)
+	end
+	utils.poolconfig(3, 1, 8)
+end)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
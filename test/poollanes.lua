@@ -0,0 +1,62 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+-- Keep the default pool limits busy with children that take a
+-- while to exit, each waited for with os.waitpid(), and time
+-- io.open() meanwhile. waitpid() runs on the 'blocking' lane, so
+-- the file operations on the 'fs' lane are not held up behind it.
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+local os    = require 'lem.os'
+
+local format = string.format
+local children = tonumber(arg[1]) or 16
+
+-- tuning a lane
+assert(not pcall(utils.poolconfig, 1, 0, 4, 'nope'))
+utils.poolconfig(3, 0, 32, 'blocking')
+
+local waiting = 0
+for i = 1, children do
+	local child = assert(io.spawnp({ 'sleep', '1' }, {}))
+	local pid = child.pid
+	waiting = waiting + 1
+	utils.spawn(function()
+		assert(os.waitpid(pid, 0))
+		waiting = waiting - 1
+	end)
+end
+
+utils.spawn(function()
+	local name = os.tmpname()
+	local t = utils.updatenow()
+	for i = 1, 100 do
+		local file = assert(io.open(name))
+		assert(file:close())
+	end
+	t = utils.updatenow() - t
+	print(format('100 opens with %d children waited for in %.3fs', waiting, t))
+	assert(waiting == children, 'opens waited for the children')
+	assert(t < 0.5)
+	os.remove(name)
+end)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
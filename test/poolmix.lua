@@ -0,0 +1,103 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+-- Mixed thread pool load: a few coroutines stream a big file in
+-- 1MB reads, which are long jobs resubmitted from file_readp_reap,
+-- while many others do file:size(), a short fstat() job. Prints
+-- the throughput of both and the latency of the short jobs.
+-- Pass 'off' as third argument to run without worker affinity.
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local format = string.format
+local threads = tonumber(arg[1]) or 4
+local duration = tonumber(arg[2]) or 2
+local affinity = arg[3] ~= 'off'
+local readers = 4
+local width = 64
+local size = 64 * 1024 * 1024
+
+local name = os.tmpname()
+local chunk = string.rep('x', 1024 * 1024)
+
+utils.spawn(function()
+	local file = assert(io.open(name, 'w'))
+	for i = 1, size / #chunk do
+		assert(file:write(chunk))
+	end
+	assert(file:close())
+
+	utils.poolconfig(1, threads, threads)
+	if utils.poolaffinity then utils.poolaffinity(affinity) end
+
+	local stop = false
+	local running = readers + width
+	local done = utils.newsleeper()
+	local bytes, short, lat, maxlat = 0, 0, 0, 0
+	local now = utils.updatenow
+
+	for i = 1, readers do
+		utils.spawn(function()
+			while not stop do
+				local file = assert(io.open(name))
+				while not stop do
+					local data = file:read(#chunk)
+					if not data then break end
+					bytes = bytes + #data
+				end
+				file:close()
+			end
+			running = running - 1
+			if running == 0 then done:wakeup() end
+		end)
+	end
+
+	for i = 1, width do
+		utils.spawn(function()
+			local file = assert(io.open(name))
+			while not stop do
+				local t = now()
+				assert(file:size() == size)
+				t = now() - t
+				lat = lat + t
+				if t > maxlat then maxlat = t end
+				short = short + 1
+			end
+			file:close()
+			running = running - 1
+			if running == 0 then done:wakeup() end
+		end)
+	end
+
+	local t = now()
+	utils.newsleeper():sleep(duration)
+	stop = true
+	done:sleep()
+	t = now() - t
+
+	print(format('%2d threads %7.1f MB/s long reads, %8.0f short jobs/s, ' ..
+		'short latency avg %.3fms max %.3fms',
+		threads, bytes / 1048576 / t, short / t,
+		1000 * lat / short, 1000 * maxlat))
+	os.remove(name)
+end)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
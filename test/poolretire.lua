@@ -0,0 +1,61 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+-- Let pool threads retire as soon as they run out of work while
+-- jobs keep coming, so submissions race with the last thread of the
+-- lane exiting. A job left behind by that never finishes.
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local format = string.format
+local jobs = tonumber(arg[1]) or 20000
+local width = 4
+
+local name = os.tmpname()
+
+utils.spawn(function()
+	-- no threads kept and no time to idle
+	utils.poolconfig(0, 0, 1)
+
+	local running = width
+	local done = utils.newsleeper()
+	for i = 1, width do
+		utils.spawn(function()
+			local file = assert(io.open(name))
+			for j = 1, jobs / width do
+				assert(file:size() == 0)
+				if j % 7 == 0 then utils.yield() end
+			end
+			file:close()
+			running = running - 1
+			if running == 0 then done:wakeup() end
+		end)
+	end
+	done:sleep(10)
+	assert(running == 0, 'a job got stranded')
+
+	local stats = utils.poolstats()
+	print(format('%d jobs, %d threads spawned', jobs, stats.lanes.fs.spawned))
+	utils.poolconfig(3, 1, 8)
+	os.remove(name)
+end)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
@@ -0,0 +1,94 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+-- Runs some file I/O and offloaded work and prints what
+-- utils.poolstats() tells about the thread pool.
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local format = string.format
+
+-- upper bound in microseconds of the bucket holding the p'th job
+local function percentile(hist, p)
+	local total = 0
+	for i = 1, #hist do total = total + hist[i] end
+	local seen = 0
+	for i = 1, #hist do
+		seen = seen + hist[i]
+		if seen >= total * p then return 2^(i-1) end
+	end
+end
+
+utils.spawn(function()
+	local name = os.tmpname()
+	local file = assert(io.open(name, 'w'))
+	for i = 1, 100 do
+		assert(file:write(string.rep('x', 4096)))
+	end
+	assert(file:close())
+
+	local n, done = 16, utils.newsleeper()
+	local left = n
+	for i = 1, n do
+		utils.spawn(function()
+			local file = assert(io.open(name))
+			for j = 1, 100 do
+				assert(file:size() == 409600)
+			end
+			assert(#file:read('*a') == 409600)
+			file:close()
+			left = left - 1
+			if left == 0 then done:wakeup() end
+		end)
+	end
+	done:sleep()
+	assert(utils.offload(function(x) return x + 1 end, 1) == 2)
+	os.remove(name)
+
+	local st = utils.poolstats()
+	assert(st.spawned >= 1)
+	assert(st.spawned >= st.exited)
+	assert(st.lanes.fs.jobs == 0 and st.lanes.fs.queued == 0)
+	assert(st.lanes.fs.maxqueued >= 1)
+	assert(st.lanes.user.spawned >= 1)
+
+	local size = st.jobs['io.File.size']
+	assert(size and size.jobs == n * 100)
+	assert(#size.wait == #size.service)
+	assert(st.jobs['io.open'].jobs >= n)
+	assert(st.jobs['utils.offload'].jobs == 1)
+
+	print(format('%d threads spawned, %d exited', st.spawned, st.exited))
+	for lane, l in pairs(st.lanes) do
+		print(format('%-9s threads %2d idle %2d spawned %2d exited %2d ' ..
+			'max queued %d', lane, l.threads, l.idle, l.spawned, l.exited,
+			l.maxqueued))
+	end
+	for name, j in pairs(st.jobs) do
+		print(format('%-20s %6d jobs  wait p50 <%dus p99 <%dus  ' ..
+			'service p50 <%dus p99 <%dus', name, j.jobs,
+			percentile(j.wait, 0.5), percentile(j.wait, 0.99),
+			percentile(j.service, 0.5), percentile(j.service, 0.99)))
+	end
+end)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
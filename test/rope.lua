@@ -0,0 +1,143 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+-- Check io.rope() and writing ropes, then serve HTTP responses
+-- built with ropes and count the write syscalls they take.
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local stdio  = io
+local utils  = require 'lem.utils'
+local io     = require 'lem.io'
+local server = require 'lem.http.server'
+local client = require 'lem.http.client'
+local response = require 'lem.http.response'
+
+local format = string.format
+local n = tonumber(arg[1]) or 2000
+local port = tonumber(arg[2]) or 18080
+
+-- short fragments and numbers merge, long strings are referenced
+local r = io.rope()
+r:add('Content-Length: ', 42, '\r\n')
+assert(r:parts() == 1 and #r == 20)
+local long = string.rep('x', 1000)
+r:add(long, '\r\n', '')
+assert(r:parts() == 3 and #r == 1022)
+assert(tostring(r) == 'Content-Length: 42\r\n' .. long .. '\r\n')
+assert(not pcall(r.add, r, {}))
+r:clear()
+assert(#r == 0 and r:tostring() == '')
+
+-- headers go into a rope, or a table as they used to
+local res = response.new()
+res.headers['X-Test'] = 'yes'
+local t = { 'HTTP/1.1 200 OK\r\n' }
+assert(res:appendheader(t) == 3)
+assert(table.concat(t) == 'HTTP/1.1 200 OK\r\nX-Test: yes\r\n\r\n')
+r:add('HTTP/1.1 200 OK\r\n')
+assert(res:appendheader(r) == r and r:tostring() == table.concat(t))
+r:clear()
+
+local function syscw()
+	local f = stdio.open('/proc/self/io')
+	if not f then return nil end
+	local c = f:read('*a'):match('syscw:%s*(%d+)')
+	f:close()
+	return tonumber(c)
+end
+
+utils.spawn(function()
+	-- more parts than fit in one writev()
+	local s1, s2 = assert(io.unix.socketpair())
+	local expect = {}
+	for i = 1, 300 do
+		local s = string.rep(string.char(64 + i % 26), 100 + i)
+		r:add(s, i)
+		expect[#expect+1] = s .. i
+	end
+	expect = table.concat(expect)
+	utils.spawn(function()
+		assert(s1:write('<', r, '>'))
+		assert(s1:close())
+	end)
+	assert(s2:read('*a') == '<' .. expect .. '>')
+
+	-- a rope waiting to be written can't change
+	s1, s2 = assert(io.unix.socketpair())
+	local big = io.rope():add(string.rep('y', 8 * 1024 * 1024))
+	utils.spawn(function() assert(s1:write(big)) end)
+	utils.yield()
+	assert(not pcall(big.add, big, 'z'))
+	assert(#assert(s2:read(#big)) == #big)
+	utils.yield()
+	big:add('z')
+	s1:close()
+	s2:close()
+
+	-- buffered streams and files
+	s1, s2 = assert(io.unix.socketpair())
+	s1:setbuffered(4096)
+	assert(s1:write(io.rope():add('buf', 'fered')))
+	assert(s2:read(8) == 'buffered')
+	s1:close()
+	s2:close()
+
+	local name = os.tmpname()
+	local file = assert(io.open(name, 'w'))
+	assert(file:write('<', r, '>'))
+	assert(file:close())
+	file = assert(io.open(name))
+	assert(file:read('*a') == '<' .. expect .. '>')
+	file:close()
+	os.remove(name)
+
+	-- HTTP round trips
+	local body = string.rep('Hello, world!\n', 100)
+	local srv = assert(server.new('127.0.0.1', port, function(req, res)
+		res.headers['Content-Type'] = 'text/plain'
+		res:add(body)
+	end))
+	utils.spawn(function() srv:run() end)
+
+	local c = client.new()
+	local url = format('http://127.0.0.1:%d/', port)
+	local res = assert(c:get(url))
+	assert(res.status == 200)
+	assert(res.headers['content-length'] == tostring(#body))
+	assert(res:body() == body)
+
+	local before = syscw()
+	local t = utils.updatenow()
+	for i = 1, n do
+		res = assert(c:get(url))
+		assert(res:body() == body)
+	end
+	t = utils.updatenow() - t
+	if before then
+		print(format('%d requests, %.2f write syscalls per round trip, %.0f requests/s',
+			n, (syscw() - before) / n, n / t))
+	else
+		print(format('%d requests, %.0f requests/s', n, n / t))
+	end
+
+	assert(c:close())
+	srv:close()
+end)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
@@ -0,0 +1,66 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local utils = require 'lem.utils'
+
+local format = string.format
+
+local function run(threads, rounds)
+	local done, sleeper = 0, utils.newsleeper()
+	local t = utils.updatenow()
+
+	for i = 1, threads do
+		utils.spawn(function()
+			for j = 1, rounds do
+				utils.yield()
+			end
+			done = done + 1
+			if done == threads then sleeper:wakeup() end
+		end)
+	end
+	sleeper:sleep()
+
+	return utils.updatenow() - t
+end
+
+local function report(name, batch, budget)
+	utils.runqueueconfig(batch, budget)
+	local before = utils.runqueuestats()
+	local diff = run(1000, 100)
+	local after = utils.runqueuestats()
+	local iterations = after.iterations - before.iterations
+	local resumed = after.resumed - before.resumed
+
+	print(format('%-16s %.3fs, %7d iterations, %6.1f threads/iteration, %d overruns',
+		name, diff, iterations, resumed / iterations,
+		after.overruns - before.overruns))
+end
+
+report('unbatched', 0)
+report('batch 64', 64)
+report('batch 4096', 4096)
+report('batch 4096/1ms', 4096, 0.001)
+
+local st = utils.runqueuestats()
+assert(st.maxbatch > 1)
+utils.runqueueconfig(0)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
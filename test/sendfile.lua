@@ -0,0 +1,93 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+-- Start more stalled sendfile() transfers than there are threads in
+-- the pool, check that file operations still go through, then read
+-- everything back and compare.
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local format = string.format
+local clients = tonumber(arg[1]) or 16
+local name = 'sendfile.tmp'
+
+local block = {}
+for i = 1, 4096 do block[i] = format('%15d\n', i) end
+block = table.concat(block)
+local size = 16 * #block
+
+utils.spawn(function()
+	local file = assert(io.open(name, 'w'))
+	for i = 1, 16 do assert(file:write(block)) end
+	assert(file:close())
+
+	file = assert(io.open(name))
+	local expect = assert(file:read(size))
+
+	local done = 0
+	local pairs = {}
+	for i = 1, clients do
+		local s1, s2 = assert(io.unix.socketpair())
+		pairs[i] = s2
+		utils.spawn(function()
+			local offset = i % 2 == 0 and 100 or 0
+			local n = assert(s1:sendfile(file, size - offset, offset))
+			assert(n == size - offset, format('sent %d bytes', n))
+			-- asking for more than the file holds stops at the end
+			assert(s1:sendfile(file, size, size - 5) == 5)
+			assert(s1:close())
+			done = done + 1
+		end)
+	end
+
+	-- nobody reads yet, but the thread pool is still available
+	local t = utils.updatenow()
+	for i = 1, 50 do
+		assert(assert(io.open(name)):close())
+	end
+	t = utils.updatenow() - t
+	assert(done == 0)
+	print(format('%d opens with %d stalled transfers in %.3fs',
+		50, clients, t))
+	assert(t < 1)
+
+	for i = 1, clients do
+		local offset = i % 2 == 0 and 100 or 0
+		local data = assert(pairs[i]:read('*a'))
+		assert(data == expect:sub(offset + 1) .. expect:sub(-5))
+	end
+	assert(done == clients)
+
+	-- closing the socket aborts a transfer
+	local s1, s2 = assert(io.unix.socketpair())
+	local res
+	utils.spawn(function() res = { s1:sendfile(file, size) } end)
+	utils.yield()
+	assert(s1:close())
+	while not res do utils.yield() end
+	assert(res[1] == nil and res[2] == 'closed', res[2])
+
+	assert(file:close())
+	os.remove(name)
+	print('ok')
+end)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
@@ -0,0 +1,137 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+-- Move data between socket pairs with stream:splice() and io.proxy()
+-- and compare against copying through Lua strings.
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local format = string.format
+local size = (tonumber(arg[1]) or 64) * 1024 * 1024
+
+local chunk = string.rep('0123456789abcdef', 4096)
+
+local function produce(s, n)
+	while n > 0 do
+		local len = n < #chunk and n or #chunk
+		assert(s:write(chunk:sub(1, len)))
+		n = n - len
+	end
+	assert(s:close())
+end
+
+local function consume(s)
+	local n = 0
+	while true do
+		local data = s:read()
+		if not data then break end
+		n = n + #data
+	end
+	return n
+end
+
+local function bench(name, copy)
+	local a1, a2 = assert(io.unix.socketpair())
+	local b1, b2 = assert(io.unix.socketpair())
+	local got
+
+	utils.spawn(produce, a1, size)
+	utils.spawn(function() got = consume(b2) end)
+
+	local t = utils.updatenow()
+	local moved = copy(a2, b1)
+	assert(b1:close())
+	while not got do utils.yield() end
+	t = utils.updatenow() - t
+
+	assert(moved == size, format('moved %s of %d bytes', moved, size))
+	assert(got == size, format('got %s of %d bytes', got, size))
+	print(format('%-8s %d MB in %.3fs, %.1f MB/s', name,
+		size / 1048576, t, size / 1048576 / t))
+end
+
+utils.spawn(function()
+	-- limited splice leaves the rest to be read
+	do
+		local s1, s2 = assert(io.unix.socketpair())
+		local d1, d2 = assert(io.unix.socketpair())
+		assert(s1:write('hello world'))
+		assert(s2:splice(d1, 5) == 5)
+		assert(d2:read(5) == 'hello')
+		assert(s2:read(6) == ' world')
+
+		-- buffered input is forwarded first
+		assert(s1:write('line\nrest'))
+		assert(s2:read('*l') == 'line')
+		assert(s1:close())
+		assert(s2:splice(d1) == 4)
+		assert(d2:read(4) == 'rest')
+
+		-- nothing left to move
+		local ok, err = s2:splice(d1)
+		assert(ok == nil and err == 'closed', err)
+	end
+
+	-- closing the source aborts the splice
+	do
+		local s1, s2 = assert(io.unix.socketpair())
+		local d1, d2 = assert(io.unix.socketpair())
+		local res
+		utils.spawn(function() res = { s2:splice(d1) } end)
+		utils.yield()
+		local ok, err = s2:read()
+		assert(ok == nil and err == 'busy', err)
+		assert(s2:close())
+		while not res do utils.yield() end
+		assert(res[1] == nil and res[2] == 'closed', res[2])
+	end
+
+	-- proxy in both directions until one side closes
+	do
+		local a1, a2 = assert(io.unix.socketpair())
+		local b1, b2 = assert(io.unix.socketpair())
+		local res
+		utils.spawn(function() res = { io.proxy(a2, b1) } end)
+		assert(a1:write('ping'))
+		assert(b2:read(4) == 'ping')
+		assert(b2:write('pong!'))
+		assert(a1:read(5) == 'pong!')
+		assert(a1:close())
+		while not res do utils.yield() end
+		assert(res[1] == 4 and res[2] == 5, format('%s %s', res[1], res[2]))
+	end
+
+	bench('strings', function(src, dst)
+		local n = 0
+		while true do
+			local data = src:read()
+			if not data then break end
+			assert(dst:write(data))
+			n = n + #data
+		end
+		return n
+	end)
+	bench('splice', function(src, dst)
+		return assert(src:splice(dst))
+	end)
+end)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
@@ -0,0 +1,68 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local utils = require 'lem.utils'
+
+local format = string.format
+
+local function churn(n)
+	local done, sleeper = 0, utils.newsleeper()
+	local t = utils.updatenow()
+
+	for i = 1, n do
+		utils.spawn(function(i)
+			local x = { i }
+			utils.yield()
+			done = done + 1
+			if done == n then sleeper:wakeup() end
+		end, i)
+		if i % 100 == 0 then utils.yield() end
+	end
+	sleeper:sleep()
+
+	return utils.updatenow() - t
+end
+
+local function report(name)
+	local before = utils.threadcachestats()
+	local diff = churn(200000)
+	local after = utils.threadcachestats()
+
+	print(format('%-10s %.3fs, %6d hits, %6d misses, %6d cached',
+		name, diff, after.hits - before.hits,
+		after.misses - before.misses, after.size))
+	return after.hits - before.hits
+end
+
+assert(report('uncached') == 0)
+utils.threadcacheconfig(256)
+assert(report('cached') > 0)
+
+-- coroutines handed out again must start from a clean stack
+utils.spawn(function(...)
+	assert(select('#', ...) == 2)
+end, 1, 2)
+utils.yield()
+
+utils.threadcacheconfig(0)
+assert(utils.threadcachestats().size == 0)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
@@ -0,0 +1,125 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+-- Check that reads, writes and accepts give up after the timeout
+-- set with settimeout() and that the objects are still usable.
+-- File reads run on the pool and can't be cancelled, so a file
+-- stays busy until its read actually completes.
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local format = string.format
+
+local function elapsed(t)
+	return utils.updatenow() - t
+end
+
+utils.spawn(function()
+	local s1, s2 = assert(io.unix.socketpair())
+
+	-- read with nothing to read
+	assert(s1:settimeout(0.1) == 0)
+	local t = utils.updatenow()
+	local ok, err = s1:read('*l')
+	assert(ok == nil and err == 'timeout', err)
+	print(format('read timed out after %.3fs', elapsed(t)))
+
+	-- the stream is still open and readable
+	assert(s2:write('hello\n'))
+	assert(s1:read('*l') == 'hello')
+
+	-- write into a full socket buffer
+	local chunk = string.rep('x', 65536)
+	t = utils.updatenow()
+	repeat
+		ok, err = s1:write(chunk)
+	until not ok
+	assert(err == 'timeout', err)
+	print(format('write timed out after %.3fs', elapsed(t)))
+
+	-- timeout 0 disables it again
+	assert(s1:settimeout() == 0.1)
+	utils.spawn(function()
+		utils.sleep(0.2)
+		s2:close()
+	end)
+	ok, err = s1:read('*l')
+	assert(ok == nil and err == 'closed', err)
+	s1:close()
+
+	-- accept without connecting clients
+	local server = assert(io.tcp.listen('127.0.0.1', 0))
+	server:settimeout(0.1)
+	t = utils.updatenow()
+	ok, err = server:accept()
+	assert(ok == nil and err == 'timeout', err)
+	print(format('accept timed out after %.3fs', elapsed(t)))
+	assert(not server:busy())
+	server:close()
+
+	-- a file read held up on the pool. pipes open as streams, so keep
+	-- the only fs thread busy opening a fifo nobody writes to instead
+	local name = os.tmpname()
+	local file = assert(io.open(name, 'w'))
+	assert(file:write('first\nsecond\n'))
+	assert(file:close())
+	local fifo = os.tmpname()
+	os.remove(fifo)
+	assert(os.execute('mkfifo ' .. fifo))
+	utils.poolconfig(3, 1, 1)
+	file = assert(io.open(name))
+	assert(file:settimeout(0.1) == 0)
+	local blocked
+	utils.spawn(function()
+		blocked = assert(io.open(fifo))
+	end)
+	utils.yield()
+	t = utils.updatenow()
+	ok, err = file:read('*l')
+	assert(ok == nil and err == 'timeout', err)
+	print(format('file read timed out after %.3fs', elapsed(t)))
+
+	-- the file is busy until the read really ran
+	ok, err = file:read('*l')
+	assert(ok == nil and err == 'busy', err)
+	collectgarbage()
+	-- a writer coming and going lets the open of the fifo finish
+	assert(os.execute('true > ' .. fifo))
+	repeat
+		utils.sleep(0.01)
+		ok, err = file:size()
+	until err ~= 'busy'
+	assert(ok == 13, err)
+
+	-- what it read was dropped, but the file is usable again
+	assert(file:settimeout() == 0.1)
+	assert(file:seek('set', 0) == 0)
+	assert(file:read('*l') == 'first')
+	assert(file:close())
+	assert(blocked:close())
+	utils.poolconfig(3, 1, 8)
+	os.remove(name)
+	os.remove(fifo)
+
+	print('ok')
+end)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
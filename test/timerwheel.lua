@@ -0,0 +1,76 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+-- Compare per-sleeper ev_timers with the timer wheel by arming and
+-- cancelling a lot of long idle timeouts, then check that short
+-- sleeps still fire about on time.
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local utils = require 'lem.utils'
+
+local format = string.format
+local n = tonumber(arg[1]) or 100000
+
+local function bench(name, granularity)
+	assert(utils.timerwheel(granularity))
+
+	local sleepers = {}
+	for i = 1, n do
+		sleepers[i] = utils.newsleeper()
+	end
+
+	local armed, done = 0, utils.newsleeper()
+	local t = utils.updatenow()
+	for i = 1, n do
+		utils.spawn(function(s)
+			armed = armed + 1
+			if armed == n then done:wakeup() end
+			s:sleep(30 + (i % 1000) / 10)
+		end, sleepers[i])
+	end
+	done:sleep()
+	local arm = utils.updatenow() - t
+
+	t = utils.updatenow()
+	for i = 1, n do
+		sleepers[i]:wakeup()
+	end
+	utils.yield()
+	local cancel = utils.updatenow() - t
+
+	local max = 0
+	for i = 1, 20 do
+		local d = i / 200
+		t = utils.updatenow()
+		utils.sleep(d)
+		local off = utils.updatenow() - t - d
+		assert(off > -0.001, 'woke up early')
+		if off > max then max = off end
+	end
+
+	print(format('%-10s arm %.3fs, cancel %.3fs, worst sleep %.1fms late',
+		name, arm, cancel, 1000 * max))
+end
+
+bench('ev_timer', 0)
+bench('wheel 1ms', 0.001)
+bench('wheel 10ms', 0.01)
+assert(utils.timerwheel(0))
+
+-- vim: syntax=lua ts=2 sw=2 noet:
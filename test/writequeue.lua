@@ -0,0 +1,77 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+-- Let a lot of coroutines write to the same socket at once and check
+-- that every message arrives whole and in the order it was written.
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local format = string.format
+local writers = tonumber(arg[1]) or 1000
+local rounds = tonumber(arg[2]) or 20
+
+local s1, s2 = assert(io.unix.socketpair())
+local payload = string.rep('.', 200)
+
+-- fill up the socket so everybody has to queue
+local filler = string.rep('x', 65536)
+repeat
+	s1:settimeout(0.01)
+	local ok = s1:write(filler)
+until not ok
+s1:settimeout(0)
+
+utils.spawn(function()
+	local t = utils.updatenow()
+	local done = 0
+	for i = 1, writers do
+		utils.spawn(function()
+			for j = 1, rounds do
+				assert(s1:write(format('%d:%d:', i, j), payload, '\n'))
+			end
+			done = done + 1
+			if done == writers then
+				assert(s1:write('end\n'))
+			end
+		end)
+	end
+
+	-- drain the filler, then check the messages
+	local seen = {}
+	local lines = 0
+	while true do
+		local line = assert(s2:read('*l'))
+		if line == 'end' then break end
+		local i, j, rest = line:match('^x*(%d+):(%d+):(.*)$')
+		if i then
+			i, j = tonumber(i), tonumber(j)
+			assert(rest == payload, 'garbled message')
+			assert(j == (seen[i] or 0) + 1, 'out of order')
+			seen[i] = j
+			lines = lines + 1
+		end
+	end
+	assert(lines == writers * rounds, lines)
+	print(format('%d messages from %d writers in %.3fs',
+		lines, writers, utils.updatenow() - t))
+end)
+
+-- vim: syntax=lua ts=2 sw=2 noet:
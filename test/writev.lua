@@ -0,0 +1,93 @@
+#!bin/lem
+--
+-- This file is part of LEM, a Lua Event Machine.
+--
+-- LEM is free software: you can redistribute it and/or modify it
+-- under the terms of the GNU Lesser General Public License as
+-- published by the Free Software Foundation, either version 3 of
+-- the License, or (at your option) any later version.
+--
+-- LEM is distributed in the hope that it will be useful, but
+-- WITHOUT ANY WARRANTY; without even the implied warranty of
+-- MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+-- GNU Lesser General Public License for more details.
+--
+-- You should have received a copy of the GNU Lesser General Public
+-- License along with LEM.  If not, see <http://www.gnu.org/licenses/>.
+--
+-- Count write syscalls per HTTP style response (status line, headers
+-- and body) when writing one argument at a time, like stream:write()
+-- used to, and when passing everything to a single gathering write.
+-- Needs /proc/self/io, so Linux only.
+
+package.path = '?.lua'
+package.cpath = '?.so;?.dll'
+
+local stdio = io
+local utils = require 'lem.utils'
+local io    = require 'lem.io'
+
+local format = string.format
+local n = tonumber(arg[1]) or 10000
+
+local function syscw()
+	local f = stdio.open('/proc/self/io')
+	if not f then return nil end
+	local c = f:read('*a'):match('syscw:%s*(%d+)')
+	f:close()
+	return tonumber(c)
+end
+
+if not syscw() then
+	print('no /proc/self/io, skipping')
+	return
+end
+
+local status = 'HTTP/1.1 200 OK\r\n'
+local headers = 'Content-Type: text/plain\r\nContent-Length: 13\r\n\r\n'
+local body = 'Hello, world!'
+local size = #status + #headers + #body
+
+local s1, s2 = assert(io.unix.socketpair())
+
+-- read everything written on the other end
+utils.spawn(function()
+	while s2:read(65536) do end
+end)
+
+local function bench(name, respond)
+	local before = syscw()
+	local t = utils.updatenow()
+	for i = 1, n do
+		respond()
+	end
+	t = utils.updatenow() - t
+	print(format('%-10s %5.2f syscalls/response %8.0f responses/s',
+		name, (syscw() - before) / n, n / t))
+end
+
+bench('separate', function()
+	assert(s1:write(status))
+	assert(s1:write(headers))
+	assert(s1:write(body))
+end)
+
+bench('gathered', function()
+	assert(s1:write(status, headers, body))
+end)
+
+local name = os.tmpname()
+local file = assert(io.open(name, 'w'))
+
+bench('file', function()
+	assert(file:write(status, headers, body))
+end)
+
+assert(file:close())
+file = assert(io.open(name))
+assert(file:size() == n * size)
+file:close()
+os.remove(name)
+s1:close()
+
+-- vim: syntax=lua ts=2 sw=2 noet: